@@ -0,0 +1,354 @@
+/* Host microbenchmarks for the nes6502 core
+ *
+ * Runs small hand-assembled 6502 loops against a bare CPU context (no
+ * PPU/APU/mapper) and reports throughput.  Build with `make -C host`,
+ * which also builds bench_cpu_predecode with NES6502_PREDECODE: both
+ * print a digest of the CPU state after a fixed run of each loop, and
+ * these must match.  The code loop is timed in BENCH_RUNS runs and the
+ * median reported with the spread, as a single run on a shared host
+ * varies by more than the two builds differ; to compare them, pin both
+ * to one core (taskset -c 0) and run them one after the other a few
+ * times.
+ *
+ *   bench_cpu [seconds] [extra_handlers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <noftypes.h>
+#include <cpu/nes6502.h>
+
+#define BENCH_HANDLERS 64
+#define BENCH_TIMESLICE 114 /* about one scanline */
+#define VERIFY_SLICES 100000
+#define BENCH_RUNS 9
+
+static uint8 ram[0x800];
+static uint8 sram[0x2000];
+static uint8 rom[0x8000];
+
+static nes6502_memread read_handlers[BENCH_HANDLERS];
+static nes6502_memwrite write_handlers[BENCH_HANDLERS];
+static nes6502_readfunc read_pages[NES6502_NUMPAGES];
+static nes6502_writefunc write_pages[NES6502_NUMPAGES];
+static nes6502_context context;
+
+static unsigned long io_reads, io_writes;
+
+static uint8 io_read(uint32 address)
+{
+   io_reads++;
+   return (uint8)address;
+}
+
+static void io_write(uint32 address, uint8 value)
+{
+   UNUSED(address);
+   UNUSED(value);
+   io_writes++;
+}
+
+static uint8 filler_read(uint32 address)
+{
+   UNUSED(address);
+   return 0xFF;
+}
+
+static void filler_write(uint32 address, uint8 value)
+{
+   UNUSED(address);
+   UNUSED(value);
+}
+
+/* memguard wants this from the OSD layer */
+void *mem_alloc(int size, bool prefer_fast_memory)
+{
+   UNUSED(prefer_fast_memory);
+   return malloc(size);
+}
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* lay out handlers the way build_address_handlers does: the stock
+** NES ones first, then <extra> sound/mapper handlers in $5xxx, then
+** the mapper's $8000-$FFFF write and the catch-alls
+*/
+static void setup_handlers(int extra)
+{
+   nes6502_memread *mr = read_handlers;
+   nes6502_memwrite *mw = write_handlers;
+   int i;
+
+#define ADD_READ(lo, hi, func) \
+   {                           \
+      mr->min_range = (lo);    \
+      mr->max_range = (hi);    \
+      mr->read_func = (func);  \
+      mr++;                    \
+   }
+#define ADD_WRITE(lo, hi, func) \
+   {                            \
+      mw->min_range = (lo);     \
+      mw->max_range = (hi);     \
+      mw->write_func = (func);  \
+      mw++;                     \
+   }
+
+   ADD_READ(0x0800, 0x1FFF, filler_read);
+   ADD_READ(0x2000, 0x3FFF, io_read);
+   ADD_READ(0x4000, 0x4015, filler_read);
+   ADD_READ(0x4016, 0x4017, io_read);
+   for (i = 0; i < extra; i++)
+      ADD_READ(0x5000 + i * 0x10, 0x5007 + i * 0x10, filler_read);
+   ADD_READ(0x4018, 0x5FFF, filler_read);
+   ADD_READ(-1, -1, NULL);
+
+   ADD_WRITE(0x0800, 0x1FFF, filler_write);
+   ADD_WRITE(0x2000, 0x3FFF, io_write);
+   ADD_WRITE(0x4000, 0x4013, filler_write);
+   ADD_WRITE(0x4015, 0x4015, filler_write);
+   ADD_WRITE(0x4014, 0x4017, filler_write);
+   for (i = 0; i < extra; i++)
+      ADD_WRITE(0x5000 + i * 0x10, 0x5007 + i * 0x10, filler_write);
+   ADD_WRITE(0x8000, 0xFFFF, io_write);
+   ADD_WRITE(0x4018, 0x5FFF, filler_write);
+   ADD_WRITE(0x8000, 0xFFFF, filler_write);
+   ADD_WRITE(-1, -1, NULL);
+}
+
+static void setup_cpu(const uint8 *code, int code_len, int extra)
+{
+   int i;
+
+   nes6502_freecode(&context);
+   memset(&context, 0, sizeof(context));
+   memset(ram, 0, sizeof(ram));
+   memset(sram, 0, sizeof(sram));
+   memset(rom, 0xEA, sizeof(rom)); /* NOP */
+   memcpy(rom, code, code_len);
+
+   /* reset vector -> $8000 */
+   rom[0x7FFC] = 0x00;
+   rom[0x7FFD] = 0x80;
+
+   setup_handlers(extra);
+
+   context.mem_page[0] = ram;
+   context.mem_page[6] = sram;
+   context.mem_page[7] = sram + 0x1000;
+   for (i = 8; i < NES6502_NUMBANKS; i++)
+      context.mem_page[i] = rom + ((i - 8) << NES6502_BANKSHIFT);
+
+   context.read_handler = read_handlers;
+   context.write_handler = write_handlers;
+   context.read_page = read_pages;
+   context.write_page = write_pages;
+   nes6502_buildpages(&context);
+
+   /* no-ops unless the core has the predecode cache */
+   nes6502_addcode(&context, rom, sizeof(rom));
+   nes6502_addcode(&context, sram, sizeof(sram));
+
+   nes6502_setcontext(&context);
+   nes6502_reset();
+}
+
+/* I/O heavy loop: PPU status poll, joypad read, mapper and PPU
+** register writes, plus a plain SRAM read/write for contrast
+*/
+static const uint8 mem_loop[] =
+{
+   0xA2, 0x00,       /* $8000 LDX #$00   */
+   0xAD, 0x02, 0x20, /* $8002 LDA $2002  */
+   0xAD, 0x16, 0x40, /*       LDA $4016  */
+   0x8D, 0x00, 0x80, /*       STA $8000  */
+   0x8D, 0x06, 0x20, /*       STA $2006  */
+   0xAD, 0x00, 0x60, /*       LDA $6000  */
+   0x8D, 0x01, 0x60, /*       STA $6001  */
+   0xCA,             /*       DEX        */
+   0xD0, 0xEB,       /*       BNE $8002  */
+   0x4C, 0x00, 0x80  /*       JMP $8000  */
+};
+
+/* plain ROM-resident code: zero page, RAM, SRAM and immediate
+** operands, branches and a subroutine call, but no I/O
+*/
+static const uint8 code_loop[] =
+{
+   0xA2, 0x00,       /* $8000 LDX #$00   */
+   0xA0, 0x10,       /* $8002 LDY #$10   */
+   0xA5, 0x10,       /* $8004 LDA $10    */
+   0x18,             /*       CLC        */
+   0x69, 0x03,       /*       ADC #$03   */
+   0x85, 0x10,       /*       STA $10    */
+   0x9D, 0x00, 0x02, /*       STA $0200,X */
+   0xBD, 0x00, 0x03, /*       LDA $0300,X */
+   0x29, 0x7F,       /*       AND #$7F   */
+   0x8D, 0x00, 0x60, /*       STA $6000  */
+   0x20, 0x20, 0x80, /*       JSR $8020  */
+   0xE8,             /*       INX        */
+   0x88,             /*       DEY        */
+   0xD0, 0xE7,       /*       BNE $8004  */
+   0x4C, 0x00, 0x80, /*       JMP $8000  */
+   0xC9, 0x40,       /* $8020 CMP #$40   */
+   0xB0, 0x02,       /*       BCS $8026  */
+   0x49, 0xFF,       /*       EOR #$FF   */
+   0x60              /*       RTS        */
+};
+
+/* self-modifying code in SRAM: rewrites the operand of a fused
+** LDA/STA pair, and flips a fused DEX/BNE into DEY/BNE and back
+*/
+static const uint8 smc_loop[] =
+{
+   0xA9, 0x00,       /* $6000 LDA #$00   */
+   0x85, 0x10,       /*       STA $10    */
+   0xEE, 0x01, 0x60, /*       INC $6001  */
+   0xAD, 0x12, 0x60, /*       LDA $6012  */
+   0x49, 0x42,       /*       EOR #$42   */
+   0x8D, 0x12, 0x60, /*       STA $6012  */
+   0xE6, 0x11,       /*       INC $11    */
+   0xEA,             /*       NOP        */
+   0xCA,             /* $6012 DEX / DEY  */
+   0xD0, 0xEB,       /*       BNE $6000  */
+   0x4C, 0x00, 0x60  /*       JMP $6000  */
+};
+
+static const uint8 smc_start[] =
+{
+   0x4C, 0x00, 0x60  /* $8000 JMP $6000  */
+};
+
+/* FNV-1a over memory, registers and cycle count */
+static uint32 hash_bytes(uint32 hash, const uint8 *data, int len)
+{
+   while (len--)
+   {
+      hash ^= *data++;
+      hash *= 16777619;
+   }
+
+   return hash;
+}
+
+static void verify(const char *name)
+{
+   uint32 hash = 2166136261u, cycles;
+   uint8 regs[6];
+   int i;
+
+   for (i = 0; i < VERIFY_SLICES; i++)
+      nes6502_execute(BENCH_TIMESLICE);
+
+   nes6502_getcontext(&context);
+   regs[0] = (uint8)context.pc_reg;
+   regs[1] = (uint8)(context.pc_reg >> 8);
+   regs[2] = context.a_reg;
+   regs[3] = context.x_reg;
+   regs[4] = context.y_reg;
+   regs[5] = context.p_reg;
+   cycles = nes6502_getcycles(false);
+
+   hash = hash_bytes(hash, regs, sizeof(regs));
+   hash = hash_bytes(hash, ram, sizeof(ram));
+   hash = hash_bytes(hash, sram, sizeof(sram));
+   hash = hash_bytes(hash, (uint8 *)&cycles, sizeof(cycles));
+
+   printf("state %-16s: %08X after %u cycles\n", name, hash, cycles);
+}
+
+static int compare_rates(const void *a, const void *b)
+{
+   double x = *(const double *)a, y = *(const double *)b;
+
+   return (x > y) - (x < y);
+}
+
+static void bench_code(double seconds)
+{
+   double start, elapsed, rate[BENCH_RUNS];
+   int run;
+
+   setup_cpu(code_loop, sizeof(code_loop), 0);
+
+   for (run = 0; run < BENCH_RUNS; run++)
+   {
+      unsigned long cycles = 0;
+
+      start = now();
+      do
+      {
+         int i;
+
+         for (i = 0; i < 10000; i++)
+            cycles += nes6502_execute(BENCH_TIMESLICE);
+         elapsed = now() - start;
+      } while (elapsed < seconds / BENCH_RUNS);
+
+      rate[run] = cycles / elapsed;
+   }
+
+   qsort(rate, BENCH_RUNS, sizeof(rate[0]), compare_rates);
+   printf("code                  : %8.2f M cycles/s (%.1fx NTSC 2A03), median of %d, %.2f to %.2f\n",
+          rate[BENCH_RUNS / 2] / 1e6, rate[BENCH_RUNS / 2] / 1789773.0, BENCH_RUNS,
+          rate[0] / 1e6, rate[BENCH_RUNS - 1] / 1e6);
+}
+
+static void bench_mem(double seconds, int extra)
+{
+   double start, elapsed;
+   unsigned long cycles = 0;
+
+   setup_cpu(mem_loop, sizeof(mem_loop), extra);
+   io_reads = io_writes = 0;
+
+   start = now();
+   do
+   {
+      int i;
+
+      for (i = 0; i < 10000; i++)
+         cycles += nes6502_execute(BENCH_TIMESLICE);
+      elapsed = now() - start;
+   } while (elapsed < seconds);
+
+   printf("mem  %2d extra handlers: %8.2f M handler reads/s, %8.2f M handler writes/s (%.1f M cycles/s)\n",
+          extra, io_reads / elapsed / 1e6, io_writes / elapsed / 1e6, cycles / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+   double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+   int extra = (argc > 2) ? atoi(argv[2]) : 24;
+
+   if (extra < 0 || extra > BENCH_HANDLERS - 16)
+      extra = BENCH_HANDLERS - 16;
+
+#ifdef NES6502_PREDECODE
+   printf("predecoded interpreter\n");
+#else  /* !NES6502_PREDECODE */
+   printf("plain interpreter\n");
+#endif /* !NES6502_PREDECODE */
+
+   setup_cpu(code_loop, sizeof(code_loop), 0);
+   verify("code");
+   setup_cpu(mem_loop, sizeof(mem_loop), extra);
+   verify("mem");
+   setup_cpu(smc_start, sizeof(smc_start), 0);
+   memcpy(sram, smc_loop, sizeof(smc_loop));
+   verify("self-modifying");
+
+   bench_code(seconds);
+   bench_mem(seconds, 0);
+   bench_mem(seconds, extra);
+
+   return 0;
+}
@@ -0,0 +1,163 @@
+/* Host multi-instance benchmark
+ *
+ * Built with NOFRENDO_MULTI_INSTANCE, so every thread has a machine
+ * of its own.  Runs the intro ROM, or each ROM given on the command
+ * line, once on its own for reference, then <threads> machines at a
+ * time, each on its own thread, and reports the total frames/s and
+ * whether every machine drew the same frames as the reference run.
+ *
+ *   bench_farm [threads] [frames] [rom.nes ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <noftypes.h>
+#include <osd.h>
+#include <bitmap.h>
+#include <vid_drv.h>
+#include <gui.h>
+#include <nes/nes.h>
+
+#define MAX_THREADS 64
+
+typedef struct
+{
+   const char *filename;
+   int frames;
+   uint32 hash;
+   int result;
+} job_t;
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* FNV-1a over the visible frame */
+static uint32 hash_frame(uint32 hash)
+{
+   bitmap_t *bmp = vid_getbuffer();
+   int x, y;
+
+   for (y = 0; y < NES_SCREEN_HEIGHT; y++)
+   {
+      for (x = 0; x < NES_SCREEN_WIDTH; x++)
+      {
+         hash ^= bmp->line[y][x];
+         hash *= 16777619;
+      }
+   }
+
+   return hash;
+}
+
+/* one machine, start to finish, on the calling thread */
+static void *run(void *arg)
+{
+   job_t *job = arg;
+   vidinfo_t video;
+   nes_t *machine;
+   int i;
+
+   job->result = -1;
+
+   /* the video buffer is per thread too */
+   osd_getvideoinfo(&video);
+   if (vid_init(video.default_width, video.default_height, video.driver) ||
+       vid_setmode(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT))
+      return NULL;
+
+   machine = nes_create();
+   if (NULL == machine || nes_insertcart(job->filename, machine))
+      return NULL;
+
+   bmp_clear(vid_getbuffer(), GUI_BLACK);
+   job->hash = 2166136261u;
+
+   for (i = 0; i < job->frames; i++)
+   {
+      nes_renderframe(true);
+      job->hash = hash_frame(job->hash);
+   }
+
+   /* not destroyed: rom_load() gets PRG/CHR from mem_alloc(), which
+   ** memguard doesn't know about, so nes_destroy() would assert
+   */
+
+   job->result = 0;
+   return NULL;
+}
+
+static void bench_rom(const char *filename, int threads, int frames)
+{
+   pthread_t thread[MAX_THREADS];
+   bool started[MAX_THREADS];
+   job_t reference, job[MAX_THREADS];
+   double start, single_fps, farm_fps;
+   int i, identical = 0;
+
+   reference.filename = filename;
+   reference.frames = frames;
+
+   start = now();
+   run(&reference);
+   single_fps = frames / (now() - start);
+
+   if (reference.result)
+   {
+      printf("%-24s: failed to load\n", filename);
+      return;
+   }
+
+   start = now();
+   for (i = 0; i < threads; i++)
+   {
+      job[i] = reference;
+      job[i].result = -1;
+      started[i] = (0 == pthread_create(&thread[i], NULL, run, &job[i]));
+   }
+
+   for (i = 0; i < threads; i++)
+   {
+      if (started[i])
+         pthread_join(thread[i], NULL);
+   }
+   farm_fps = threads * frames / (now() - start);
+
+   for (i = 0; i < threads; i++)
+   {
+      if (0 == job[i].result && job[i].hash == reference.hash)
+         identical++;
+   }
+
+   printf("%-24s: 1 machine %8.1f fps, %d machines %8.1f fps total (%.2fx), "
+          "%d/%d drew identical frames\n",
+          filename, single_fps, threads, farm_fps, farm_fps / single_fps,
+          identical, threads);
+}
+
+int main(int argc, char *argv[])
+{
+   int threads = (argc > 1) ? atoi(argv[1]) : 4;
+   int frames = (argc > 2) ? atoi(argv[2]) : 3000;
+   int i;
+
+   if (threads <= 0 || threads > MAX_THREADS)
+      threads = 4;
+   if (frames <= 0)
+      frames = 3000;
+
+   if (argc <= 3)
+      bench_rom("(intro)", threads, frames);
+
+   for (i = 3; i < argc; i++)
+      bench_rom(argv[i], threads, frames);
+
+   return 0;
+}
@@ -0,0 +1,407 @@
+/* Host frame benchmark
+ *
+ * Runs the intro ROM, or each ROM given on the command line, for a
+ * number of frames with no pacing: stopping the CPU at every scanline
+ * (the old frame loop), on the event timeline, and on the timeline
+ * with idle loop skipping, and reports frames/s for each plus whether
+ * they all drew the same frames.  The APU mixes a frame's worth of
+ * sound after every frame, as on the ESP32.
+ *
+ * The last configuration is then run once more with the time spent in
+ * nes6502_execute, ppu_scanline and apu_process measured (the link
+ * wraps the first two), and CPU instructions/s reported.  Only this
+ * run writes the files given with -v (frames as binary PPMs) and -a
+ * (raw 16-bit mono PCM at 22050 Hz), and -i drives joypad 1 from a
+ * script (see host_openinput) in every run.  If the PPU has the
+ * background line cache, its hit rate is reported too, as an average
+ * and the worst of any one frame.  Idle loop skipping is also run
+ * drawing only every other frame, as frame skipping on the ESP32 does:
+ * sprite 0 hits don't depend on drawing, so the frames it does draw
+ * must be the same as theirs in the runs that draw them all.  Not for
+ * MMC2/MMC4, whose latches only see the pattern fetches of frames
+ * drawn; nor for CHR-RAM that's never written, which comes up with
+ * different garbage in each run.  And once more with 8 lines of
+ * overscan cut off top and bottom, which the PPU doesn't draw: the
+ * lines left must be the same as in the run that draws them all.
+ *
+ * Every run checks that the timeline is rebased onto the CPU's cycle
+ * count after each frame, and idle loop skipping is run for
+ * LONG_RUN_FRAMES on top, past where cycles since a fixed base would
+ * have overflowed an int32 of master clocks (~6000 frames).
+ *
+ * bench_frame_profile has the CPU profiler built in, and leaves the
+ * profile of the last run of each ROM in <rom>.prof for profsym.
+ * bench_frame_deferred is built with NOFRENDO_DEFERRED_RENDER, and
+ * runs idle loop skipping once more with the lines drawn on a thread
+ * of their own, which must draw the same frames.
+ *
+ *   bench_frame [-v video.ppm] [-a audio.raw] [-i input.txt] [frames] [rom.nes ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <noftypes.h>
+#include <osd.h>
+#include <bitmap.h>
+#include <vid_drv.h>
+#include <gui.h>
+#include <nes/nes.h>
+
+#include "host_osd.h"
+
+/* 2 minutes of play */
+#define LONG_RUN_FRAMES 7200
+
+enum
+{
+   SECTION_CPU,
+   SECTION_PPU,
+   SECTION_APU,
+   SECTION_OTHER,
+   NUM_SECTIONS
+};
+
+typedef struct
+{
+   double fps, ips, idle_share;
+   double bg_hits;
+   int bg_hits_min;
+   double section_time[NUM_SECTIONS];
+   uint32 hash;
+   uint32 drawn_hash; /* of every other frame, the ones skipping draws */
+   uint32 cropped_hash; /* of what 8 lines of overscan leave, see run */
+   int drift_frame; /* the first with the timeline not rebased, or -1 */
+} result_t;
+
+static const char *video_file = NULL, *audio_file = NULL;
+
+/* time split, only kept while timing is on */
+static bool timing = false;
+static int section = SECTION_OTHER;
+static double section_mark, section_time[NUM_SECTIONS];
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* charge the time since the last switch to the running section, and
+** switch to <next>, returns the one to go back to
+*/
+static int enter_section(int next)
+{
+   double t = now();
+   int old = section;
+
+   section_time[section] += t - section_mark;
+   section_mark = t;
+   section = next;
+
+   return old;
+}
+
+extern int __real_nes6502_execute(int timeslice_cycles);
+extern void __real_ppu_scanline(bitmap_t *bmp, int scanline, uint32 cycle, bool draw_flag);
+
+int __wrap_nes6502_execute(int timeslice_cycles)
+{
+   int old, cycles;
+
+   if (false == timing)
+      return __real_nes6502_execute(timeslice_cycles);
+
+   old = enter_section(SECTION_CPU);
+   cycles = __real_nes6502_execute(timeslice_cycles);
+   enter_section(old);
+
+   return cycles;
+}
+
+/* lazy catch-up calls this from inside nes6502_execute */
+void __wrap_ppu_scanline(bitmap_t *bmp, int scanline, uint32 cycle, bool draw_flag)
+{
+   int old;
+
+   if (false == timing)
+   {
+      __real_ppu_scanline(bmp, scanline, cycle, draw_flag);
+      return;
+   }
+
+   old = enter_section(SECTION_PPU);
+   __real_ppu_scanline(bmp, scanline, cycle, draw_flag);
+   enter_section(old);
+}
+
+/* FNV-1a over lines <first_line> to <end_line> - 1 of the frame */
+static uint32 hash_frame(uint32 hash, int first_line, int end_line)
+{
+   bitmap_t *bmp = vid_getbuffer();
+   int x, y;
+
+   for (y = first_line; y < end_line; y++)
+   {
+      for (x = 0; x < NES_SCREEN_WIDTH; x++)
+      {
+         hash ^= bmp->line[y][x];
+         hash *= 16777619;
+      }
+   }
+
+   return hash;
+}
+
+static int run(const char *filename, int frames, bool line_sync, bool idle,
+               bool deferred, bool skip, int overscan, bool timed, result_t *result)
+{
+   nes_t *machine;
+   double start, pause, idle_cycles = 0;
+   int i, hits, hit_frames = 0;
+
+   machine = nes_create();
+   if (NULL == machine || nes_insertcart(filename, machine))
+      return -1;
+
+   nes_setlinesync(line_sync);
+   nes6502_setidle(idle);
+   ppu_setdeferred(deferred);
+   vid_setoverscan(overscan, overscan, 0, 0);
+   osd_setsound(machine->apu->process);
+   bmp_clear(vid_getbuffer(), GUI_BLACK);
+   result->hash = result->drawn_hash = result->cropped_hash = 2166136261u;
+   result->drift_frame = -1;
+
+   if (timed)
+   {
+      if (video_file && host_openvideo(video_file))
+         printf("can't write %s\n", video_file);
+      if (audio_file && host_openaudio(audio_file))
+         printf("can't write %s\n", audio_file);
+
+      memset(section_time, 0, sizeof(section_time));
+      section = SECTION_OTHER;
+      timing = true;
+   }
+
+   result->bg_hits = 0;
+   result->bg_hits_min = 100;
+   ppu_getbgcachehits(true);
+
+   nes6502_getinstructions(true);
+   start = section_mark = now();
+   for (i = 0; i < frames; i++)
+   {
+      host_startframe(i);
+      nes_renderframe(false == skip || 0 == (i & 1));
+      idle_cycles += nes_getcontextptr()->idle_cycles;
+
+      /* the timeline starts each frame where the CPU is */
+      if (result->drift_frame < 0 && nes6502_getcycles(false) != nes_getcontextptr()->cycle_base)
+         result->drift_frame = i;
+
+      if (timing)
+      {
+         int old = enter_section(SECTION_APU);
+         host_mixsound();
+         enter_section(old);
+      }
+      else
+      {
+         host_mixsound();
+      }
+
+      /* the benchmark's own work isn't charged to anything */
+      pause = now();
+      result->hash = hash_frame(result->hash, 0, NES_SCREEN_HEIGHT);
+      result->cropped_hash = hash_frame(result->cropped_hash, 8, NES_SCREEN_HEIGHT - 8);
+      if (0 == (i & 1))
+         result->drawn_hash = hash_frame(result->drawn_hash, 0, NES_SCREEN_HEIGHT);
+
+      hits = ppu_getbgcachehits(true);
+      if (hits >= 0)
+      {
+         result->bg_hits += hits;
+         if (hits < result->bg_hits_min)
+            result->bg_hits_min = hits;
+         hit_frames++;
+      }
+      host_writeframe();
+      pause = now() - pause;
+      section_mark += pause;
+      start += pause;
+   }
+   result->fps = frames / (now() - start);
+   result->ips = nes6502_getinstructions(true) / (frames / result->fps);
+   result->idle_share = idle_cycles / (frames * (262 * 1364 / 12.0));
+   result->bg_hits = hit_frames ? result->bg_hits / hit_frames : -1;
+
+   if (timed)
+   {
+      enter_section(SECTION_OTHER);
+      memcpy(result->section_time, section_time, sizeof(section_time));
+      timing = false;
+      host_close();
+   }
+
+   /* not destroyed: rom_load() gets PRG/CHR from mem_alloc(), which
+   ** memguard doesn't know about, so nes_destroy() would assert; but
+   ** the render thread, if there is one, is stopped
+   */
+   ppu_setdeferred(false);
+   vid_setoverscan(0, 0, 0, 0);
+
+   return 0;
+}
+
+#ifdef NES6502_PROFILE
+static FILE *prof_fp;
+
+static void prof_write(const uint8 *data, int len)
+{
+   fwrite(data, 1, len, prof_fp);
+}
+
+static void save_profile(const char *filename)
+{
+   char profname[PATH_MAX];
+   const char *base = strrchr(filename, '/');
+
+   base = base ? base + 1 : filename;
+   if ('(' == *base)
+      base = "intro";
+   snprintf(profname, sizeof(profname), "%s.prof", base);
+
+   prof_fp = fopen(profname, "wb");
+   if (NULL == prof_fp)
+      return;
+
+   nes6502_profdump(prof_write, true);
+   fclose(prof_fp);
+   printf("%-24s: profile in %s\n", filename, profname);
+}
+#endif /* NES6502_PROFILE */
+
+static void bench_rom(const char *filename, int frames)
+{
+   result_t line, event, idle, skip, cropped, timed, long_run;
+#ifdef NOFRENDO_DEFERRED_RENDER
+   result_t deferred;
+#endif /* NOFRENDO_DEFERRED_RENDER */
+   double total;
+   int i;
+
+   if (run(filename, frames, true, false, false, false, 0, false, &line) ||
+       run(filename, frames, false, false, false, false, 0, false, &event) ||
+       run(filename, frames, false, true, false, false, 0, false, &idle) ||
+       run(filename, frames, false, true, false, true, 0, false, &skip) ||
+       run(filename, frames, false, true, false, false, 8, false, &cropped) ||
+       run(filename, frames, false, true, false, false, 0, true, &timed) ||
+       run(filename, LONG_RUN_FRAMES, false, true, false, false, 0, false, &long_run))
+   {
+      printf("%-24s: failed to load\n", filename);
+      return;
+   }
+
+   printf("%-24s: per-scanline %8.1f fps, timeline %8.1f fps (%+.1f%%), "
+          "idle skip %8.1f fps (%+.1f%%, %.1f%% of cycles), frames %s\n",
+          filename, line.fps, event.fps, (event.fps / line.fps - 1.0) * 100.0,
+          idle.fps, (idle.fps / line.fps - 1.0) * 100.0, idle.idle_share * 100.0,
+          (line.hash == event.hash && line.hash == idle.hash && line.hash == timed.hash) ? "identical" : "DIFFER");
+
+   printf("%-24s: idle skip drawing every other frame %8.1f fps (%+.1f%%), drawn frames %s\n",
+          filename, skip.fps, (skip.fps / idle.fps - 1.0) * 100.0,
+          (skip.drawn_hash == idle.drawn_hash) ? "identical" : "DIFFER");
+
+   printf("%-24s: idle skip with 8 lines of overscan %8.1f fps (%+.1f%%), lines shown %s\n",
+          filename, cropped.fps, (cropped.fps / idle.fps - 1.0) * 100.0,
+          (cropped.cropped_hash == idle.cropped_hash) ? "identical" : "DIFFER");
+
+   if (line.drift_frame < 0 && event.drift_frame < 0 && idle.drift_frame < 0 && skip.drift_frame < 0 &&
+       cropped.drift_frame < 0 && timed.drift_frame < 0 && long_run.drift_frame < 0)
+      printf("%-24s: timeline rebased every frame, %d frames in the long run\n", filename, LONG_RUN_FRAMES);
+   else
+      printf("%-24s: timeline NOT rebased after every frame\n", filename);
+
+   for (total = 0, i = 0; i < NUM_SECTIONS; i++)
+      total += timed.section_time[i];
+
+   printf("%-24s: %8.2f M instructions/s, time in nes6502_execute %.1f%%, "
+          "ppu_scanline %.1f%%, apu_process %.1f%%, other %.1f%%\n",
+          filename, idle.ips / 1e6,
+          timed.section_time[SECTION_CPU] * 100.0 / total,
+          timed.section_time[SECTION_PPU] * 100.0 / total,
+          timed.section_time[SECTION_APU] * 100.0 / total,
+          timed.section_time[SECTION_OTHER] * 100.0 / total);
+
+   if (idle.bg_hits >= 0)
+      printf("%-24s: background line cache hits %.1f%% a frame, worst %d%%\n",
+             filename, idle.bg_hits, idle.bg_hits_min);
+
+#ifdef NOFRENDO_DEFERRED_RENDER
+   if (0 == run(filename, frames, false, true, true, false, 0, false, &deferred))
+      printf("%-24s: deferred rendering %8.1f fps (%+.1f%% on idle skip), frames %s\n",
+             filename, deferred.fps, (deferred.fps / idle.fps - 1.0) * 100.0,
+             (deferred.hash == idle.hash) ? "identical" : "DIFFER");
+#endif /* NOFRENDO_DEFERRED_RENDER */
+
+#ifdef NES6502_PROFILE
+   save_profile(filename);
+#endif /* NES6502_PROFILE */
+}
+
+int main(int argc, char *argv[])
+{
+   vidinfo_t video;
+   int frames = 3000;
+   int opt, i;
+
+   while (-1 != (opt = getopt(argc, argv, "v:a:i:")))
+   {
+      switch (opt)
+      {
+      case 'v':
+         video_file = optarg;
+         break;
+
+      case 'a':
+         audio_file = optarg;
+         break;
+
+      case 'i':
+         if (host_openinput(optarg))
+         {
+            printf("can't read %s\n", optarg);
+            return 1;
+         }
+         break;
+
+      default:
+         printf("usage: %s [-v video.ppm] [-a audio.raw] [-i input.txt] [frames] [rom.nes ...]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   if (optind < argc)
+      frames = atoi(argv[optind++]);
+   if (frames <= 0)
+      frames = 3000;
+
+   osd_getvideoinfo(&video);
+   if (vid_init(video.default_width, video.default_height, video.driver) ||
+       vid_setmode(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT))
+      return 1;
+
+   if (optind >= argc)
+      bench_rom("(intro)", frames);
+
+   for (i = optind; i < argc; i++)
+      bench_rom(argv[i], frames);
+
+   return 0;
+}
@@ -0,0 +1,153 @@
+/* Host PPU scanline benchmark
+ *
+ * Runs the intro ROM, or each ROM given on the command line, for some
+ * frames to get to a real screen, then draws that screen's 240 lines
+ * over and over from the same PPU state and reports scanlines/s: with
+ * the decoded CHR and background line caches kept warm, and with them
+ * flushed before every frame.  Build with `make -C host`, which also
+ * builds bench_ppu_nocache with both caches off, and bench_ppu_generic
+ * with them off and the one scanline renderer that tests the mapper
+ * and sprite size as it goes instead of the variants made for them:
+ * all print a digest of the screen they drew, and these must match.
+ *
+ *   bench_ppu [seconds] [frames] [rom.nes ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <noftypes.h>
+#include <osd.h>
+#include <bitmap.h>
+#include <vid_drv.h>
+#include <gui.h>
+#include <nes/nes.h>
+
+static ppu_t saved_ppu;
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* FNV-1a over the visible frame */
+static uint32 hash_frame(uint32 hash)
+{
+   bitmap_t *bmp = vid_getbuffer();
+   int x, y;
+
+   for (y = 0; y < NES_SCREEN_HEIGHT; y++)
+   {
+      for (x = 0; x < NES_SCREEN_WIDTH; x++)
+      {
+         hash ^= bmp->line[y][x];
+         hash *= 16777619;
+      }
+   }
+
+   return hash;
+}
+
+/* the saved screen, once, from the top */
+static void draw_frame(bool flush)
+{
+   bitmap_t *bmp = vid_getbuffer();
+   int line;
+
+   ppu_setcontext(&saved_ppu);
+   if (flush)
+      ppu_flushchr(&saved_ppu);
+
+   for (line = 0; line < NES_SCREEN_HEIGHT; line++)
+   {
+      ppu_scanline(bmp, line, 0, true);
+      ppu_endscanline(line);
+   }
+}
+
+static double bench_lines(double seconds, bool flush)
+{
+   double start, elapsed;
+   unsigned long lines = 0;
+
+   start = now();
+   do
+   {
+      int i;
+
+      for (i = 0; i < 100; i++)
+         draw_frame(flush);
+      lines += 100 * NES_SCREEN_HEIGHT;
+      elapsed = now() - start;
+   } while (elapsed < seconds);
+
+   return lines / elapsed;
+}
+
+static void bench_rom(const char *filename, double seconds, int frames)
+{
+   nes_t *machine;
+   double warm, cold;
+   uint32 hash;
+   int i;
+
+   machine = nes_create();
+   if (NULL == machine || nes_insertcart(filename, machine))
+   {
+      printf("%-24s: failed to load\n", filename);
+      return;
+   }
+
+   bmp_clear(vid_getbuffer(), GUI_BLACK);
+   for (i = 0; i < frames; i++)
+      nes_renderframe(true);
+
+   /* the state at the end of a frame is where the next one starts */
+   ppu_getcontext(&saved_ppu);
+
+   draw_frame(true);
+   hash = hash_frame(2166136261u);
+
+   warm = bench_lines(seconds, false);
+   cold = bench_lines(seconds, true);
+
+   printf("%-24s: %8.0f scanlines/s warm, %8.0f scanlines/s flushed every frame, screen %08X\n",
+          filename, warm, cold, hash);
+
+   /* not destroyed: rom_load() gets PRG/CHR from mem_alloc(), which
+   ** memguard doesn't know about, so nes_destroy() would assert
+   */
+}
+
+int main(int argc, char *argv[])
+{
+   vidinfo_t video;
+   double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+   int frames = (argc > 2) ? atoi(argv[2]) : 600;
+   int i;
+
+   if (seconds <= 0)
+      seconds = 1.0;
+   if (frames <= 0)
+      frames = 600;
+
+   printf("CHR cache of %d tiles, background line cache of %d nametables, %s renderers\n",
+          PPU_CHRCACHE_TILES, PPU_BGCACHE_TABLES, PPU_RENDERVARIANTS ? "specialised" : "generic");
+
+   osd_getvideoinfo(&video);
+   if (vid_init(video.default_width, video.default_height, video.driver) ||
+       vid_setmode(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT))
+      return 1;
+
+   if (argc <= 3)
+      bench_rom("(intro)", seconds, frames);
+
+   for (i = 3; i < argc; i++)
+      bench_rom(argv[i], seconds, frames);
+
+   return 0;
+}
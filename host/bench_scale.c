@@ -0,0 +1,525 @@
+/* Host LCD scaler benchmark
+ *
+ * Runs the intro ROM, or each ROM given on the command line, and puts
+ * every frame through vid_scale onto a simulated 480x320 RGB565 LCD,
+ * as display.cpp does.  Every 60th frame is also checked against the
+ * old per-pixel loop of display_write_frame (the scale_x/scale_y
+ * tables and a byte swap of the palette) and against the same frame
+ * done in bands of 1 to 16 lines, and the scaler with 8 pixels of
+ * overscan cut off each edge against a per column gather through its
+ * tables.  Then the scaler is timed on the last frame, against that
+ * gather (what vid_scale did before it copied repeated rows and
+ * expanded 4 pixels at a time) and the old loop, and in each of the
+ * scaling modes, checked against the gather too.  The smooth rows are
+ * timed against them in each mode, and checked against mixing each
+ * channel of each column on its own.
+ *
+ * Built for whole frames, each frame is flushed and taken back out of
+ * the video driver's pool, and only its dirty bands are scaled onto
+ * the LCD, as display.cpp does: the checks above are of what that
+ * leaves on it, and how much of it had to be sent is reported.
+ *
+ * bench_scale_stream is built with NOFRENDO_LINE_STREAM, and gets the
+ * LCD a band at a time straight out of the video driver's line ring,
+ * as the firmware does.  Both print a digest of the LCD over all the
+ * frames, and these must match.
+ *
+ * bench_scale_rgb565 is built with NOFRENDO_RGB565, and scales the
+ * lines the PPU resolved to RGB565 instead, checking every 60th frame
+ * that each is its 8-bit line through the palette.  Its digest must
+ * match too, and its times are for resolving a frame and scaling it,
+ * nearest and smooth, against the palette scaler's; its smooth rows
+ * must be the palette's.
+ *
+ *   bench_scale [seconds] [frames] [rom.nes ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <noftypes.h>
+#include <osd.h>
+#include <bitmap.h>
+#include <vid_drv.h>
+#include <vid_scale.h>
+#include <gui.h>
+#include <nes/nes.h>
+
+#include "host_osd.h"
+
+#define LCD_WIDTH 480
+#define LCD_HEIGHT 320
+
+static vidscale_t scale;
+static uint16 rgb565[256];
+static uint16 lcd[LCD_WIDTH * LCD_HEIGHT];
+static uint16 check[LCD_WIDTH * LCD_HEIGHT];
+
+/* display.cpp before vid_scale */
+static uint16 ref_x[LCD_WIDTH];
+static uint8 ref_y[LCD_HEIGHT];
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* FNV-1a over the LCD */
+static uint32 hash_lcd(uint32 hash)
+{
+   int i;
+
+   for (i = 0; i < LCD_WIDTH * LCD_HEIGHT; i++)
+   {
+      hash ^= lcd[i];
+      hash *= 16777619;
+   }
+
+   return hash;
+}
+
+/* the palette as osd.c's set_palette() makes it */
+static void get_palette(void)
+{
+   rgb_t *pal = nes_getcontextptr()->ppu->curpal;
+   int i;
+
+   for (i = 0; i < 256; i++)
+      rgb565[i] = (pal[i].b >> 3) + ((pal[i].g >> 2) << 5) + ((pal[i].r >> 3) << 11);
+
+   vidscale_setpalette(&scale, rgb565);
+}
+
+#ifndef NOFRENDO_RGB565
+static void ref_frame(uint8 **lines, uint16 *dest)
+{
+   int x, y;
+
+   for (y = 0; y < LCD_HEIGHT; y++, dest += LCD_WIDTH)
+   {
+      const uint8 *src = lines[ref_y[y]];
+
+      for (x = 0; x < LCD_WIDTH; x++)
+      {
+         uint16 c = rgb565[src[ref_x[x]]];
+         dest[x] = (c >> 8) | (c << 8);
+      }
+   }
+}
+
+/* every row on its own, every column through the tables */
+static void gather_frame(const vidscale_t *scale, uint8 **lines, uint16 *dest)
+{
+   int x, y;
+
+   for (y = 0; y < scale->height; y++, dest += scale->width)
+   {
+      const uint8 *src = lines[scale->line[y]];
+
+      for (x = 0; x < scale->width; x++)
+         dest[x] = scale->palette[src[scale->col[x]]];
+   }
+}
+
+/* smooth rows the slow way: each channel of each column mixed on its
+** own, from the unswapped palette
+*/
+static void smooth_gather(const vidscale_t *scale, uint8 **lines, uint16 *dest)
+{
+   static const int shift[3] = { 11, 5, 0 }, mask[3] = { 31, 63, 31 };
+   int x, y, i;
+
+   for (y = 0; y < scale->height; y++, dest += scale->width)
+   {
+      const uint8 *src = lines[scale->line[y]];
+
+      for (x = 0; x < scale->width; x++)
+      {
+         int w = scale->blend[x];
+         uint16 a = rgb565[src[scale->col[x]]];
+         uint16 b = w ? rgb565[src[scale->col[x] + 1]] : a;
+         uint16 c = 0;
+
+         for (i = 0; i < 3; i++)
+         {
+            int ca = (a >> shift[i]) & mask[i], cb = (b >> shift[i]) & mask[i];
+            c |= ((ca * (VIDSCALE_BLEND_ONE - w) + cb * w) / VIDSCALE_BLEND_ONE) << shift[i];
+         }
+
+         dest[x] = (c >> 8) | (c << 8);
+      }
+   }
+}
+#endif /* !NOFRENDO_RGB565 */
+
+static void scale_frame(uint8 **lines, uint16 *dest)
+{
+   vidscale_fill(&scale, lines, 0, LCD_HEIGHT, dest);
+}
+
+#ifdef NOFRENDO_RGB565
+static void scale_frame16(uint16 **lines, uint16 *dest)
+{
+   vidscale_fill16(&scale, lines, 0, LCD_HEIGHT, dest);
+}
+
+/* what the PPU does to each line as it finishes it */
+static void resolve_frame(const bitmap_t *bmp)
+{
+   int x, y;
+
+   for (y = 0; y < NES_SCREEN_HEIGHT; y++)
+      for (x = 0; x < NES_SCREEN_WIDTH; x++)
+         bmp->line16[y][x] = bmp->rgb565[bmp->line[y][x]];
+}
+
+/* each RGB565 line must be its 8-bit one through the palette */
+static bool check_resolved(const bitmap_t *bmp)
+{
+   int x, y;
+
+   for (y = 0; y < NES_SCREEN_HEIGHT; y++)
+      for (x = 0; x < NES_SCREEN_WIDTH; x++)
+         if (bmp->line16[y][x] != scale.palette[bmp->line[y][x]])
+            return false;
+
+   return true;
+}
+#endif /* NOFRENDO_RGB565 */
+
+#ifdef NOFRENDO_LINE_STREAM
+/* a band of lines from the driver, to where on the LCD they go */
+static void stream_sink(uint8 *const *lines, int first_line, int num_lines)
+{
+   vidscale_band(&scale, lines, first_line, num_lines,
+                 lcd + scale.first_row[first_line] * LCD_WIDTH);
+}
+#elif !defined(NOFRENDO_RGB565)
+static vidscale_t cropped;
+
+/* the old loop, and every band height, must draw the same LCD; and
+** the scaler its own tables, for a window that doesn't start at 0
+*/
+static bool check_frame(uint8 **lines)
+{
+   int band, line;
+
+   vidscale_setpalette(&cropped, rgb565);
+   gather_frame(&cropped, lines, check);
+   vidscale_fill(&cropped, lines, 0, LCD_HEIGHT, lcd);
+   if (memcmp(check, lcd, sizeof(lcd)))
+      return false;
+   scale_frame(lines, lcd);
+
+   ref_frame(lines, check);
+   if (memcmp(check, lcd, sizeof(lcd)))
+      return false;
+
+   for (band = 1; band <= 16; band++)
+   {
+      uint16 *dest = check;
+
+      memset(check, 0, sizeof(check));
+      for (line = 0; line < NES_SCREEN_HEIGHT; line += band)
+      {
+         int num_lines = (line + band <= NES_SCREEN_HEIGHT) ? band : NES_SCREEN_HEIGHT - line;
+         dest += vidscale_band(&scale, lines, line, num_lines, dest) * LCD_WIDTH;
+      }
+
+      if (memcmp(check, lcd, sizeof(lcd)))
+         return false;
+   }
+
+   return true;
+}
+#endif /* !NOFRENDO_LINE_STREAM && !NOFRENDO_RGB565 */
+
+/* the ways to the LCD timed */
+static void scale_bmp(bitmap_t *bmp)
+{
+   scale_frame(bmp->line, lcd);
+}
+
+static void smooth_bmp(bitmap_t *bmp)
+{
+   scale.smooth = true;
+   vidscale_fill(&scale, bmp->line, 0, scale.height, lcd);
+   scale.smooth = false;
+}
+
+#ifdef NOFRENDO_RGB565
+static void resolve_scale_bmp(bitmap_t *bmp)
+{
+   resolve_frame(bmp);
+   scale_frame16(bmp->line16, lcd);
+}
+
+static void smooth_resolve_scale_bmp(bitmap_t *bmp)
+{
+   resolve_frame(bmp);
+   scale.smooth = true;
+   scale_frame16(bmp->line16, lcd);
+   scale.smooth = false;
+}
+#else  /* !NOFRENDO_RGB565 */
+static void gather_bmp(bitmap_t *bmp)
+{
+   gather_frame(&scale, bmp->line, lcd);
+}
+
+static void ref_bmp(bitmap_t *bmp)
+{
+   ref_frame(bmp->line, lcd);
+}
+
+static void mode_bmp(bitmap_t *bmp)
+{
+   vidscale_fill(&scale, bmp->line, 0, scale.height, lcd);
+}
+#endif /* !NOFRENDO_RGB565 */
+
+static double time_frames(void (*draw)(bitmap_t *bmp), bitmap_t *bmp, double seconds)
+{
+   double start, elapsed;
+   int runs = 0;
+
+   start = now();
+   do
+   {
+      draw(bmp);
+      runs++;
+      elapsed = now() - start;
+   } while (elapsed < seconds);
+
+   return runs / elapsed;
+}
+
+#ifndef NOFRENDO_RGB565
+/* each mode's area of the LCD, how fast, nearest and smooth, and
+** drawn right
+*/
+static void bench_modes(bitmap_t *bmp, double seconds)
+{
+   static const char *names[VIDSCALE_MODES] = { "stretch", "1x", "8:7", "4:3", "cropped" };
+   vidscale_t saved = scale;
+   size_t size;
+   double fps, smooth_fps;
+   bool nearest_ok, smooth_ok;
+   int mode;
+
+   for (mode = 0; mode < VIDSCALE_MODES; mode++)
+   {
+      vidscale_setmode(&scale, mode, 0, 0, NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, LCD_WIDTH, LCD_HEIGHT);
+      vidscale_setpalette(&scale, rgb565);
+      size = scale.width * scale.height * sizeof(uint16);
+
+      gather_frame(&scale, bmp->line, check);
+      mode_bmp(bmp);
+      nearest_ok = (0 == memcmp(check, lcd, size));
+      smooth_gather(&scale, bmp->line, check);
+      smooth_bmp(bmp);
+      smooth_ok = (0 == memcmp(check, lcd, size));
+
+      fps = time_frames(mode_bmp, bmp, seconds);
+      smooth_fps = time_frames(smooth_bmp, bmp, seconds);
+
+      printf("%24s  %-8s %3dx%3d at %3d,%3d: %7.1f frames/s, smooth %7.1f frames/s%s%s\n", "", names[mode],
+             scale.width, scale.height, scale.x, scale.y, fps, smooth_fps,
+             nearest_ok ? "" : ", DIFFERS from the gather",
+             smooth_ok ? "" : ", smooth DIFFERS from the channel mix");
+   }
+
+   scale = saved;
+}
+#endif /* !NOFRENDO_RGB565 */
+
+#ifndef NOFRENDO_LINE_STREAM
+/* the frame just drawn through the pool, and only the rows of it the
+** video driver says changed onto the LCD; how many rows that was
+*/
+static int flush_dirties(int *whole)
+{
+   rect_t dirty_rects[VID_MAX_DIRTIES];
+   bitmap_t *bmp;
+   int num_dirties, i, first_row, end_row, rows = 0;
+
+   vid_flush();
+   bmp = vid_takeframe();
+   num_dirties = vid_getdirties(dirty_rects);
+
+   if (num_dirties < 0)
+   {
+      (*whole)++;
+      num_dirties = 1;
+      dirty_rects[0].y = 0;
+      dirty_rects[0].h = NES_SCREEN_HEIGHT;
+   }
+
+   for (i = 0; i < num_dirties; i++)
+   {
+      first_row = scale.first_row[dirty_rects[i].y];
+      end_row = scale.first_row[dirty_rects[i].y + dirty_rects[i].h];
+#ifdef NOFRENDO_RGB565
+      vidscale_fill16(&scale, bmp->line16, first_row, end_row - first_row, lcd + first_row * LCD_WIDTH);
+#else  /* !NOFRENDO_RGB565 */
+      vidscale_fill(&scale, bmp->line, first_row, end_row - first_row, lcd + first_row * LCD_WIDTH);
+#endif /* !NOFRENDO_RGB565 */
+      rows += end_row - first_row;
+   }
+
+   return rows;
+}
+#endif /* !NOFRENDO_LINE_STREAM */
+
+static void bench_rom(const char *filename, double seconds, int frames)
+{
+   nes_t *machine;
+   bitmap_t *bmp;
+   double new_fps, smooth_fps, ref_fps;
+#ifdef NOFRENDO_RGB565
+   double ref_smooth_fps;
+#else  /* !NOFRENDO_RGB565 */
+   double gather_fps;
+#endif /* !NOFRENDO_RGB565 */
+   uint32 hash = 2166136261u;
+   bool identical = true;
+   int i;
+#ifndef NOFRENDO_LINE_STREAM
+   int rows = 0, whole = 0;
+#endif /* !NOFRENDO_LINE_STREAM */
+
+   machine = nes_create();
+   if (NULL == machine || nes_insertcart(filename, machine))
+   {
+      printf("%-24s: failed to load\n", filename);
+      return;
+   }
+
+   /* a new game: nothing on the LCD to keep */
+   vid_setmode(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT);
+   bmp_clear(vid_getbuffer(), GUI_BLACK);
+   memset(lcd, 0, sizeof(lcd));
+   get_palette();
+
+   for (i = 0; i < frames; i++)
+   {
+      nes_renderframe(true);
+      get_palette();
+
+#if defined(NOFRENDO_RGB565)
+      bmp = vid_getbuffer();
+      if (0 == i % 60 && false == check_resolved(bmp))
+         identical = false;
+      rows += flush_dirties(&whole);
+      if (0 == i % 60)
+      {
+         scale_frame16(bmp->line16, check);
+         if (memcmp(check, lcd, sizeof(lcd)))
+            identical = false;
+      }
+#elif !defined(NOFRENDO_LINE_STREAM)
+      bmp = vid_getbuffer();
+      rows += flush_dirties(&whole);
+      if (0 == i % 60 && false == check_frame(bmp->line))
+         identical = false;
+#endif
+
+      hash = hash_lcd(hash);
+   }
+
+   /* the last frame's lines are the ring's in a streamed build, but
+   ** any 240 lines time the same
+   */
+   bmp = vid_getbuffer();
+
+#ifdef NOFRENDO_RGB565
+   /* the last frame smooth both ways */
+   resolve_frame(bmp);
+   smooth_bmp(bmp);
+   scale.smooth = true;
+   scale_frame16(bmp->line16, check);
+   scale.smooth = false;
+   if (memcmp(check, lcd, sizeof(lcd)))
+      identical = false;
+
+   new_fps = time_frames(resolve_scale_bmp, bmp, seconds);
+   smooth_fps = time_frames(smooth_resolve_scale_bmp, bmp, seconds);
+   ref_fps = time_frames(scale_bmp, bmp, seconds);
+   ref_smooth_fps = time_frames(smooth_bmp, bmp, seconds);
+
+   printf("%-24s: LCD %08X%s, resolved and scaled %7.1f frames/s (smooth %7.1f), palette scaler %7.1f frames/s (smooth %7.1f)\n",
+          filename, hash, identical ? "" : " DIFFERS from the palette",
+          new_fps, smooth_fps, ref_fps, ref_smooth_fps);
+   printf("%24s  dirty bands: %.1f%% of the LCD's rows sent, %d of %d frames whole\n", "",
+          100.0 * rows / ((double)frames * LCD_HEIGHT), whole, frames);
+#else  /* !NOFRENDO_RGB565 */
+   new_fps = time_frames(scale_bmp, bmp, seconds);
+   smooth_fps = time_frames(smooth_bmp, bmp, seconds);
+   gather_fps = time_frames(gather_bmp, bmp, seconds);
+   ref_fps = time_frames(ref_bmp, bmp, seconds);
+
+   printf("%-24s: LCD %08X%s, scaler %7.1f frames/s (%.1f Mpixels/s), smooth %7.1f frames/s, gather %7.1f frames/s, old loop %7.1f frames/s\n",
+          filename, hash, identical ? "" : " DIFFERS from the old loop",
+          new_fps, new_fps * LCD_WIDTH * LCD_HEIGHT / 1e6, smooth_fps, gather_fps, ref_fps);
+#ifndef NOFRENDO_LINE_STREAM
+   printf("%24s  dirty bands: %.1f%% of the LCD's rows sent, %d of %d frames whole\n", "",
+          100.0 * rows / ((double)frames * LCD_HEIGHT), whole, frames);
+#endif /* !NOFRENDO_LINE_STREAM */
+   bench_modes(bmp, seconds);
+#endif /* !NOFRENDO_RGB565 */
+
+   /* not destroyed: rom_load() gets PRG/CHR from mem_alloc(), which
+   ** memguard doesn't know about, so nes_destroy() would assert
+   */
+}
+
+int main(int argc, char *argv[])
+{
+   vidinfo_t video;
+   double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+   int frames = (argc > 2) ? atoi(argv[2]) : 600;
+   int i;
+
+   if (seconds <= 0)
+      seconds = 1.0;
+   if (frames <= 0)
+      frames = 600;
+
+   for (i = 0; i < LCD_WIDTH; i++)
+      ref_x[i] = (i * NES_SCREEN_WIDTH) / LCD_WIDTH;
+   for (i = 0; i < LCD_HEIGHT; i++)
+      ref_y[i] = (i * NES_SCREEN_HEIGHT) / LCD_HEIGHT;
+
+   if (vidscale_init(&scale, 0, 0, NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, LCD_WIDTH, LCD_HEIGHT))
+      return 1;
+#if !defined(NOFRENDO_LINE_STREAM) && !defined(NOFRENDO_RGB565)
+   if (vidscale_init(&cropped, 8, 8, NES_SCREEN_WIDTH - 16, NES_SCREEN_HEIGHT - 16, LCD_WIDTH, LCD_HEIGHT))
+      return 1;
+#endif /* !NOFRENDO_LINE_STREAM && !NOFRENDO_RGB565 */
+
+#ifdef NOFRENDO_LINE_STREAM
+   printf("streamed in bands of %d lines, ring of %d bands\n", VID_STREAM_BAND, VID_STREAM_BANDS);
+   host_setstream(stream_sink);
+#elif defined(NOFRENDO_RGB565)
+   printf("whole frames, resolved to RGB565 by the PPU\n");
+#else
+   printf("whole frames\n");
+#endif
+
+   osd_getvideoinfo(&video);
+   if (vid_init(video.default_width, video.default_height, video.driver) ||
+       vid_setmode(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT))
+      return 1;
+
+   if (argc <= 3)
+      bench_rom("(intro)", seconds, frames);
+
+   for (i = 3; i < argc; i++)
+      bench_rom(argv[i], seconds, frames);
+
+   return 0;
+}
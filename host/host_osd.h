@@ -0,0 +1,24 @@
+/* File-backed extras of the host OSD layer (null_osd.c) */
+#ifndef _HOST_OSD_H_
+#define _HOST_OSD_H_
+
+/* all optional, and all return -1 if the file can't be opened */
+extern int host_openvideo(const char *filename); /* binary PPM per frame */
+extern int host_openaudio(const char *filename); /* raw 16-bit mono PCM */
+extern int host_openinput(const char *filename); /* joypad 1 script */
+
+/* around each nes_renderframe(): apply scripted input before, run
+** the APU for the frame (and write its sound) and write the frame
+** after
+*/
+extern void host_startframe(int frame);
+extern void host_mixsound(void);
+extern void host_writeframe(void);
+extern void host_close(void);
+
+#ifdef NOFRENDO_LINE_STREAM
+/* where the video driver's bands of lines go, NULL for nowhere */
+extern void host_setstream(void (*sink)(uint8 *const *lines, int first_line, int num_lines));
+#endif /* NOFRENDO_LINE_STREAM */
+
+#endif /* !_HOST_OSD_H_ */
@@ -0,0 +1,350 @@
+/* Null OSD layer for the host build
+ *
+ * Video goes to a plain 256x240 8-bit buffer, and there is no timer:
+ * whoever drives the emulator calls nes_renderframe() as fast as it
+ * likes, then host_mixsound() to run the APU for the frame.  By default
+ * nothing is displayed, played or pressed, but frames can be written
+ * to a file as binary PPMs, sound as raw 16-bit mono PCM, and joypad
+ * 1 can be driven from a script (see host_openinput).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <noftypes.h>
+#ifdef NOFRENDO_DEFERRED_RENDER
+#include <pthread.h>
+#include <sched.h>
+#endif /* NOFRENDO_DEFERRED_RENDER */
+#include <osd.h>
+#include <bitmap.h>
+#include <vid_drv.h>
+#include <nes/nes.h>
+#include <nes/nesinput.h>
+
+#include "host_osd.h"
+
+#define SAMPLE_RATE 22050
+#define MAX_SCRIPT 1024
+
+static THREAD_LOCAL uint8 fb[NES_SCREEN_WIDTH * NES_SCREEN_HEIGHT];
+static THREAD_LOCAL bitmap_t *myBitmap;
+static THREAD_LOCAL rgb_t palette[256];
+
+static THREAD_LOCAL void (*audio_callback)(void *buffer, int length) = NULL;
+static THREAD_LOCAL int16 audio_frame[SAMPLE_RATE / NES_REFRESH_RATE];
+
+static THREAD_LOCAL FILE *video_fp = NULL, *audio_fp = NULL;
+
+#ifdef NOFRENDO_LINE_STREAM
+static THREAD_LOCAL void (*stream_sink)(uint8 *const *lines, int first_line, int num_lines) = NULL;
+#endif /* NOFRENDO_LINE_STREAM */
+
+/* joypad 1 script: from frame <frame> on, hold <buttons> */
+static THREAD_LOCAL struct
+{
+   int frame, buttons;
+} script[MAX_SCRIPT];
+static THREAD_LOCAL int script_len = 0, script_pos = 0;
+static THREAD_LOCAL nesinput_t joypad = {INP_JOYPAD0, 0};
+
+void *mem_alloc(int size, bool prefer_fast_memory)
+{
+   UNUSED(prefer_fast_memory);
+   return malloc(size);
+}
+
+static int init(int width, int height)
+{
+   UNUSED(width);
+   UNUSED(height);
+   return 0;
+}
+
+static void shutdown(void)
+{
+}
+
+static int set_mode(int width, int height)
+{
+   UNUSED(width);
+   UNUSED(height);
+   return 0;
+}
+
+static void set_palette(rgb_t *pal)
+{
+   memcpy(palette, pal, sizeof(palette));
+}
+
+static void clear(uint8 color)
+{
+   memset(fb, color, sizeof(fb));
+}
+
+static bitmap_t *lock_write(void)
+{
+   myBitmap = bmp_createhw(fb, NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, NES_SCREEN_WIDTH);
+   return myBitmap;
+}
+
+static void free_write(int num_dirties, rect_t *dirty_rects)
+{
+   UNUSED(num_dirties);
+   UNUSED(dirty_rects);
+   bmp_destroy(&myBitmap);
+}
+
+static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects)
+{
+   UNUSED(bmp);
+   UNUSED(num_dirties);
+   UNUSED(dirty_rects);
+}
+
+#ifdef NOFRENDO_LINE_STREAM
+static void stream_band(bitmap_t *bmp, int first_line, int num_lines)
+{
+   if (stream_sink)
+      stream_sink(bmp->line, first_line, num_lines);
+}
+
+void host_setstream(void (*sink)(uint8 *const *lines, int first_line, int num_lines))
+{
+   stream_sink = sink;
+}
+#endif /* NOFRENDO_LINE_STREAM */
+
+static viddriver_t nullDriver =
+    {
+        "null video", /* name */
+        init,         /* init */
+        shutdown,     /* shutdown */
+        set_mode,     /* set_mode */
+        set_palette,  /* set_palette */
+        clear,        /* clear */
+        lock_write,   /* lock_write */
+        free_write,   /* free_write */
+        custom_blit,  /* custom_blit */
+        false,        /* invalidate flag */
+#ifdef NOFRENDO_LINE_STREAM
+        stream_band /* stream_band */
+#endif /* NOFRENDO_LINE_STREAM */
+};
+
+void osd_getvideoinfo(vidinfo_t *info)
+{
+   info->default_width = NES_SCREEN_WIDTH;
+   info->default_height = NES_SCREEN_HEIGHT;
+   info->driver = &nullDriver;
+}
+
+void osd_getsoundinfo(sndinfo_t *info)
+{
+   info->sample_rate = SAMPLE_RATE;
+   info->bps = 16;
+}
+
+void osd_setsound(void (*playfunc)(void *buffer, int length))
+{
+   audio_callback = playfunc;
+}
+
+#ifdef NOFRENDO_DEFERRED_RENDER
+typedef struct
+{
+   void (*func)(void *arg);
+   void *arg;
+} thread_start_t;
+
+static void *thread_main(void *start_arg)
+{
+   thread_start_t start = *(thread_start_t *)start_arg;
+
+   free(start_arg);
+   start.func(start.arg);
+   return NULL;
+}
+
+int osd_startthread(void (*func)(void *arg), void *arg)
+{
+   thread_start_t *start = malloc(sizeof(thread_start_t));
+   pthread_t thread;
+
+   if (NULL == start)
+      return -1;
+
+   start->func = func;
+   start->arg = arg;
+   if (pthread_create(&thread, NULL, thread_main, start))
+   {
+      free(start);
+      return -1;
+   }
+
+   pthread_detach(thread);
+   return 0;
+}
+
+void osd_yield(void)
+{
+   sched_yield();
+}
+#endif /* NOFRENDO_DEFERRED_RENDER */
+
+int osd_init(void)
+{
+   return 0;
+}
+
+void osd_shutdown(void)
+{
+}
+
+int osd_main(int argc, char *argv[])
+{
+   UNUSED(argc);
+   UNUSED(argv);
+   return 0;
+}
+
+int osd_installtimer(int frequency, void *func, int funcsize, void *counter, int countersize)
+{
+   UNUSED(frequency);
+   UNUSED(func);
+   UNUSED(funcsize);
+   UNUSED(counter);
+   UNUSED(countersize);
+   return 0;
+}
+
+void osd_getinput(void)
+{
+}
+
+void osd_getmouse(int *x, int *y, int *button)
+{
+   *x = *y = *button = 0;
+}
+
+void osd_fullname(char *fullname, const char *shortname)
+{
+   strncpy(fullname, shortname, PATH_MAX);
+}
+
+char *osd_newextension(char *string, char *ext)
+{
+   UNUSED(ext);
+   return string;
+}
+
+int osd_makesnapname(char *filename, int len)
+{
+   UNUSED(filename);
+   UNUSED(len);
+   return -1;
+}
+
+int host_openvideo(const char *filename)
+{
+   video_fp = fopen(filename, "wb");
+   return video_fp ? 0 : -1;
+}
+
+int host_openaudio(const char *filename)
+{
+   audio_fp = fopen(filename, "wb");
+   return audio_fp ? 0 : -1;
+}
+
+/* one "<frame> <buttons>" per line, buttons being any of ABsSUDLR
+** (s = select, S = start) or - for none, e.g. "120 S" then "125 -"
+*/
+int host_openinput(const char *filename)
+{
+   static const char names[] = "ABsSUDLR";
+   char line[64], buttons[16];
+   FILE *fp;
+   int i, j;
+
+   fp = fopen(filename, "r");
+   if (NULL == fp)
+      return -1;
+
+   script_len = script_pos = 0;
+   while (script_len < MAX_SCRIPT && fgets(line, sizeof(line), fp))
+   {
+      if (2 != sscanf(line, "%d %15s", &script[script_len].frame, buttons))
+         continue;
+
+      /* INP_PAD_* bits are in ABsSUDLR order */
+      script[script_len].buttons = 0;
+      for (i = 0; buttons[i]; i++)
+      {
+         for (j = 0; names[j]; j++)
+         {
+            if (buttons[i] == names[j])
+               script[script_len].buttons |= 1 << j;
+         }
+      }
+      script_len++;
+   }
+
+   fclose(fp);
+   input_register(&joypad);
+   return 0;
+}
+
+void host_startframe(int frame)
+{
+   if (0 == frame)
+   {
+      script_pos = 0;
+      joypad.data = 0;
+   }
+
+   while (script_pos < script_len && script[script_pos].frame <= frame)
+      joypad.data = script[script_pos++].buttons;
+}
+
+void host_mixsound(void)
+{
+   if (NULL == audio_callback)
+      return;
+
+   audio_callback(audio_frame, SAMPLE_RATE / NES_REFRESH_RATE);
+   if (audio_fp)
+      fwrite(audio_frame, sizeof(int16), SAMPLE_RATE / NES_REFRESH_RATE, audio_fp);
+}
+
+/* straight from the emulator's buffer, nothing calls vid_flush() */
+void host_writeframe(void)
+{
+   bitmap_t *bmp = vid_getbuffer();
+   uint8 pixel;
+   int x, y;
+
+   if (NULL == video_fp)
+      return;
+
+   fprintf(video_fp, "P6\n%d %d\n255\n", NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT);
+   for (y = 0; y < NES_SCREEN_HEIGHT; y++)
+   {
+      for (x = 0; x < NES_SCREEN_WIDTH; x++)
+      {
+         pixel = bmp->line[y][x];
+         fputc(palette[pixel].r, video_fp);
+         fputc(palette[pixel].g, video_fp);
+         fputc(palette[pixel].b, video_fp);
+      }
+   }
+}
+
+void host_close(void)
+{
+   if (video_fp)
+      fclose(video_fp);
+   if (audio_fp)
+      fclose(audio_fp);
+   video_fp = audio_fp = NULL;
+}
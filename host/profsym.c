@@ -0,0 +1,266 @@
+/* Symboliser for nes6502 execution profiles
+ *
+ * Reads a dump from nes6502_profdump() -- a file written by a host
+ * tool, or a capture of the ESP32's serial console, which is searched
+ * for the "N6PF" header -- and prints the opcodes that took the most
+ * cycles and the hottest sampled PCs.  Given the ROM the profile was
+ * taken on, PCs in PRG-ROM are disassembled with dis6502.
+ *
+ *   profsym profile.bin [rom.nes] [top]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <noftypes.h>
+#include <cpu/nes6502.h>
+#include <cpu/dis6502.h>
+
+#define PROF_HEADER 24
+#define PROF_NOBANK 0xFFFF
+#define BANK_SIZE 0x1000
+#define DISASM_REGS 21 /* "NV1BDIZC AA XX YY SS\n" at the end of a line */
+
+typedef struct
+{
+   int index;
+   uint32 count, cycles;
+} opcode_t;
+
+typedef struct
+{
+   uint16 bank, address;
+   uint32 hits;
+} sample_t;
+
+static uint8 ram[0x800];
+static uint8 empty_bank[BANK_SIZE];
+static uint8 *prg = NULL;
+static uint32 prg_size = 0;
+
+static nes6502_memread read_handlers[1] = {{(uint32)-1, (uint32)-1, NULL}};
+static nes6502_memwrite write_handlers[1] = {{(uint32)-1, (uint32)-1, NULL}};
+static nes6502_readfunc read_pages[NES6502_NUMPAGES];
+static nes6502_writefunc write_pages[NES6502_NUMPAGES];
+static nes6502_context context;
+
+/* memguard wants this from the OSD layer */
+void *mem_alloc(int size, bool prefer_fast_memory)
+{
+   UNUSED(prefer_fast_memory);
+   return malloc(size);
+}
+
+static uint32 get32(const uint8 *data)
+{
+   return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32)data[3] << 24);
+}
+
+static uint8 *load_file(const char *filename, long *size)
+{
+   FILE *fp = fopen(filename, "rb");
+   uint8 *data;
+
+   if (NULL == fp)
+      return NULL;
+
+   fseek(fp, 0, SEEK_END);
+   *size = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+
+   data = malloc(*size + 1);
+   if (data && fread(data, 1, *size, fp) != (size_t)*size)
+   {
+      free(data);
+      data = NULL;
+   }
+
+   fclose(fp);
+   return data;
+}
+
+/* PRG-ROM out of an iNES image */
+static int load_prg(const char *filename)
+{
+   uint8 *rom;
+   long size, offset;
+
+   rom = load_file(filename, &size);
+   if (NULL == rom || size < 16 || memcmp(rom, "NES\x1A", 4))
+      return -1;
+
+   offset = 16 + ((rom[6] & 4) ? 512 : 0); /* skip the trainer */
+   prg_size = rom[4] * 0x4000;
+   if (offset + (long)prg_size > size)
+      return -1;
+
+   prg = rom + offset;
+   return 0;
+}
+
+static void map_page(int page, uint32 bank)
+{
+   if (prg && bank != PROF_NOBANK && (bank + 1) * BANK_SIZE <= prg_size)
+      context.mem_page[page] = prg + bank * BANK_SIZE;
+   else
+      context.mem_page[page] = empty_bank;
+}
+
+/* the instruction at bank:address, without the register dump */
+static char *disasm(uint32 bank, uint32 address)
+{
+   int page = address >> NES6502_BANKSHIFT;
+   char *text;
+   int len;
+
+   /* an instruction can run into the next 4kB, which is most likely
+   ** the next bank of the same larger one
+   */
+   map_page(page, bank);
+   if (page < NES6502_NUMBANKS - 1)
+      map_page(page + 1, bank + 1);
+   nes6502_setcontext(&context);
+
+   text = nes6502_disasm(address, 0, 0, 0, 0, 0);
+   len = strlen(text) - DISASM_REGS;
+   while (len > 0 && ' ' == text[len - 1])
+      len--;
+   text[len] = 0;
+
+   return text;
+}
+
+static int cmp_opcode(const void *a, const void *b)
+{
+   const opcode_t *x = a, *y = b;
+
+   if (x->cycles != y->cycles)
+      return (x->cycles < y->cycles) ? 1 : -1;
+   return x->index - y->index;
+}
+
+static int cmp_sample(const void *a, const void *b)
+{
+   const sample_t *x = a, *y = b;
+
+   if (x->hits != y->hits)
+      return (x->hits < y->hits) ? 1 : -1;
+   return (x->bank << 16 | x->address) - (y->bank << 16 | y->address);
+}
+
+int main(int argc, char *argv[])
+{
+   opcode_t opcodes[256];
+   sample_t *samples;
+   uint8 *dump, *data;
+   long size, offset;
+   uint32 version, period, total_samples, dropped, pcs;
+   double total_cycles = 0;
+   int i, top;
+
+   if (argc < 2)
+   {
+      fprintf(stderr, "usage: %s profile.bin [rom.nes] [top]\n", argv[0]);
+      return 1;
+   }
+
+   dump = load_file(argv[1], &size);
+   if (NULL == dump)
+   {
+      fprintf(stderr, "can't read %s\n", argv[1]);
+      return 1;
+   }
+
+   if (argc > 2 && load_prg(argv[2]))
+      fprintf(stderr, "can't read PRG-ROM from %s, not disassembling\n", argv[2]);
+
+   top = (argc > 3) ? atoi(argv[3]) : 40;
+
+   /* a serial capture has log text around the dump */
+   for (offset = 0; offset + PROF_HEADER <= size; offset++)
+   {
+      if (0 == memcmp(dump + offset, "N6PF", 4))
+         break;
+   }
+
+   if (offset + PROF_HEADER > size)
+   {
+      fprintf(stderr, "no profile in %s\n", argv[1]);
+      return 1;
+   }
+
+   data = dump + offset;
+   version = get32(data + 4);
+   period = get32(data + 8);
+   total_samples = get32(data + 12);
+   dropped = get32(data + 16);
+   pcs = get32(data + 20);
+
+   if (NES6502_PROFILE_VERSION != version ||
+       offset + PROF_HEADER + 256 * 8 + (long)pcs * 8 > size)
+   {
+      fprintf(stderr, "bad or truncated profile in %s\n", argv[1]);
+      return 1;
+   }
+
+   /* a bare context, so dis6502 can read code through the core */
+   context.mem_page[0] = ram;
+   for (i = 1; i < NES6502_NUMBANKS; i++)
+      context.mem_page[i] = empty_bank;
+   context.read_handler = read_handlers;
+   context.write_handler = write_handlers;
+   context.read_page = read_pages;
+   context.write_page = write_pages;
+   nes6502_buildpages(&context);
+   nes6502_setcontext(&context);
+
+   data += PROF_HEADER;
+   for (i = 0; i < 256; i++, data += 8)
+   {
+      opcodes[i].index = i;
+      opcodes[i].count = get32(data);
+      opcodes[i].cycles = get32(data + 4);
+      total_cycles += opcodes[i].cycles;
+   }
+
+   samples = malloc((pcs + 1) * sizeof(sample_t));
+   for (i = 0; i < (int)pcs; i++, data += 8)
+   {
+      samples[i].bank = data[0] | (data[1] << 8);
+      samples[i].address = data[2] | (data[3] << 8);
+      samples[i].hits = get32(data + 4);
+   }
+
+   qsort(opcodes, 256, sizeof(opcode_t), cmp_opcode);
+   qsort(samples, pcs, sizeof(sample_t), cmp_sample);
+
+   printf("%.0f cycles in opcodes, %u PC samples every %u cycles (%u dropped, %u distinct)\n\n",
+          total_cycles, total_samples, period, dropped, pcs);
+
+   printf("op  instruction          count       cycles  share\n");
+   for (i = 0; i < 256 && i < top && opcodes[i].cycles; i++)
+   {
+      /* operands read as zero from the empty bank */
+      memset(empty_bank, 0, sizeof(empty_bank));
+      empty_bank[0] = (uint8)opcodes[i].index;
+      printf("%02X  %-16s %10u %12u %5.1f%%\n", opcodes[i].index,
+             disasm(PROF_NOBANK, 0x8000) + 15, opcodes[i].count, opcodes[i].cycles,
+             total_cycles ? opcodes[i].cycles * 100.0 / total_cycles : 0.0);
+   }
+   memset(empty_bank, 0, sizeof(empty_bank));
+
+   printf("\nbank:addr       hits  share  instruction\n");
+   for (i = 0; i < (int)pcs && i < top; i++)
+   {
+      if (PROF_NOBANK == samples[i].bank)
+         printf("  --:%04X", samples[i].address);
+      else
+         printf("%4X:%04X", samples[i].bank, samples[i].address);
+
+      printf(" %10u %5.1f%%  %s\n", samples[i].hits,
+             total_samples ? samples[i].hits * 100.0 / total_samples : 0.0,
+             (prg && PROF_NOBANK != samples[i].bank) ? disasm(samples[i].bank, samples[i].address) + 6 : "(RAM/SRAM)");
+   }
+
+   return 0;
+}
@@ -32,8 +32,16 @@
 
 void bmp_clear(const bitmap_t *bitmap, uint8 color)
 {
+   int x, y;
+
    if (bitmap && bitmap->data) {
-      memset(bitmap->data, color, bitmap->pitch * bitmap->height);
+      memset(bitmap->data, color, bitmap->pitch * bitmap->rows);
+   }
+
+   if (bitmap && bitmap->line16) {
+      for (y = 0; y < bitmap->rows; y++)
+         for (x = 0; x < bitmap->width; x++)
+            bitmap->line16[y][x] = bitmap->rgb565[color];
    }
 }
 
@@ -53,7 +61,10 @@ static bitmap_t *_make_bitmap(uint8 *data_addr, bool hw, int width,
       return NULL;
 
    bitmap->hardware = hw;
+   bitmap->rgb565 = NULL;
+   bitmap->line16 = NULL;
    bitmap->height = height;
+   bitmap->rows = height;
    bitmap->width = width;
    bitmap->data = data_addr;
    bitmap->pitch = pitch + (overdraw * 2);
@@ -111,6 +122,63 @@ bitmap_t *bmp_create(int width, int height, int overdraw)
    return _make_bitmap(addr, false, width, height, width, overdraw);
 }
 
+/* a bitmap <height> lines tall with only <rows> lines of memory, line
+** <i> being row <i % rows>: for whoever takes lines away as they're
+** drawn (vid_streamline)
+*/
+bitmap_t *bmp_createring(int width, int height, int rows, int overdraw)
+{
+   bitmap_t *bitmap;
+   uint8 *addr;
+   int i;
+
+   if (width <= 0 || rows <= 0 || rows > height || overdraw < 0)
+      return NULL;
+
+   addr = NOFRENDO_MALLOC((((width + overdraw * 2) * rows) + 7) & ~7);
+   if (NULL == addr)
+      return NULL;
+
+   bitmap = _make_bitmap(addr, false, width, height, width, overdraw);
+   if (NULL == bitmap)
+   {
+      NOFRENDO_FREE(addr);
+      return NULL;
+   }
+
+   /* around the same rows again */
+   for (i = rows; i < height; i++)
+      bitmap->line[i] = bitmap->line[i - rows];
+   bitmap->rows = rows;
+
+   return bitmap;
+}
+
+/* give <bitmap> a plane of RGB565 lines the PPU resolves its lines
+** into through <rgb565> (256 colors), in a ring like the lines if it
+** is one
+*/
+int bmp_addrgb565(bitmap_t *bitmap, const uint16 *rgb565)
+{
+   uint16 *addr;
+   int i;
+
+   if (NULL == bitmap || NULL == rgb565 || bitmap->line16)
+      return -1;
+
+   bitmap->line16 = NOFRENDO_MALLOC(sizeof(uint16 *) * bitmap->height +
+                                    sizeof(uint16) * bitmap->width * bitmap->rows);
+   if (NULL == bitmap->line16)
+      return -1;
+
+   addr = (uint16 *)(bitmap->line16 + bitmap->height);
+   for (i = 0; i < bitmap->height; i++)
+      bitmap->line16[i] = addr + (i % bitmap->rows) * bitmap->width;
+   bitmap->rgb565 = rgb565;
+
+   return 0;
+}
+
 /* allocate and initialize a hardware bitmap */
 bitmap_t *bmp_createhw(uint8 *addr, int width, int height, int pitch)
 {
@@ -128,6 +196,8 @@ void bmp_destroy(bitmap_t **bitmap)
    {
       if ((*bitmap)->data && false == (*bitmap)->hardware)
          NOFRENDO_FREE((*bitmap)->data);
+      if ((*bitmap)->line16)
+         NOFRENDO_FREE((*bitmap)->line16);
       NOFRENDO_FREE(*bitmap);
       *bitmap = NULL;
    }
@@ -43,14 +43,25 @@ typedef struct rgb_s
 typedef struct bitmap_s
 {
    int width, height, pitch;
+   int rows;                 /* lines of data, fewer than height in a ring */
    bool hardware;            /* is data a hardware region? */
    uint8 *data;              /* protected */
+
+   /* each line again in RGB565, bytes swapped for the LCD bus, as the
+   ** PPU resolves it through <rgb565> once it's finished -- NULL if
+   ** there's no such plane, see bmp_addrgb565
+   */
+   const uint16 *rgb565;
+   uint16 **line16;
+
    uint8 *line[ZERO_LENGTH]; /* will hold line pointers */
 } bitmap_t;
 
 extern void bmp_clear(const bitmap_t *bitmap, uint8 color);
 extern bitmap_t *bmp_create(int width, int height, int overdraw);
 extern bitmap_t *bmp_createhw(uint8 *addr, int width, int height, int pitch);
+extern bitmap_t *bmp_createring(int width, int height, int rows, int overdraw);
+extern int bmp_addrgb565(bitmap_t *bitmap, const uint16 *rgb565);
 extern void bmp_destroy(bitmap_t **bitmap);
 
 #endif /* _BITMAP_H_ */
@@ -52,12 +52,12 @@ enum
 /* keep a filthy local copy of PC to
 ** reduce the amount of parameter passing
 */
-static uint32 pc_reg;
+static THREAD_LOCAL uint32 pc_reg;
 
 /* if we ever overrun this buffer, something will
 ** have gone very wrong anyway...
 */
-static char disasm_buf[256];
+static THREAD_LOCAL char disasm_buf[256];
 
 static uint8 dis_op8(void)
 {
@@ -25,6 +25,7 @@
 ** $Id: nes6502.c,v 1.2 2001/04/27 14:37:11 neil Exp $
 */
 
+#include <string.h>
 #include "nes6502.h"
 #include "dis6502.h"
 
@@ -34,6 +35,13 @@
 #define NES6502_JUMPTABLE
 #endif /* __GNUC__ */
 
+/* the predecoded dispatch is built on the jump table, and fused
+** instructions would throw off the disassembly and the profile
+*/
+#if defined(NES6502_PREDECODE) && (!defined(NES6502_JUMPTABLE) || defined(NES6502_DISASM) || defined(NES6502_PROFILE))
+#undef NES6502_PREDECODE
+#endif
+
 #define ADD_CYCLES(x)          \
    {                           \
       remaining_cycles -= (x); \
@@ -58,13 +66,13 @@
 /* Immediate */
 #define IMMEDIATE_BYTE(value)      \
    {                               \
-      value = bank_readbyte(PC++); \
+      value = CODE_READBYTE(PC++); \
    }
 
 /* Absolute */
 #define ABSOLUTE_ADDR(address)     \
    {                               \
-      address = bank_readword(PC); \
+      address = CODE_READWORD(PC); \
       PC += 2;                     \
    }
 
@@ -261,6 +269,13 @@
 /* Set N and Z flags based on given value */
 #define SET_NZ_FLAGS(value) n_flag = z_flag = (value);
 
+/* a jump back to <PC> from <tail> may have closed an idle loop */
+#define IDLE_CHECK(tail)                                             \
+   {                                                                 \
+      if (idle_enabled && (uint32)((tail) - PC) <= IDLE_MAX_BODY)    \
+         idle_check(PC & 0xFFFF, (tail) & 0xFFFF, X, Y);             \
+   }
+
 /* For BCC, BCS, BEQ, BMI, BNE, BPL, BVC, BVS */
 #define RELATIVE_BRANCH(condition)                  \
    {                                                \
@@ -271,11 +286,14 @@
             ADD_CYCLES(1);                          \
          ADD_CYCLES(3);                             \
          PC += (int8)btemp;                         \
+         if ((int8)btemp < 0)                       \
+            IDLE_CHECK(PC - (int8)btemp - 2);       \
       }                                             \
       else                                          \
       {                                             \
          PC++;                                      \
          ADD_CYCLES(2);                             \
+         idle_pc = IDLE_NONE;                       \
       }                                             \
    }
 
@@ -680,7 +698,7 @@
 
 #define JMP_INDIRECT()                                                   \
    {                                                                     \
-      temp = bank_readword(PC);                                          \
+      temp = CODE_READWORD(PC);                                          \
       /* bug in crossing page boundaries */                              \
       if (0xFF == (temp & 0xFF))                                         \
          PC = (bank_readbyte(temp & 0xFF00) << 8) | bank_readbyte(temp); \
@@ -689,19 +707,22 @@
       ADD_CYCLES(5);                                                     \
    }
 
-#define JMP_ABSOLUTE() \
-   {                   \
-      JUMP(PC);        \
-      ADD_CYCLES(3);   \
+#define JMP_ABSOLUTE()        \
+   {                          \
+      temp = PC - 1;          \
+      PC = CODE_READWORD(PC); \
+      ADD_CYCLES(3);          \
+      if (PC <= temp)         \
+         IDLE_CHECK(temp);    \
    }
 
-#define JSR()          \
-   {                   \
-      PC++;            \
-      PUSH(PC >> 8);   \
-      PUSH(PC & 0xFF); \
-      JUMP(PC - 1);    \
-      ADD_CYCLES(6);   \
+#define JSR()                     \
+   {                              \
+      PC++;                       \
+      PUSH(PC >> 8);              \
+      PUSH(PC & 0xFF);            \
+      PC = CODE_READWORD(PC - 1); \
+      ADD_CYCLES(6);              \
    }
 
 /* undocumented */
@@ -1117,11 +1138,50 @@
    }
 
 /* internal CPU context */
-static nes6502_context cpu;
-static int remaining_cycles = 0; /* so we can release timeslice */
+static THREAD_LOCAL nes6502_context cpu;
+static THREAD_LOCAL int remaining_cycles = 0; /* so we can release timeslice */
 /* memory region pointers */
-static uint8 *ram = NULL, *stack = NULL;
-static uint8 null_page[NES6502_BANKSIZE];
+static THREAD_LOCAL uint8 *ram = NULL, *stack = NULL;
+static THREAD_LOCAL uint8 null_page[NES6502_BANKSIZE];
+static THREAD_LOCAL uint32 bank_switches = 0;
+static THREAD_LOCAL uint32 total_instructions = 0;
+
+/* idle loop skipping */
+#define IDLE_MAX_BODY 16
+#define IDLE_NONE 0xFFFFFFFF
+
+static THREAD_LOCAL bool idle_enabled = true;
+static THREAD_LOCAL uint32 idle_cycles = 0;     /* cycles skipped */
+static THREAD_LOCAL uint32 idle_pc = IDLE_NONE; /* tail of the last loop that went round */
+static THREAD_LOCAL int idle_loop_cycles = 0;   /* its cycles per iteration, 0 = not idle */
+static THREAD_LOCAL uint32 idle_io = IDLE_NONE; /* the I/O address it polls, if any */
+
+#ifdef NES6502_PROFILE
+/* execution profile: per-opcode counts and cycles, and a histogram
+** of PCs sampled every PROF_PERIOD cycles, keyed by PRG-ROM bank
+*/
+#define PROF_PERIOD 97 /* prime, so it doesn't beat with loops */
+#define PROF_PROBES 8
+#define PROF_NOBANK 0xFFFF
+
+static THREAD_LOCAL uint32 prof_count[256], prof_cycles[256];
+static THREAD_LOCAL uint32 prof_key[NES6502_PROFILE_SLOTS], prof_hits[NES6502_PROFILE_SLOTS];
+static THREAD_LOCAL uint32 prof_samples = 0, prof_dropped = 0;
+static THREAD_LOCAL const uint8 *prof_prg = NULL;
+static THREAD_LOCAL uint32 prof_prg_size = 0;
+
+static THREAD_LOCAL int prof_op = -1;   /* instruction being run, -1 = none */
+static THREAD_LOCAL uint32 prof_pc;     /* and its address */
+static THREAD_LOCAL int32 prof_mark;    /* cpu.total_cycles when it started */
+static THREAD_LOCAL uint32 prof_idle;   /* idle_cycles when it started */
+static THREAD_LOCAL int32 prof_next = PROF_PERIOD; /* cycles until the next sample */
+#endif /* NES6502_PROFILE */
+
+#ifdef NES6502_PREDECODE
+/* decode tags for the memory each page maps, NULL if not predecoded */
+static THREAD_LOCAL uint16 *decode_page[NES6502_NUMBANKS];
+static THREAD_LOCAL uint16 decode_none[NES6502_BANKSIZE]; /* never decoded, never written */
+#endif /* NES6502_PREDECODE */
 
 /*
 ** Zero-page helper macros
@@ -1184,62 +1244,287 @@ INLINE void bank_writebyte(register uint32 address, register uint8 value)
    cpu.mem_page[address >> NES6502_BANKSHIFT][address & NES6502_BANKMASK] = value;
 }
 
-/* read a byte of 6502 memory */
-static uint8 mem_readbyte(uint32 address)
+#ifdef NES6502_PREDECODE
+
+/*
+** Predecode cache.  Each byte of a registered code region (PRG-ROM,
+** SRAM) gets a tag saying what the instruction starting there is: a
+** plain opcode, or a superinstruction that runs it and the one after
+** it (sometimes two) back to back, without going through the
+** dispatcher in between.  Tags are keyed by offset into the region,
+** so they survive bankswitches, and writes to a region forget any
+** tag whose instruction(s) the written byte is part of.
+*/
+enum
 {
-   nes6502_memread *mr;
+   DECODE_NONE,   /* not decoded yet */
+   DECODE_OPCODE, /* DECODE_OPCODE + opcode: a plain instruction */
+   DECODE_LDAI_STAZ = DECODE_OPCODE + 256,
+   DECODE_LDAI_STAA,
+   DECODE_LDAZ_STAZ,
+   DECODE_LDAZ_STAA,
+   DECODE_LDAA_STAZ,
+   DECODE_LDAA_STAA,
+   DECODE_DEX_BNE,
+   DECODE_DEY_BNE,
+   DECODE_INX_BNE,
+   DECODE_INY_BNE,
+   DECODE_INX_CPX_BNE,
+   DECODE_INY_CPY_BNE,
+   DECODE_LDAA_BPL,
+   DECODE_LDAA_BMI,
+   DECODE_BITA_BPL,
+   DECODE_BITA_BMI,
+   DECODE_BITA_BVC,
+   DECODE_BITA_BVS,
+   DECODE_LDAZ_BEQ,
+   DECODE_LDAZ_BNE,
+   DECODE_NUMTAGS
+};
+
+/* longest superinstruction, in bytes */
+#define DECODE_MAX_SPAN 6
+
+static const struct
+{
+   uint8 op1, op2, op3; /* op3 = 0: just a pair */
+   uint8 len1, span;
+   uint16 tag;
+} decode_fused[] =
+{
+   {0xA9, 0x85, 0, 2, 4, DECODE_LDAI_STAZ}, /* LDA #$nn   / STA $nn   */
+   {0xA9, 0x8D, 0, 2, 5, DECODE_LDAI_STAA}, /* LDA #$nn   / STA $nnnn */
+   {0xA5, 0x85, 0, 2, 4, DECODE_LDAZ_STAZ}, /* LDA $nn    / STA $nn   */
+   {0xA5, 0x8D, 0, 2, 5, DECODE_LDAZ_STAA}, /* LDA $nn    / STA $nnnn */
+   {0xAD, 0x85, 0, 3, 5, DECODE_LDAA_STAZ}, /* LDA $nnnn  / STA $nn   */
+   {0xAD, 0x8D, 0, 3, 6, DECODE_LDAA_STAA}, /* LDA $nnnn  / STA $nnnn */
+   {0xCA, 0xD0, 0, 1, 3, DECODE_DEX_BNE},   /* DEX / BNE */
+   {0x88, 0xD0, 0, 1, 3, DECODE_DEY_BNE},   /* DEY / BNE */
+   {0xE8, 0xE0, 0xD0, 1, 5, DECODE_INX_CPX_BNE}, /* INX / CPX #$nn / BNE */
+   {0xC8, 0xC0, 0xD0, 1, 5, DECODE_INY_CPY_BNE}, /* INY / CPY #$nn / BNE */
+   {0xE8, 0xD0, 0, 1, 3, DECODE_INX_BNE},   /* INX / BNE */
+   {0xC8, 0xD0, 0, 1, 3, DECODE_INY_BNE},   /* INY / BNE */
+   {0xAD, 0x10, 0, 3, 5, DECODE_LDAA_BPL},  /* LDA $nnnn / BPL */
+   {0xAD, 0x30, 0, 3, 5, DECODE_LDAA_BMI},  /* LDA $nnnn / BMI */
+   {0x2C, 0x10, 0, 3, 5, DECODE_BITA_BPL},  /* BIT $nnnn / BPL */
+   {0x2C, 0x30, 0, 3, 5, DECODE_BITA_BMI},  /* BIT $nnnn / BMI */
+   {0x2C, 0x50, 0, 3, 5, DECODE_BITA_BVC},  /* BIT $nnnn / BVC */
+   {0x2C, 0x70, 0, 3, 5, DECODE_BITA_BVS},  /* BIT $nnnn / BVS */
+   {0xA5, 0xF0, 0, 2, 4, DECODE_LDAZ_BEQ},  /* LDA $nn / BEQ */
+   {0xA5, 0xD0, 0, 2, 4, DECODE_LDAZ_BNE},  /* LDA $nn / BNE */
+};
+
+/* decode the instruction at <code>, with <room> bytes left in its page */
+static uint16 decode_tag(const uint8 *code, int room)
+{
+   unsigned int i;
 
-   /* TODO: following 2 cases are N2A03-specific */
-   if (address < 0x800)
+   for (i = 0; i < sizeof(decode_fused) / sizeof(decode_fused[0]); i++)
    {
-      /* RAM */
-      return ram[address];
+      if (code[0] == decode_fused[i].op1 && decode_fused[i].span <= room &&
+          code[decode_fused[i].len1] == decode_fused[i].op2 &&
+          (0 == decode_fused[i].op3 || code[decode_fused[i].len1 + 2] == decode_fused[i].op3))
+         return decode_fused[i].tag;
    }
-   else if (address >= 0x8000)
+
+   return DECODE_OPCODE + code[0];
+}
+
+/* find the tags for whatever <page> maps, if it's in a code region */
+static void decode_mappage(int page)
+{
+   uint8 *mem = cpu.mem_page[page];
+   nes6502_code *code;
+   int i;
+
+   decode_page[page] = NULL;
+
+   /* RAM is written far too often to be worth it */
+   if (0 == page)
+      return;
+
+   for (i = 0; i < NES6502_MAX_CODE; i++)
+   {
+      code = &cpu.code[i];
+      if (code->tags && mem >= code->base && mem + NES6502_BANKSIZE <= code->base + code->size &&
+          0 == ((mem - code->base) & NES6502_BANKMASK))
+      {
+         decode_page[page] = code->tags + (mem - code->base);
+         return;
+      }
+   }
+}
+
+/* forget everything decoded that the byte at <address> is part of */
+static void decode_invalidate(uint32 address)
+{
+   uint16 *tags = decode_page[address >> NES6502_BANKSHIFT];
+   int offset = address & NES6502_BANKMASK;
+   int first = offset - (DECODE_MAX_SPAN - 1);
+
+   if (first < 0)
+      first = 0;
+
+   while (first <= offset)
+      tags[first++] = DECODE_NONE;
+}
+
+#define DECODE_INVALIDATE(address)                           \
+   {                                                         \
+      if (decode_page[(address) >> NES6502_BANKSHIFT])       \
+         decode_invalidate(address);                         \
+   }
+
+#else /* !NES6502_PREDECODE */
+
+#define DECODE_INVALIDATE(address)
+
+#endif /* !NES6502_PREDECODE */
+
+/* walk the read handler list -- only used for pages that are
+** shared between several handlers (e.g. $4000-$40FF)
+*/
+static uint8 mem_walkread(uint32 address)
+{
+   nes6502_memread *mr;
+
+   for (mr = cpu.read_handler; mr->min_range != 0xFFFFFFFF; mr++)
    {
-      /* always paged memory */
-      return bank_readbyte(address);
+      if (address >= mr->min_range && address <= mr->max_range)
+         return mr->read_func(address);
    }
-   /* check memory range handlers */
-   else
+
+   /* return paged memory */
+   return bank_readbyte(address);
+}
+
+/* walk the write handler list, for shared pages */
+static void mem_walkwrite(uint32 address, uint8 value)
+{
+   nes6502_memwrite *mw;
+
+   for (mw = cpu.write_handler; mw->min_range != 0xFFFFFFFF; mw++)
    {
-      for (mr = cpu.read_handler; mr->min_range != 0xFFFFFFFF; mr++)
+      if (address >= mw->min_range && address <= mw->max_range)
       {
-         if (address >= mr->min_range && address <= mr->max_range)
-            return mr->read_func(address);
+         mw->write_func(address, value);
+         return;
       }
    }
 
+   /* write to paged memory */
+   bank_writebyte(address, value);
+   DECODE_INVALIDATE(address);
+}
+
+/* read a byte of 6502 memory */
+static uint8 mem_readbyte(uint32 address)
+{
+   nes6502_readfunc read_func;
+
+   /* TODO: N2A03-specific */
+   if (address < 0x800)
+   {
+      /* RAM */
+      return ram[address];
+   }
+
+   /* $8000-$FFFF never has a read handler: see nes6502_buildpages */
+   read_func = cpu.read_page[address >> NES6502_PAGESHIFT];
+   if (read_func)
+      return read_func(address);
+
    /* return paged memory */
    return bank_readbyte(address);
 }
 
-/* write a byte of data to 6502 memory */
-static void mem_writebyte(uint32 address, uint8 value)
+/* write a byte of data to 6502 memory, returns true if
+** the write went to an I/O handler
+*/
+static bool mem_writebyte(uint32 address, uint8 value)
 {
-   nes6502_memwrite *mw;
+   nes6502_writefunc write_func;
 
    /* RAM */
    if (address < 0x800)
    {
       ram[address] = value;
-      return;
+      return false;
+   }
+
+   write_func = cpu.write_page[address >> NES6502_PAGESHIFT];
+   if (write_func)
+   {
+      write_func(address, value);
+      return true;
+   }
+
+   /* write to paged memory */
+   bank_writebyte(address, value);
+   DECODE_INVALIDATE(address);
+   return false;
+}
+
+/* handler writes can bankswitch the page we are executing from */
+#define MEM_WRITEBYTE(address, value)     \
+   {                                      \
+      if (mem_writebyte(address, value))  \
+         code_start = CODE_PAGE_INVALID;  \
    }
-   /* check memory range handlers */
-   else
+
+/* Compile the read/write handler lists into page tables.  A page
+** wholly covered by the first handler that touches it dispatches
+** straight to that handler; a page split between handlers falls
+** back to walking the list, so first-match-wins ordering is kept.
+** RAM ($0000-$07FF) is never dispatched, and neither are reads
+** from $8000-$FFFF, which always come from paged memory.
+*/
+void nes6502_buildpages(nes6502_context *context)
+{
+   uint32 page, min_addr, max_addr;
+   nes6502_memread *mr;
+   nes6502_memwrite *mw;
+
+   ASSERT(context);
+   ASSERT(context->read_page && context->write_page);
+
+   for (page = 0; page < NES6502_NUMPAGES; page++)
    {
-      for (mw = cpu.write_handler; mw->min_range != 0xFFFFFFFF; mw++)
+      min_addr = page << NES6502_PAGESHIFT;
+      max_addr = min_addr + (1 << NES6502_PAGESHIFT) - 1;
+
+      context->read_page[page] = NULL;
+      if (min_addr >= 0x800 && min_addr < 0x8000)
       {
-         if (address >= mw->min_range && address <= mw->max_range)
+         for (mr = context->read_handler; mr->min_range != 0xFFFFFFFF; mr++)
          {
-            mw->write_func(address, value);
-            return;
+            if (mr->max_range < min_addr || mr->min_range > max_addr)
+               continue;
+
+            if (mr->min_range <= min_addr && mr->max_range >= max_addr)
+               context->read_page[page] = mr->read_func;
+            else
+               context->read_page[page] = mem_walkread;
+            break;
          }
       }
-   }
 
-   /* write to paged memory */
-   bank_writebyte(address, value);
+      context->write_page[page] = NULL;
+      if (min_addr >= 0x800)
+      {
+         for (mw = context->write_handler; mw->min_range != 0xFFFFFFFF; mw++)
+         {
+            if (mw->max_range < min_addr || mw->min_range > max_addr)
+               continue;
+
+            if (mw->min_range <= min_addr && mw->max_range >= max_addr)
+               context->write_page[page] = mw->write_func;
+            else
+               context->write_page[page] = mem_walkwrite;
+            break;
+         }
+      }
+   }
 }
 
 /* set the current context */
@@ -1260,6 +1545,11 @@ void nes6502_setcontext(nes6502_context *context)
 
    ram = cpu.mem_page[0]; /* quick zero-page/RAM references */
    stack = ram + STACK_OFFSET;
+
+#ifdef NES6502_PREDECODE
+   for (loop = 0; loop < NES6502_NUMBANKS; loop++)
+      decode_mappage(loop);
+#endif /* NES6502_PREDECODE */
 }
 
 /* get the current context */
@@ -1279,12 +1569,260 @@ void nes6502_getcontext(nes6502_context *context)
    }
 }
 
+/* remap <num_pages> consecutive 4kB pages of the live context,
+** starting at <page>, onto the memory at <base> (NULL = dead page).
+** Cheaper than a getcontext/setcontext round trip, and safe to call
+** from a write handler mid-timeslice.
+*/
+void nes6502_setpages(int page, int num_pages, uint8 *base)
+{
+   /* page 0 is cached in ram/stack */
+   ASSERT(page > 0 && page + num_pages <= NES6502_NUMBANKS);
+
+   while (num_pages--)
+   {
+      if (NULL == base)
+      {
+         cpu.mem_page[page] = null_page;
+      }
+      else
+      {
+         cpu.mem_page[page] = base;
+         base += NES6502_BANKSIZE;
+      }
+
+#ifdef NES6502_PREDECODE
+      decode_mappage(page);
+#endif /* NES6502_PREDECODE */
+      page++;
+   }
+
+   bank_switches++;
+}
+
+/* predecode code run from <size> bytes at <base>, returns -1 if the
+** cache isn't built in, there's no memory, or no free region slot
+*/
+int nes6502_addcode(nes6502_context *context, uint8 *base, uint32 size)
+{
+#ifdef NES6502_PREDECODE
+   int i;
+
+   ASSERT(context && base);
+
+   for (i = 0; i < NES6502_MAX_CODE; i++)
+   {
+      if (NULL == context->code[i].tags)
+      {
+         context->code[i].tags = NOFRENDO_MALLOC(size * sizeof(uint16));
+         if (NULL == context->code[i].tags)
+            return -1;
+
+         memset(context->code[i].tags, DECODE_NONE, size * sizeof(uint16));
+         context->code[i].base = base;
+         context->code[i].size = size;
+         return 0;
+      }
+   }
+#else  /* !NES6502_PREDECODE */
+   UNUSED(context);
+   UNUSED(base);
+   UNUSED(size);
+#endif /* !NES6502_PREDECODE */
+
+   return -1;
+}
+
+/* forget everything decoded, after code memory was changed behind
+** the CPU's back (e.g. a state load)
+*/
+void nes6502_flushcode(nes6502_context *context)
+{
+   int i;
+
+   for (i = 0; i < NES6502_MAX_CODE; i++)
+   {
+      if (context->code[i].tags)
+         memset(context->code[i].tags, 0, context->code[i].size * sizeof(uint16));
+   }
+}
+
+void nes6502_freecode(nes6502_context *context)
+{
+   int i;
+
+   for (i = 0; i < NES6502_MAX_CODE; i++)
+   {
+      if (context->code[i].tags)
+         NOFRENDO_FREE(context->code[i].tags);
+      context->code[i].tags = NULL;
+      context->code[i].base = NULL;
+      context->code[i].size = 0;
+   }
+}
+
+/* get number of instructions executed (not counting idle loop
+** iterations that were skipped)
+*/
+uint32 nes6502_getinstructions(bool reset_flag)
+{
+   uint32 count = total_instructions;
+
+   if (reset_flag)
+      total_instructions = 0;
+
+   return count;
+}
+
+/* get number of bank switches (setpages calls) */
+uint32 nes6502_getbankswitches(bool reset_flag)
+{
+   uint32 count = bank_switches;
+
+   if (reset_flag)
+      bank_switches = 0;
+
+   return count;
+}
+
+/* turn idle loop skipping on or off */
+void nes6502_setidle(bool enable)
+{
+   idle_enabled = enable;
+   idle_pc = IDLE_NONE;
+}
+
+/* get number of cycles skipped in idle loops */
+uint32 nes6502_getidlecycles(bool reset_flag)
+{
+   uint32 cycles = idle_cycles;
+
+   if (reset_flag)
+      idle_cycles = 0;
+
+   return cycles;
+}
+
+#ifdef NES6502_PROFILE
+static void prof_put32(uint8 *buf, uint32 value)
+{
+   buf[0] = (uint8)value;
+   buf[1] = (uint8)(value >> 8);
+   buf[2] = (uint8)(value >> 16);
+   buf[3] = (uint8)(value >> 24);
+}
+#endif /* NES6502_PROFILE */
+
+/* clear the execution profile; <prg> is the PRG-ROM that sampled PCs
+** get their bank numbers from
+*/
+void nes6502_profreset(const uint8 *prg, uint32 prg_size)
+{
+#ifdef NES6502_PROFILE
+   memset(prof_count, 0, sizeof(prof_count));
+   memset(prof_cycles, 0, sizeof(prof_cycles));
+   memset(prof_key, 0, sizeof(prof_key));
+   memset(prof_hits, 0, sizeof(prof_hits));
+   prof_samples = prof_dropped = 0;
+   prof_prg = prg;
+   prof_prg_size = prg_size;
+   prof_op = -1;
+   prof_next = PROF_PERIOD;
+#else  /* !NES6502_PROFILE */
+   UNUSED(prg);
+   UNUSED(prg_size);
+#endif /* !NES6502_PROFILE */
+}
+
+/* pass the profile to <write_func> as a binary dump, all values
+** little-endian:
+**
+**   "N6PF", u32 version, u32 sample period, u32 samples, u32 dropped,
+**   u32 number of PCs, then 256 x (u32 count, u32 cycles) by opcode,
+**   then per PC: u16 bank (0xFFFF = not PRG-ROM), u16 address, u32 hits
+**
+** returns the dump size in bytes, or -1 if the profiler isn't built in
+*/
+int nes6502_profdump(void (*write_func)(const uint8 *data, int len), bool reset_flag)
+{
+#ifdef NES6502_PROFILE
+   uint8 buf[24];
+   uint32 pcs = 0;
+   int i, size;
+
+   ASSERT(write_func);
+
+   for (i = 0; i < NES6502_PROFILE_SLOTS; i++)
+   {
+      if (prof_hits[i])
+         pcs++;
+   }
+
+   memcpy(buf, "N6PF", 4);
+   prof_put32(buf + 4, NES6502_PROFILE_VERSION);
+   prof_put32(buf + 8, PROF_PERIOD);
+   prof_put32(buf + 12, prof_samples);
+   prof_put32(buf + 16, prof_dropped);
+   prof_put32(buf + 20, pcs);
+   write_func(buf, 24);
+
+   for (i = 0; i < 256; i++)
+   {
+      prof_put32(buf, prof_count[i]);
+      prof_put32(buf + 4, prof_cycles[i]);
+      write_func(buf, 8);
+   }
+
+   for (i = 0; i < NES6502_PROFILE_SLOTS; i++)
+   {
+      if (prof_hits[i])
+      {
+         /* key is bank << 16 | address */
+         buf[0] = (uint8)(prof_key[i] >> 16);
+         buf[1] = (uint8)(prof_key[i] >> 24);
+         buf[2] = (uint8)prof_key[i];
+         buf[3] = (uint8)(prof_key[i] >> 8);
+         prof_put32(buf + 4, prof_hits[i]);
+         write_func(buf, 8);
+      }
+   }
+
+   size = 24 + 256 * 8 + pcs * 8;
+
+   if (reset_flag)
+      nes6502_profreset(prof_prg, prof_prg_size);
+
+   return size;
+#else  /* !NES6502_PROFILE */
+   UNUSED(write_func);
+   UNUSED(reset_flag);
+   return -1;
+#endif /* !NES6502_PROFILE */
+}
+
 /* DMA a byte of data from ROM */
 uint8 nes6502_getbyte(uint32 address)
 {
    return bank_readbyte(address);
 }
 
+/* the 256-byte page at <address>, if it's plain memory (no I/O
+** handlers) that DMA can block copy from, otherwise NULL
+*/
+uint8 *nes6502_getpage(uint32 address)
+{
+   address &= 0xFF00;
+
+   /* TODO: N2A03-specific */
+   if (address < 0x800)
+      return ram + address;
+
+   if (cpu.read_page[address >> NES6502_PAGESHIFT])
+      return NULL;
+
+   return cpu.mem_page[address >> NES6502_BANKSHIFT] + (address & NES6502_BANKMASK);
+}
+
 /* get number of elapsed cycles */
 uint32 nes6502_getcycles(bool reset_flag)
 {
@@ -1318,23 +1856,364 @@ uint32 nes6502_getcycles(bool reset_flag)
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+/*
+** Code fetch goes through a pointer to the 4kB page PC is in, so
+** opcodes and operands are a single indexed load.  The pointer is
+** re-derived from the bank table only when PC leaves the page (runs
+** off the end, or jumps/branches/returns/interrupts elsewhere) or
+** when a handler write may have bankswitched it.  An instruction in
+** the last two bytes of a page is staged into code_edge, so operands
+** are always fetched from the right bank.
+*/
+#define CODE_PAGE_INVALID 0x80000000
+#define CODE_PAGE_SPAN (NES6502_BANKSIZE - 3)
+
+#define CODE_READBYTE(address) code_ptr[(address)]
+
+#ifdef HOST_LITTLE_ENDIAN
+#define CODE_READWORD(address) ((uint32)(*(uint16 *)(code_ptr + (address))))
+#else /* !HOST_LITTLE_ENDIAN */
+#define CODE_READWORD(address) ((uint32)code_ptr[(address)] | ((uint32)code_ptr[(address) + 1] << 8))
+#endif /* !HOST_LITTLE_ENDIAN */
+
+#ifdef NES6502_PREDECODE
+#define DECODE_SETPAGE()                                             \
+   {                                                                 \
+      decode_ptr = decode_page[PC >> NES6502_BANKSHIFT];             \
+      decode_ptr = (decode_ptr ? decode_ptr : decode_none) - code_start; \
+   }
+#define DECODE_SETEDGE()             \
+   {                                 \
+      decode_ptr = decode_none - PC; \
+   }
+#else /* !NES6502_PREDECODE */
+#define DECODE_SETPAGE()
+#define DECODE_SETEDGE()
+#endif /* !NES6502_PREDECODE */
+
+#define CODE_CHECK_PAGE()                                                      \
+   {                                                                           \
+      if ((uint32)(PC - code_start) > CODE_PAGE_SPAN)                          \
+      {                                                                        \
+         PC &= 0xFFFF;                                                         \
+         if ((PC & NES6502_BANKMASK) <= CODE_PAGE_SPAN)                        \
+         {                                                                     \
+            code_start = PC & ~NES6502_BANKMASK;                               \
+            code_ptr = cpu.mem_page[PC >> NES6502_BANKSHIFT] - code_start;     \
+            DECODE_SETPAGE();                                                  \
+         }                                                                     \
+         else                                                                  \
+         {                                                                     \
+            code_edge[0] = bank_readbyte(PC);                                  \
+            code_edge[1] = bank_readbyte((PC + 1) & 0xFFFF);                   \
+            code_edge[2] = bank_readbyte((PC + 2) & 0xFFFF);                   \
+            code_ptr = code_edge - PC;                                         \
+            code_start = CODE_PAGE_INVALID;                                    \
+            DECODE_SETEDGE();                                                  \
+         }                                                                     \
+      }                                                                        \
+   }
+
+/*
+** Idle loop skipping.  A short loop that does nothing but poll memory
+** (loads, compares, BIT, AND/ORA, closed by a backward branch or a
+** JMP to its head) goes round in exactly the same state until what it
+** polls changes.  Plain memory can't change under such a loop before
+** the timeslice ends, and for I/O the context's idle_func says how
+** long it will keep reading the same.  So once the loop has gone all
+** the way round, whole iterations are added to the cycle count, up to
+** that limit: the CPU ends up exactly where it would have, sooner.
+*/
+
+/* the polled address, if it's I/O, has to be the loop's only one */
+static bool idle_stable(uint32 address)
+{
+   if (address < 0x800 || NULL == cpu.read_page[address >> NES6502_PAGESHIFT])
+      return true;
+
+   if (IDLE_NONE != idle_io && address != idle_io)
+      return false;
+
+   idle_io = address;
+   return true;
+}
+
+/* scan the loop from <head> to the branch or JMP at <tail>, returns
+** cycles per iteration, or 0 if it does more than poll memory
+*/
+static int idle_scan(uint32 head, uint32 tail, uint8 x, uint8 y)
+{
+   enum { IMP, IMM, ZP, ZPX, ZPY, ABS, ABSX, ABSY };
+   bool x_loaded = false, y_loaded = false, x_used = false, y_used = false;
+   uint32 pc = head, address;
+   int cycles = 0, mode;
+   uint8 opcode;
+
+   idle_io = IDLE_NONE;
+
+   while (pc < tail)
+   {
+      opcode = bank_readbyte(pc);
+      switch (opcode)
+      {
+      case 0xEA: /* NOP */
+         mode = IMP;
+         break;
+
+      case 0x09: case 0x29: case 0xA9: case 0xC9: /* ORA/AND/LDA/CMP # */
+      case 0xA0: case 0xC0: case 0xA2: case 0xE0: /* LDY/CPY/LDX/CPX # */
+         mode = IMM;
+         break;
+
+      case 0x05: case 0x24: case 0x25: case 0xA5: case 0xC5: /* ORA/BIT/AND/LDA/CMP zp */
+      case 0xA4: case 0xC4: case 0xA6: case 0xE4:            /* LDY/CPY/LDX/CPX zp */
+         mode = ZP;
+         break;
+
+      case 0x15: case 0x35: case 0xB5: case 0xD5: case 0xB4: /* ORA/AND/LDA/CMP/LDY zp,X */
+         mode = ZPX;
+         break;
+
+      case 0xB6: /* LDX zp,Y */
+         mode = ZPY;
+         break;
+
+      case 0x0D: case 0x2C: case 0x2D: case 0xAD: case 0xCD: /* ORA/BIT/AND/LDA/CMP abs */
+      case 0xAC: case 0xCC: case 0xAE: case 0xEC:            /* LDY/CPY/LDX/CPX abs */
+         mode = ABS;
+         break;
+
+      case 0x1D: case 0x3D: case 0xBD: case 0xDD: case 0xBC: /* ORA/AND/LDA/CMP/LDY abs,X */
+         mode = ABSX;
+         break;
+
+      case 0x19: case 0x39: case 0xB9: case 0xD9: case 0xBE: /* ORA/AND/LDA/CMP/LDX abs,Y */
+         mode = ABSY;
+         break;
+
+      default:
+         return 0;
+      }
+
+      if (0xA2 == opcode || 0xA6 == opcode || 0xB6 == opcode || 0xAE == opcode || 0xBE == opcode)
+         x_loaded = true;
+      if (0xA0 == opcode || 0xA4 == opcode || 0xB4 == opcode || 0xAC == opcode || 0xBC == opcode)
+         y_loaded = true;
+
+      switch (mode)
+      {
+      case IMP:
+         cycles += 2;
+         pc++;
+         break;
+
+      case IMM:
+      case ZP:
+         cycles += (IMM == mode) ? 2 : 3;
+         pc += 2;
+         break;
+
+      case ZPX:
+      case ZPY:
+         /* zero page always comes from RAM */
+         x_used |= (ZPX == mode);
+         y_used |= (ZPY == mode);
+         cycles += 4;
+         pc += 2;
+         break;
+
+      default:
+         address = bank_readbyte(pc + 1) | (bank_readbyte((pc + 2) & 0xFFFF) << 8);
+         cycles += 4;
+         if (ABSX == mode || ABSY == mode)
+         {
+            uint8 index = (ABSX == mode) ? x : y;
+
+            x_used |= (ABSX == mode);
+            y_used |= (ABSY == mode);
+            if ((address & 0xFF) + index > 0xFF)
+               cycles++;
+            address = (address + index) & 0xFFFF;
+         }
+         if (false == idle_stable(address))
+            return 0;
+         pc += 3;
+         break;
+      }
+   }
+
+   /* an instruction straddles the tail, or indexes off a register the
+   ** loop itself changes
+   */
+   if (pc != tail || (x_loaded && x_used) || (y_loaded && y_used))
+      return 0;
+
+   /* the jump back */
+   if (0x4C == bank_readbyte(tail))
+      return cycles + 3;
+
+   if (((tail + 2) ^ head) & 0xFF00)
+      cycles++;
+
+   return cycles + 3;
+}
+
+/* we just jumped back to <head> from <tail> */
+static void idle_check(uint32 head, uint32 tail, uint8 x, uint8 y)
+{
+   int32 limit, skip;
+
+   /* the first time round only says what kind of loop it is */
+   if (tail != idle_pc)
+   {
+      idle_pc = tail;
+      idle_loop_cycles = idle_scan(head, tail, x, y);
+      return;
+   }
+
+   if (0 == idle_loop_cycles)
+      return;
+
+   limit = remaining_cycles;
+   if (IDLE_NONE != idle_io)
+   {
+      if (NULL == cpu.idle_func)
+         return;
+      limit = MIN(limit, cpu.idle_func(idle_io));
+   }
+
+   skip = limit - (limit % idle_loop_cycles);
+   if (skip > 0)
+   {
+      ADD_CYCLES(skip);
+      idle_cycles += skip;
+   }
+}
+
+#ifdef NES6502_PROFILE
+
+/* bank:address key for a PC, bank being the 4kB PRG-ROM bank the page
+** maps, or PROF_NOBANK for code in RAM/SRAM
+*/
+static uint32 prof_makekey(uint32 address)
+{
+   const uint8 *page = cpu.mem_page[address >> NES6502_BANKSHIFT];
+   uint32 bank = PROF_NOBANK;
+
+   if (address >= 0x800 && prof_prg && page >= prof_prg && page < prof_prg + prof_prg_size)
+      bank = (uint32)(page - prof_prg) >> NES6502_BANKSHIFT;
+
+   return (bank << 16) | address;
+}
+
+static void prof_sample(uint32 address)
+{
+   uint32 key = prof_makekey(address);
+   uint32 slot = (key * 2654435761u) % NES6502_PROFILE_SLOTS;
+   int i;
+
+   prof_samples++;
+
+   /* open addressing, keys are never removed until the profile is
+   ** reset, so an empty slot means the key isn't in the table
+   */
+   for (i = 0; i < PROF_PROBES; i++)
+   {
+      if (prof_key[slot] == key || 0 == prof_hits[slot])
+      {
+         prof_key[slot] = key;
+         prof_hits[slot]++;
+         return;
+      }
+      slot = (slot + 1) % NES6502_PROFILE_SLOTS;
+   }
+
+   prof_dropped++;
+}
+
+/* charge the instruction that just finished, interrupts and DMA
+** taken between timeslices and cycles skipped in idle loops aren't
+** charged to anything
+*/
+INLINE void prof_end(void)
+{
+   int32 cycles;
+
+   if (prof_op < 0)
+      return;
+
+   cycles = cpu.total_cycles - prof_mark - (int32)(idle_cycles - prof_idle);
+   prof_cycles[prof_op] += cycles;
+
+   for (prof_next -= cycles; prof_next <= 0; prof_next += PROF_PERIOD)
+      prof_sample(prof_pc);
+
+   prof_op = -1;
+}
+
+INLINE void prof_begin(uint32 address, uint8 opcode)
+{
+   prof_op = opcode;
+   prof_pc = address;
+   prof_mark = cpu.total_cycles;
+   prof_idle = idle_cycles;
+   prof_count[opcode]++;
+}
+
+#define PROFILE_END() prof_end()
+#define PROFILE_BEGIN() prof_begin(PC, CODE_READBYTE(PC))
+
+#else /* !NES6502_PROFILE */
+
+#define PROFILE_END()
+#define PROFILE_BEGIN()
+
+#endif /* !NES6502_PROFILE */
+
 #ifdef NES6502_JUMPTABLE
 
 #define OPCODE_BEGIN(xx) op##xx:
 #ifdef NES6502_DISASM
 
 #define OPCODE_END                                                       \
+   PROFILE_END();                                                        \
    if (remaining_cycles <= 0)                                            \
       goto end_execute;                                                  \
    nofrendo_log_printf(nes6502_disasm(PC, COMBINE_FLAGS(), A, X, Y, S)); \
-   goto *opcode_table[bank_readbyte(PC++)];
+   CODE_CHECK_PAGE();                                                    \
+   PROFILE_BEGIN();                                                      \
+   instructions++;                                                       \
+   goto *opcode_table[CODE_READBYTE(PC++)];
+
+#elif defined(NES6502_PREDECODE)
+
+#define OPCODE_END            \
+   if (remaining_cycles <= 0) \
+      goto end_execute;       \
+   CODE_CHECK_PAGE();         \
+   instructions++;            \
+   goto *decode_table[decode_ptr[PC++]];
+
+/* first half of a superinstruction done: carry on with the second,
+** unless the timeslice ran out (PC is on its opcode)
+*/
+#define FUSED_BEGIN(name) fused_##name:
+#define FUSED_NEXT()          \
+   if (remaining_cycles <= 0) \
+      goto end_execute;       \
+   instructions++;            \
+   PC++;
 
 #else /* !NES6520_DISASM */
 
 #define OPCODE_END            \
+   PROFILE_END();             \
    if (remaining_cycles <= 0) \
       goto end_execute;       \
-   goto *opcode_table[bank_readbyte(PC++)];
+   CODE_CHECK_PAGE();         \
+   PROFILE_BEGIN();           \
+   instructions++;            \
+   goto *opcode_table[CODE_READBYTE(PC++)];
 
 #endif /* !NES6502_DISASM */
 
@@ -1364,6 +2243,22 @@ int nes6502_execute(int timeslice_cycles)
    uint32 PC;
    uint8 A, X, Y, S;
 
+   /* instructions run, fused pairs count as two */
+   uint32 instructions = 0;
+
+   /* current code page */
+   uint8 *code_ptr = NULL;
+   uint32 code_start = CODE_PAGE_INVALID;
+   uint8 code_edge[3];
+
+#ifdef NES6502_PREDECODE
+   /* decode tags for the current code page */
+   static THREAD_LOCAL void *decode_table[DECODE_NUMTAGS];
+   uint16 *decode_ptr = decode_none;
+   uint16 tag;
+   int i;
+#endif /* NES6502_PREDECODE */
+
 #ifdef NES6502_JUMPTABLE
 
    static void *opcode_table[256] =
@@ -1401,10 +2296,42 @@ int nes6502_execute(int timeslice_cycles)
            &&opF0, &&opF1, &&opF2, &&opF3, &&opF4, &&opF5, &&opF6, &&opF7,
            &&opF8, &&opF9, &&opFA, &&opFB, &&opFC, &&opFD, &&opFE, &&opFF};
 
+#ifdef NES6502_PREDECODE
+   if (NULL == decode_table[DECODE_NONE])
+   {
+      decode_table[DECODE_NONE] = &&decode;
+      for (i = 0; i < 256; i++)
+         decode_table[DECODE_OPCODE + i] = opcode_table[i];
+      decode_table[DECODE_LDAI_STAZ] = &&fused_ldai_staz;
+      decode_table[DECODE_LDAI_STAA] = &&fused_ldai_staa;
+      decode_table[DECODE_LDAZ_STAZ] = &&fused_ldaz_staz;
+      decode_table[DECODE_LDAZ_STAA] = &&fused_ldaz_staa;
+      decode_table[DECODE_LDAA_STAZ] = &&fused_ldaa_staz;
+      decode_table[DECODE_LDAA_STAA] = &&fused_ldaa_staa;
+      decode_table[DECODE_DEX_BNE] = &&fused_dex_bne;
+      decode_table[DECODE_DEY_BNE] = &&fused_dey_bne;
+      decode_table[DECODE_INX_BNE] = &&fused_inx_bne;
+      decode_table[DECODE_INY_BNE] = &&fused_iny_bne;
+      decode_table[DECODE_INX_CPX_BNE] = &&fused_inx_cpx_bne;
+      decode_table[DECODE_INY_CPY_BNE] = &&fused_iny_cpy_bne;
+      decode_table[DECODE_LDAA_BPL] = &&fused_ldaa_bpl;
+      decode_table[DECODE_LDAA_BMI] = &&fused_ldaa_bmi;
+      decode_table[DECODE_BITA_BPL] = &&fused_bita_bpl;
+      decode_table[DECODE_BITA_BMI] = &&fused_bita_bmi;
+      decode_table[DECODE_BITA_BVC] = &&fused_bita_bvc;
+      decode_table[DECODE_BITA_BVS] = &&fused_bita_bvs;
+      decode_table[DECODE_LDAZ_BEQ] = &&fused_ldaz_beq;
+      decode_table[DECODE_LDAZ_BNE] = &&fused_ldaz_bne;
+   }
+#endif /* NES6502_PREDECODE */
+
 #endif /* NES6502_JUMPTABLE */
 
    remaining_cycles = timeslice_cycles;
 
+   /* interrupts come in between timeslices */
+   idle_pc = IDLE_NONE;
+
    GET_GLOBAL_REGS();
 
    /* check for DMA cycle burning */
@@ -1438,10 +2365,24 @@ int nes6502_execute(int timeslice_cycles)
 #endif /* NES6502_DISASM */
 
       /* Fetch and execute instruction */
-      switch (bank_readbyte(PC++))
+      CODE_CHECK_PAGE();
+      PROFILE_BEGIN();
+      instructions++;
+      switch (CODE_READBYTE(PC++))
       {
 #endif /* !NES6502_JUMPTABLE */
 
+#ifdef NES6502_PREDECODE
+   /* PC is one past an opcode that hasn't been decoded yet */
+decode:
+   if (CODE_PAGE_INVALID == code_start || NULL == decode_page[code_start >> NES6502_BANKSHIFT])
+      goto *opcode_table[CODE_READBYTE(PC - 1)];
+
+   tag = decode_tag(code_ptr + PC - 1, NES6502_BANKSIZE - (PC - 1 - code_start));
+   decode_ptr[PC - 1] = tag;
+   goto *decode_table[tag];
+#endif /* NES6502_PREDECODE */
+
    OPCODE_BEGIN(00) /* BRK */
    BRK();
    OPCODE_END
@@ -1468,7 +2409,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(03) /* SLO ($nn,X) */
-   SLO(8, INDIR_X, mem_writebyte, addr);
+   SLO(8, INDIR_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(04) /* NOP $nn */
@@ -1514,11 +2455,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(0E) /* ASL $nnnn */
-   ASL(6, ABSOLUTE, mem_writebyte, addr);
+   ASL(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(0F) /* SLO $nnnn */
-   SLO(6, ABSOLUTE, mem_writebyte, addr);
+   SLO(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(10) /* BPL $nnnn */
@@ -1530,7 +2471,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(13) /* SLO ($nn),Y */
-   SLO(8, INDIR_Y, mem_writebyte, addr);
+   SLO(8, INDIR_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(14) /* NOP $nn,X */
@@ -1572,7 +2513,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(1B) /* SLO $nnnn,Y */
-   SLO(7, ABS_IND_Y, mem_writebyte, addr);
+   SLO(7, ABS_IND_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(1C) /* NOP $nnnn,X */
@@ -1589,11 +2530,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(1E) /* ASL $nnnn,X */
-   ASL(7, ABS_IND_X, mem_writebyte, addr);
+   ASL(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(1F) /* SLO $nnnn,X */
-   SLO(7, ABS_IND_X, mem_writebyte, addr);
+   SLO(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(20) /* JSR $nnnn */
@@ -1605,7 +2546,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(23) /* RLA ($nn,X) */
-   RLA(8, INDIR_X, mem_writebyte, addr);
+   RLA(8, INDIR_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(24) /* BIT $nn */
@@ -1649,11 +2590,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(2E) /* ROL $nnnn */
-   ROL(6, ABSOLUTE, mem_writebyte, addr);
+   ROL(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(2F) /* RLA $nnnn */
-   RLA(6, ABSOLUTE, mem_writebyte, addr);
+   RLA(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(30) /* BMI $nnnn */
@@ -1665,7 +2606,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(33) /* RLA ($nn),Y */
-   RLA(8, INDIR_Y, mem_writebyte, addr);
+   RLA(8, INDIR_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(35) /* AND $nn,X */
@@ -1689,7 +2630,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(3B) /* RLA $nnnn,Y */
-   RLA(7, ABS_IND_Y, mem_writebyte, addr);
+   RLA(7, ABS_IND_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(3D) /* AND $nnnn,X */
@@ -1697,11 +2638,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(3E) /* ROL $nnnn,X */
-   ROL(7, ABS_IND_X, mem_writebyte, addr);
+   ROL(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(3F) /* RLA $nnnn,X */
-   RLA(7, ABS_IND_X, mem_writebyte, addr);
+   RLA(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(40) /* RTI */
@@ -1713,7 +2654,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(43) /* SRE ($nn,X) */
-   SRE(8, INDIR_X, mem_writebyte, addr);
+   SRE(8, INDIR_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(45) /* EOR $nn */
@@ -1753,11 +2694,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(4E) /* LSR $nnnn */
-   LSR(6, ABSOLUTE, mem_writebyte, addr);
+   LSR(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(4F) /* SRE $nnnn */
-   SRE(6, ABSOLUTE, mem_writebyte, addr);
+   SRE(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(50) /* BVC $nnnn */
@@ -1769,7 +2710,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(53) /* SRE ($nn),Y */
-   SRE(8, INDIR_Y, mem_writebyte, addr);
+   SRE(8, INDIR_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(55) /* EOR $nn,X */
@@ -1793,7 +2734,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(5B) /* SRE $nnnn,Y */
-   SRE(7, ABS_IND_Y, mem_writebyte, addr);
+   SRE(7, ABS_IND_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(5D) /* EOR $nnnn,X */
@@ -1801,11 +2742,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(5E) /* LSR $nnnn,X */
-   LSR(7, ABS_IND_X, mem_writebyte, addr);
+   LSR(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(5F) /* SRE $nnnn,X */
-   SRE(7, ABS_IND_X, mem_writebyte, addr);
+   SRE(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(60) /* RTS */
@@ -1817,7 +2758,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(63) /* RRA ($nn,X) */
-   RRA(8, INDIR_X, mem_writebyte, addr);
+   RRA(8, INDIR_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(65) /* ADC $nn */
@@ -1857,11 +2798,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(6E) /* ROR $nnnn */
-   ROR(6, ABSOLUTE, mem_writebyte, addr);
+   ROR(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(6F) /* RRA $nnnn */
-   RRA(6, ABSOLUTE, mem_writebyte, addr);
+   RRA(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(70) /* BVS $nnnn */
@@ -1873,7 +2814,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(73) /* RRA ($nn),Y */
-   RRA(8, INDIR_Y, mem_writebyte, addr);
+   RRA(8, INDIR_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(75) /* ADC $nn,X */
@@ -1897,7 +2838,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(7B) /* RRA $nnnn,Y */
-   RRA(7, ABS_IND_Y, mem_writebyte, addr);
+   RRA(7, ABS_IND_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(7D) /* ADC $nnnn,X */
@@ -1905,11 +2846,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(7E) /* ROR $nnnn,X */
-   ROR(7, ABS_IND_X, mem_writebyte, addr);
+   ROR(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(7F) /* RRA $nnnn,X */
-   RRA(7, ABS_IND_X, mem_writebyte, addr);
+   RRA(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(80) /* NOP #$nn */
@@ -1921,11 +2862,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(81) /* STA ($nn,X) */
-   STA(6, INDIR_X_ADDR, mem_writebyte, addr);
+   STA(6, INDIR_X_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(83) /* SAX ($nn,X) */
-   SAX(6, INDIR_X_ADDR, mem_writebyte, addr);
+   SAX(6, INDIR_X_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(84) /* STY $nn */
@@ -1957,19 +2898,19 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(8C) /* STY $nnnn */
-   STY(4, ABSOLUTE_ADDR, mem_writebyte, addr);
+   STY(4, ABSOLUTE_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(8D) /* STA $nnnn */
-   STA(4, ABSOLUTE_ADDR, mem_writebyte, addr);
+   STA(4, ABSOLUTE_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(8E) /* STX $nnnn */
-   STX(4, ABSOLUTE_ADDR, mem_writebyte, addr);
+   STX(4, ABSOLUTE_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(8F) /* SAX $nnnn */
-   SAX(4, ABSOLUTE_ADDR, mem_writebyte, addr);
+   SAX(4, ABSOLUTE_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(90) /* BCC $nnnn */
@@ -1977,11 +2918,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(91) /* STA ($nn),Y */
-   STA(6, INDIR_Y_ADDR, mem_writebyte, addr);
+   STA(6, INDIR_Y_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(93) /* SHA ($nn),Y */
-   SHA(6, INDIR_Y_ADDR, mem_writebyte, addr);
+   SHA(6, INDIR_Y_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(94) /* STY $nn,X */
@@ -2005,7 +2946,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(99) /* STA $nnnn,Y */
-   STA(5, ABS_IND_Y_ADDR, mem_writebyte, addr);
+   STA(5, ABS_IND_Y_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(9A) /* TXS */
@@ -2013,23 +2954,23 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(9B) /* SHS $nnnn,Y */
-   SHS(5, ABS_IND_Y_ADDR, mem_writebyte, addr);
+   SHS(5, ABS_IND_Y_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(9C) /* SHY $nnnn,X */
-   SHY(5, ABS_IND_X_ADDR, mem_writebyte, addr);
+   SHY(5, ABS_IND_X_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(9D) /* STA $nnnn,X */
-   STA(5, ABS_IND_X_ADDR, mem_writebyte, addr);
+   STA(5, ABS_IND_X_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(9E) /* SHX $nnnn,Y */
-   SHX(5, ABS_IND_Y_ADDR, mem_writebyte, addr);
+   SHX(5, ABS_IND_Y_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(9F) /* SHA $nnnn,Y */
-   SHA(5, ABS_IND_Y_ADDR, mem_writebyte, addr);
+   SHA(5, ABS_IND_Y_ADDR, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(A0) /* LDY #$nn */
@@ -2165,7 +3106,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(C3) /* DCP ($nn,X) */
-   DCP(8, INDIR_X, mem_writebyte, addr);
+   DCP(8, INDIR_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(C4) /* CPY $nn */
@@ -2209,11 +3150,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(CE) /* DEC $nnnn */
-   DEC(6, ABSOLUTE, mem_writebyte, addr);
+   DEC(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(CF) /* DCP $nnnn */
-   DCP(6, ABSOLUTE, mem_writebyte, addr);
+   DCP(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(D0) /* BNE $nnnn */
@@ -2225,7 +3166,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(D3) /* DCP ($nn),Y */
-   DCP(8, INDIR_Y, mem_writebyte, addr);
+   DCP(8, INDIR_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(D5) /* CMP $nn,X */
@@ -2249,7 +3190,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(DB) /* DCP $nnnn,Y */
-   DCP(7, ABS_IND_Y, mem_writebyte, addr);
+   DCP(7, ABS_IND_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(DD) /* CMP $nnnn,X */
@@ -2257,11 +3198,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(DE) /* DEC $nnnn,X */
-   DEC(7, ABS_IND_X, mem_writebyte, addr);
+   DEC(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(DF) /* DCP $nnnn,X */
-   DCP(7, ABS_IND_X, mem_writebyte, addr);
+   DCP(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(E0) /* CPX #$nn */
@@ -2273,7 +3214,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(E3) /* ISB ($nn,X) */
-   ISB(8, INDIR_X, mem_writebyte, addr);
+   ISB(8, INDIR_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(E4) /* CPX $nn */
@@ -2314,11 +3255,11 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(EE) /* INC $nnnn */
-   INC(6, ABSOLUTE, mem_writebyte, addr);
+   INC(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(EF) /* ISB $nnnn */
-   ISB(6, ABSOLUTE, mem_writebyte, addr);
+   ISB(6, ABSOLUTE, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(F0) /* BEQ $nnnn */
@@ -2330,7 +3271,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(F3) /* ISB ($nn),Y */
-   ISB(8, INDIR_Y, mem_writebyte, addr);
+   ISB(8, INDIR_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(F5) /* SBC $nn,X */
@@ -2354,7 +3295,7 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(FB) /* ISB $nnnn,Y */
-   ISB(7, ABS_IND_Y, mem_writebyte, addr);
+   ISB(7, ABS_IND_Y, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(FD) /* SBC $nnnn,X */
@@ -2362,23 +3303,151 @@ int nes6502_execute(int timeslice_cycles)
    OPCODE_END
 
    OPCODE_BEGIN(FE) /* INC $nnnn,X */
-   INC(7, ABS_IND_X, mem_writebyte, addr);
+   INC(7, ABS_IND_X, MEM_WRITEBYTE, addr);
    OPCODE_END
 
    OPCODE_BEGIN(FF) /* ISB $nnnn,X */
-   ISB(7, ABS_IND_X, mem_writebyte, addr);
+   ISB(7, ABS_IND_X, MEM_WRITEBYTE, addr);
+   OPCODE_END
+
+#ifdef NES6502_PREDECODE
+   FUSED_BEGIN(ldai_staz) /* LDA #$nn / STA $nn */
+   LDA(2, IMMEDIATE_BYTE);
+   FUSED_NEXT();
+   STA(3, ZERO_PAGE_ADDR, ZP_WRITEBYTE, baddr);
+   OPCODE_END
+
+   FUSED_BEGIN(ldai_staa) /* LDA #$nn / STA $nnnn */
+   LDA(2, IMMEDIATE_BYTE);
+   FUSED_NEXT();
+   STA(4, ABSOLUTE_ADDR, MEM_WRITEBYTE, addr);
+   OPCODE_END
+
+   FUSED_BEGIN(ldaz_staz) /* LDA $nn / STA $nn */
+   LDA(3, ZERO_PAGE_BYTE);
+   FUSED_NEXT();
+   STA(3, ZERO_PAGE_ADDR, ZP_WRITEBYTE, baddr);
+   OPCODE_END
+
+   FUSED_BEGIN(ldaz_staa) /* LDA $nn / STA $nnnn */
+   LDA(3, ZERO_PAGE_BYTE);
+   FUSED_NEXT();
+   STA(4, ABSOLUTE_ADDR, MEM_WRITEBYTE, addr);
+   OPCODE_END
+
+   FUSED_BEGIN(ldaa_staz) /* LDA $nnnn / STA $nn */
+   LDA(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   STA(3, ZERO_PAGE_ADDR, ZP_WRITEBYTE, baddr);
+   OPCODE_END
+
+   FUSED_BEGIN(ldaa_staa) /* LDA $nnnn / STA $nnnn */
+   LDA(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   STA(4, ABSOLUTE_ADDR, MEM_WRITEBYTE, addr);
+   OPCODE_END
+
+   FUSED_BEGIN(dex_bne) /* DEX / BNE */
+   DEX();
+   FUSED_NEXT();
+   BNE();
+   OPCODE_END
+
+   FUSED_BEGIN(dey_bne) /* DEY / BNE */
+   DEY();
+   FUSED_NEXT();
+   BNE();
+   OPCODE_END
+
+   FUSED_BEGIN(inx_bne) /* INX / BNE */
+   INX();
+   FUSED_NEXT();
+   BNE();
+   OPCODE_END
+
+   FUSED_BEGIN(iny_bne) /* INY / BNE */
+   INY();
+   FUSED_NEXT();
+   BNE();
+   OPCODE_END
+
+   FUSED_BEGIN(inx_cpx_bne) /* INX / CPX #$nn / BNE */
+   INX();
+   FUSED_NEXT();
+   CPX(2, IMMEDIATE_BYTE);
+   FUSED_NEXT();
+   BNE();
+   OPCODE_END
+
+   FUSED_BEGIN(iny_cpy_bne) /* INY / CPY #$nn / BNE */
+   INY();
+   FUSED_NEXT();
+   CPY(2, IMMEDIATE_BYTE);
+   FUSED_NEXT();
+   BNE();
+   OPCODE_END
+
+   FUSED_BEGIN(ldaa_bpl) /* LDA $nnnn / BPL */
+   LDA(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   BPL();
+   OPCODE_END
+
+   FUSED_BEGIN(ldaa_bmi) /* LDA $nnnn / BMI */
+   LDA(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   BMI();
+   OPCODE_END
+
+   FUSED_BEGIN(bita_bpl) /* BIT $nnnn / BPL */
+   BIT(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   BPL();
+   OPCODE_END
+
+   FUSED_BEGIN(bita_bmi) /* BIT $nnnn / BMI */
+   BIT(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   BMI();
+   OPCODE_END
+
+   FUSED_BEGIN(bita_bvc) /* BIT $nnnn / BVC */
+   BIT(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   BVC();
+   OPCODE_END
+
+   FUSED_BEGIN(bita_bvs) /* BIT $nnnn / BVS */
+   BIT(4, ABSOLUTE_BYTE);
+   FUSED_NEXT();
+   BVS();
+   OPCODE_END
+
+   FUSED_BEGIN(ldaz_beq) /* LDA $nn / BEQ */
+   LDA(3, ZERO_PAGE_BYTE);
+   FUSED_NEXT();
+   BEQ();
+   OPCODE_END
+
+   FUSED_BEGIN(ldaz_bne) /* LDA $nn / BNE */
+   LDA(3, ZERO_PAGE_BYTE);
+   FUSED_NEXT();
+   BNE();
    OPCODE_END
+#endif /* NES6502_PREDECODE */
 
 #ifdef NES6502_JUMPTABLE
 end_execute:
 
 #else  /* !NES6502_JUMPTABLE */
       }
+      PROFILE_END();
    }
 #endif /* !NES6502_JUMPTABLE */
 
    /* store local copy of regs */
    STORE_LOCAL_REGS();
+   total_instructions += instructions;
 
    /* Return our actual amount of executed cycles */
    return (cpu.total_cycles - old_cycles);
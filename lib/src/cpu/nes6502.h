@@ -34,11 +34,30 @@
 /* Define this to enable decimal mode in ADC / SBC (not needed in NES) */
 /*#define  NES6502_DECIMAL*/
 
+/* Define this to predecode code in PRG-ROM/SRAM and fuse common
+** instruction pairs (gcc only, costs 2 bytes of RAM per byte of code).
+** No faster on x86, where the branch predictor already hides most of
+** the dispatch; it's for the ESP32's in-order core, where every
+** dispatch is an unpredicted indirect jump, so measure it there first
+*/
+/*#define  NES6502_PREDECODE*/
+
+/* Define this to count executions and cycles per opcode and sample
+** the PC into a histogram (see nes6502_profdump); turns off predecode
+*/
+/*#define  NES6502_PROFILE*/
+#define NES6502_PROFILE_SLOTS 2048 /* distinct PCs the histogram holds */
+#define NES6502_PROFILE_VERSION 1
+
 #define NES6502_NUMBANKS 16
 #define NES6502_BANKSHIFT 12
 #define NES6502_BANKSIZE (0x10000 / NES6502_NUMBANKS)
 #define NES6502_BANKMASK (NES6502_BANKSIZE - 1)
 
+/* memory handlers are dispatched through a table of 256-byte pages */
+#define NES6502_NUMPAGES 256
+#define NES6502_PAGESHIFT 8
+
 /* P (flag) register bitmasks */
 #define N_FLAG 0x80
 #define V_FLAG 0x40
@@ -64,16 +83,35 @@
 /* Stack is located on 6502 page 1 */
 #define STACK_OFFSET 0x0100
 
+typedef uint8 (*nes6502_readfunc)(uint32 address);
+typedef void (*nes6502_writefunc)(uint32 address, uint8 value);
+
+/* how many cycles reads of an I/O address are sure to keep returning
+** the same value, for idle loop skipping (0 = don't skip)
+*/
+typedef int32 (*nes6502_idlefunc)(uint32 address);
+#define NES6502_IDLE_FOREVER 0x7FFFFFFF
+
+/* a region of memory code is predecoded in, keyed by offset into it */
+#define NES6502_MAX_CODE 2
+
+typedef struct
+{
+   uint8 *base;
+   uint32 size;
+   uint16 *tags; /* decoded instruction at each byte, 0 = not yet */
+} nes6502_code;
+
 typedef struct
 {
    uint32 min_range, max_range;
-   uint8 (*read_func)(uint32 address);
+   nes6502_readfunc read_func;
 } nes6502_memread;
 
 typedef struct
 {
    uint32 min_range, max_range;
-   void (*write_func)(uint32 address, uint8 value);
+   nes6502_writefunc write_func;
 } nes6502_memwrite;
 
 typedef struct
@@ -83,6 +121,18 @@ typedef struct
    nes6502_memread *read_handler;
    nes6502_memwrite *write_handler;
 
+   /* per-page dispatch, compiled from the handler lists by
+   ** nes6502_buildpages -- NULL entries are plain paged memory
+   */
+   nes6502_readfunc *read_page;
+   nes6502_writefunc *write_page;
+
+   /* NULL: idle loops polling I/O are never skipped */
+   nes6502_idlefunc idle_func;
+
+   /* predecoded code regions, see nes6502_addcode */
+   nes6502_code code[NES6502_MAX_CODE];
+
    uint32 pc_reg;
    uint8 a_reg, p_reg;
    uint8 x_reg, y_reg;
@@ -106,10 +156,32 @@ extern "C"
    extern void nes6502_nmi(void);
    extern void nes6502_irq(void);
    extern uint8 nes6502_getbyte(uint32 address);
+   extern uint8 *nes6502_getpage(uint32 address);
    extern uint32 nes6502_getcycles(bool reset_flag);
+   extern uint32 nes6502_getinstructions(bool reset_flag);
    extern void nes6502_burn(int cycles);
    extern void nes6502_release(void);
 
+   /* In-place bankswitching of the live context */
+   extern void nes6502_setpages(int page, int num_pages, uint8 *base);
+   extern uint32 nes6502_getbankswitches(bool reset_flag);
+
+   /* Idle loop skipping */
+   extern void nes6502_setidle(bool enable);
+   extern uint32 nes6502_getidlecycles(bool reset_flag);
+
+   /* Predecode cache (only with NES6502_PREDECODE) */
+   extern int nes6502_addcode(nes6502_context *cpu, uint8 *base, uint32 size);
+   extern void nes6502_flushcode(nes6502_context *cpu);
+   extern void nes6502_freecode(nes6502_context *cpu);
+
+   /* Execution profiler (only with NES6502_PROFILE) */
+   extern void nes6502_profreset(const uint8 *prg, uint32 prg_size);
+   extern int nes6502_profdump(void (*write_func)(const uint8 *data, int len), bool reset_flag);
+
+   /* Compile handler lists into the per-page dispatch tables */
+   extern void nes6502_buildpages(nes6502_context *cpu);
+
    /* Context get/set */
    extern void nes6502_setcontext(nes6502_context *cpu);
    extern void nes6502_getcontext(nes6502_context *cpu);
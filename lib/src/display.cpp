@@ -1,5 +1,7 @@
 extern "C" {
   #include <nes/nes.h>
+  #include <vid_drv.h>
+  #include <vid_scale.h>
 }
 
 #define LGFX_USE_V1
@@ -14,9 +16,6 @@ extern "C" {
 #define PIN_BUSY        -1
 #define PIN_BL          45
 
-// Macro per swap dei byte per i colori (necessaria per i colori corretti)
-#define SWAP16(x) ((x >> 8) | (x << 8))
-
 // Configurazione
 #define PWM_CHANNEL     7
 #define FREQ_WRITE      40000000
@@ -31,6 +30,49 @@ extern "C" {
 #define DISPLAY_WIDTH   480
 #define DISPLAY_HEIGHT  320
 
+// Righe dello schermo per banda e bande in giro: la CPU converte la
+// prossima mentre il DMA manda quella prima (LovyanGFX ne fa una alla
+// volta, quindi 2 bastano; 4 lasciano margine se il driver le accoda)
+#ifndef DISPLAY_BAND_ROWS
+#define DISPLAY_BAND_ROWS 16
+#endif
+
+#ifndef DISPLAY_BAND_BUFFERS
+#define DISPLAY_BAND_BUFFERS 2
+#endif
+
+#if DISPLAY_BAND_BUFFERS < 2 || DISPLAY_BAND_ROWS < 1
+#error "DISPLAY_BAND_BUFFERS almeno 2, DISPLAY_BAND_ROWS almeno 1"
+#endif
+
+// Modo di scaling all'avvio (VIDSCALE_STRETCH, _1X, _8_7, _4_3, _CROPPED)
+#ifndef DISPLAY_SCALE_MODE
+#define DISPLAY_SCALE_MODE VIDSCALE_STRETCH
+#endif
+
+// Scaling morbido all'avvio: le colonne a cavallo di due pixel NES li
+// mescolano, invece di pixel larghi a volte 1 e a volte 2
+#ifndef DISPLAY_SMOOTH
+#define DISPLAY_SMOOTH 0
+#endif
+
+// Un frame morbido che ci mette piu' di DISPLAY_FRAME_BUDGET_US (60 Hz)
+// fa tornare al nearest per DISPLAY_SMOOTH_BACKOFF frame, poi si riprova
+#ifndef DISPLAY_FRAME_BUDGET_US
+#define DISPLAY_FRAME_BUDGET_US 16666
+#endif
+
+#ifndef DISPLAY_SMOOTH_BACKOFF
+#define DISPLAY_SMOOTH_BACKOFF 300
+#endif
+
+// Ogni quanti frame stampare la banda passante del bus (0: mai). Spento
+// se non richiesto, come il profiler: la stessa UART porta il dump
+// binario del profilo, e una riga in mezzo lo rovinerebbe
+#ifndef DISPLAY_REPORT_FRAMES
+#define DISPLAY_REPORT_FRAMES 0
+#endif
+
 class LGFX : public lgfx::LGFX_Device {
   lgfx::Panel_ILI9488 _panel_instance;
   lgfx::Bus_Parallel16 _bus_instance;
@@ -97,12 +139,42 @@ public:
 // Istanza display
 LGFX gfx;
 
-// Scaling arrays
-static uint16_t scale_x[DISPLAY_WIDTH];
-static uint8_t scale_y[DISPLAY_HEIGHT];
+// Tabelle di scaling e palette RGB565 (byte gia' invertiti per il bus)
+static vidscale_t lcd_scale;
+
+// Finestra NES da mostrare (overscan) e modo di scaling: arrivano dal
+// task dell'emulatore, le tabelle si rifanno qui all'inizio del frame
+// successivo. Si passano sotto window_mux, cosi' il display non legge
+// mai una finestra scritta a meta'
+static portMUX_TYPE window_mux = portMUX_INITIALIZER_UNLOCKED;
+static rect_t window_next = { 0, 0, NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT };
+static volatile int mode_next = DISPLAY_SCALE_MODE;
+static bool window_pending = false;
+
+// Morbido richiesto (dal task dell'emulatore), e qui l'ultima richiesta
+// vista e i frame che restano in nearest dopo uno sforato
+static volatile bool smooth_next = DISPLAY_SMOOTH;
+static bool smooth_asked = DISPLAY_SMOOTH;
+static int smooth_backoff = 0;
+
+// Buffer di banda in DMA: uno si riempie mentre l'altro va sul bus
+static uint16_t *band_buffer[DISPLAY_BAND_BUFFERS];
+static int band_rows = 0;
+static int band_next = 0;
+
+#ifdef NOFRENDO_LINE_STREAM
+static bool band_open = false;
+static uint32_t band_busy_us = 0;
+#endif
+
+// Misure per il report: tempo del frame, di conversione, e byte mandati
+static struct {
+  uint32_t frame_start;
+  uint32_t frames, frame_us, convert_us, bytes;
+  uint32_t smooth_frames, over_budget;
+} bus_stats;
 
 extern int16_t bg_color;
-extern uint16_t myPalette[];
 
 extern void display_begin() {
   Serial.println("Initializing display...");
@@ -142,46 +214,284 @@ extern void display_begin() {
 
 extern "C" void display_init() {
   // Precalcola scaling
-  for (int x = 0; x < DISPLAY_WIDTH; x++) {
-    scale_x[x] = (x * NES_SCREEN_WIDTH) / DISPLAY_WIDTH;
-  }
-  
-  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
-    scale_y[y] = (y * NES_SCREEN_HEIGHT) / DISPLAY_HEIGHT;
+  vidscale_setmode(&lcd_scale, mode_next, 0, 0, NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+
+#ifdef NOFRENDO_LINE_STREAM
+  // Abbastanza righe per la banda piu' alta, anche con tutto l'overscan
+  // e il modo che taglia di piu'
+  band_rows = VID_STREAM_BAND * DISPLAY_HEIGHT / (NES_SCREEN_HEIGHT - 2 * VID_OVERSCAN_MAX - 2 * VIDSCALE_CROP) + 1;
+#else
+  band_rows = DISPLAY_BAND_ROWS;
+#endif
+
+  for (int i = 0; i < DISPLAY_BAND_BUFFERS; i++) {
+    band_buffer[i] = (uint16_t *)heap_caps_malloc(band_rows * DISPLAY_WIDTH * sizeof(uint16_t), MALLOC_CAP_DMA);
+    if (!band_buffer[i]) {
+      Serial.printf("No DMA memory for %d bands of %d rows\n", DISPLAY_BAND_BUFFERS, band_rows);
+      band_rows = 0;
+      break;
+    }
   }
-  
+
   Serial.println("Display scaling initialized");
 }
 
-extern "C" void display_write_frame(const uint8_t *data[]) {
+extern "C" void display_set_palette(const uint16_t *palette) {
+  vidscale_setpalette(&lcd_scale, palette);
+}
+
+extern "C" void display_set_window(const rect_t *window) {
+  portENTER_CRITICAL(&window_mux);
+  window_next = *window;
+  window_pending = true;
+  portEXIT_CRITICAL(&window_mux);
+}
+
+extern "C" int display_get_scalemode() {
+  return mode_next;
+}
+
+extern "C" void display_set_scalemode(int mode) {
+  if (mode < 0 || mode >= VIDSCALE_MODES) return;
+
+  portENTER_CRITICAL(&window_mux);
+  mode_next = mode;
+  window_pending = true;
+  portEXIT_CRITICAL(&window_mux);
+}
+
+extern "C" bool display_get_smooth() {
+  return smooth_next;
+}
+
+extern "C" void display_set_smooth(bool smooth) {
+  smooth_next = smooth;
+}
+
+// Tabelle per la nuova finestra o il nuovo modo, se sono cambiati: la
+// parte tagliata non ha righe, il resto va nell'area del modo, e il
+// bordo intorno si disegna qui una volta sola. True se sono nuove
+static bool apply_window() {
+  portENTER_CRITICAL(&window_mux);
+  bool pending = window_pending;
+  rect_t window = window_next;
+  int mode = mode_next;
+  window_pending = false;
+  portEXIT_CRITICAL(&window_mux);
+
+  if (!pending) return false;
+
+  vidscale_setmode(&lcd_scale, mode, window.x, window.y, window.w, window.h, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+
+  if (lcd_scale.width < DISPLAY_WIDTH || lcd_scale.height < DISPLAY_HEIGHT) {
+    gfx.fillScreen(bg_color);
+  }
+
+  return true;
+}
+
+// Morbido o no per questo frame: se richiesto e non in pausa dopo un
+// frame sforato (una richiesta nuova toglie la pausa). True se cambia,
+// e allora il frame va mandato tutto
+static bool apply_smooth() {
+  bool asked = smooth_next;
+
+  if (asked != smooth_asked) {
+    smooth_asked = asked;
+    smooth_backoff = 0;
+  }
+
+  bool smooth = asked && 0 == smooth_backoff;
+
+  if (smooth_backoff > 0) smooth_backoff--;
+  if (smooth == lcd_scale.smooth) return false;
+
+  lcd_scale.smooth = smooth;
+  return true;
+}
+
+// Solo l'area del modo: i frame non toccano il bordo
+static inline void set_area() {
+  gfx.setAddrWindow(lcd_scale.x, lcd_scale.y, lcd_scale.width, lcd_scale.height);
+}
+
+// Righe dello schermo dalle linee NES: a 8 bit passano per la palette,
+// gia' risolte in RGB565 dalla PPU (NOFRENDO_RGB565) vanno solo scalate
+// (le righe che ripetono la linea di sopra si copiano e basta)
+static inline void scale_rows(const uint8_t *data[], int first_row, int num_rows, uint16_t *dest) {
+  vidscale_fill(&lcd_scale, (uint8 *const *)data, first_row, num_rows, dest);
+}
+
+static inline void scale_rows(const uint16_t *data[], int first_row, int num_rows, uint16_t *dest) {
+  vidscale_fill16(&lcd_scale, (uint16 *const *)data, first_row, num_rows, dest);
+}
+
+static inline int scale_band(const uint8_t *data[], int first_line, int num_lines, uint16_t *dest) {
+  return vidscale_band(&lcd_scale, (uint8 *const *)data, first_line, num_lines, dest);
+}
+
+static inline int scale_band(const uint16_t *data[], int first_line, int num_lines, uint16_t *dest) {
+  return vidscale_band16(&lcd_scale, (uint16 *const *)data, first_line, num_lines, dest);
+}
+
+// La prossima banda libera: pushPixelsDMA aspetta che finisca il DMA
+// prima di partire, quindi quella mandata DISPLAY_BAND_BUFFERS - 1
+// bande fa e' gia' arrivata
+static inline uint16_t *next_band() {
+  uint16_t *buf = band_buffer[band_next];
+  band_next = (band_next + 1) % DISPLAY_BAND_BUFFERS;
+  return buf;
+}
+
+static inline void push_band(uint16_t *buf, int rows) {
+  gfx.pushPixelsDMA(buf, rows * lcd_scale.width);
+  bus_stats.bytes += rows * lcd_scale.width * sizeof(uint16_t);
+}
+
+// Fine del frame: aspetta l'ultimo DMA, se era morbido e il display ci
+// ha lavorato (busy_us) piu' del budget torna al nearest per un po', e
+// ogni DISPLAY_REPORT_FRAMES frame stampa quanto del bus a 16 bit e
+// FREQ_WRITE si e' usato
+static void end_frame(uint32_t busy_us) {
+  gfx.waitDMA();
+  gfx.endWrite();
+
+  uint32_t frame_us = micros() - bus_stats.frame_start;
+  if (lcd_scale.smooth) {
+    bus_stats.smooth_frames++;
+    if (busy_us > DISPLAY_FRAME_BUDGET_US) {
+      smooth_backoff = DISPLAY_SMOOTH_BACKOFF;
+      bus_stats.over_budget++;
+    }
+  }
+
+  bus_stats.frame_us += frame_us;
+  if (0 == DISPLAY_REPORT_FRAMES || ++bus_stats.frames < DISPLAY_REPORT_FRAMES) return;
+
+  // Solo interi: il task del display ha poco stack per formattare float
+  uint32_t achieved = (uint32_t)((uint64_t)bus_stats.bytes * 1000 / bus_stats.frame_us);  // KB/s
+  uint32_t limit = FREQ_WRITE * 2 / 1000;
+  Serial.printf("LCD: %u us/frame (%u us converting), %u KB/s of %u KB/s on the bus (%u per mille), bands of %d rows x %d, %u frames smooth (%u over budget)\n",
+                bus_stats.frame_us / bus_stats.frames, bus_stats.convert_us / bus_stats.frames,
+                achieved, limit, (uint32_t)((uint64_t)achieved * 1000 / limit), band_rows, DISPLAY_BAND_BUFFERS,
+                bus_stats.smooth_frames, bus_stats.over_budget);
+  memset(&bus_stats, 0, sizeof(bus_stats));
+}
+
+// Le righe [first_row, end_row) dell'area, con la finestra di scrittura
+// solo su quelle
+template <typename pixel_t>
+static void write_rows(const pixel_t *data[], int first_row, int end_row) {
+  if (end_row <= first_row) return;
+
+  // La finestra cambia solo a bus fermo
+  gfx.waitDMA();
+  gfx.setAddrWindow(lcd_scale.x, lcd_scale.y + first_row, lcd_scale.width, end_row - first_row);
+
+  for (int y = first_row; y < end_row; y += band_rows) {
+    int rows = (y + band_rows <= end_row) ? band_rows : end_row - y;
+    uint16_t *buf = next_band();
+
+    // Converti la banda mentre va in DMA quella prima
+    uint32_t start = micros();
+    scale_rows(data, y, rows, buf);
+    bus_stats.convert_us += micros() - start;
+
+    push_band(buf, rows);
+  }
+}
+
+// Un frame intero (num_dirties < 0), o solo le sue bande di linee NES
+// cambiate (dal video driver, in ordine dall'alto): quelle attaccate
+// vanno in una finestra sola, e se non ne e' cambiata nessuna non si
+// manda niente
+template <typename pixel_t>
+static void write_frame(const pixel_t *data[], int num_dirties, const rect_t *dirty_rects) {
   // Verifica che i dati esistano
-  if (!data) return;
-  
-  // Prepara un buffer di linea per una velocità ottimale
-  static uint16_t line_buffer[DISPLAY_WIDTH];
+  if (!data || 0 == band_rows) return;
+
+  // Con tabelle nuove, o passando tra morbido e nearest, lo schermo non
+  // ha piu' niente del frame prima
+  if (apply_window()) num_dirties = -1;
+  if (apply_smooth()) num_dirties = -1;
+  bus_stats.frame_start = micros();
   
   // Disegna direttamente sullo schermo
   gfx.startWrite();
   
-  // Imposta la finestra di scrittura una volta sola per l'intero frame
-  gfx.setAddrWindow(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
-  
-  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
-    // Prendi la linea sorgente usando lo scaling
-    const uint8_t* src = data[scale_y[y]];
-    
-    // Prerendi i pixel della linea nel buffer
-    for (int x = 0; x < DISPLAY_WIDTH; x++) {
-      // Applica SWAP16 per invertire i byte del colore come nel codice originale
-      line_buffer[x] = SWAP16(myPalette[src[scale_x[x]]]);
+  if (num_dirties < 0) {
+    write_rows(data, 0, lcd_scale.height);
+  }
+
+  for (int i = 0; i < num_dirties; ) {
+    int first_line = dirty_rects[i].y;
+    int end_line = first_line + dirty_rects[i].h;
+
+    for (i++; i < num_dirties && dirty_rects[i].y == end_line; i++) {
+      end_line += dirty_rects[i].h;
     }
-    
-    // Invia l'intera linea in un'unica operazione (molto più veloce)
-    gfx.pushPixelsDMA(line_buffer, DISPLAY_WIDTH);
+
+    write_rows(data, lcd_scale.first_row[first_line], lcd_scale.first_row[end_line]);
   }
   
-  gfx.endWrite();
+  end_frame(micros() - bus_stats.frame_start);
+}
+
+extern "C" void display_write_frame(const uint8_t *data[], int num_dirties, const rect_t *dirty_rects) {
+  write_frame(data, num_dirties, dirty_rects);
+}
+
+extern "C" void display_write_frame16(const uint16_t *data[], int num_dirties, const rect_t *dirty_rects) {
+  write_frame(data, num_dirties, dirty_rects);
+}
+
+#ifdef NOFRENDO_LINE_STREAM
+// Una banda di righe NES appena finite: la finestra si apre con la prima
+// banda del frame e si chiude con l'ultima
+template <typename pixel_t>
+static void write_band(const pixel_t *data[], int first_line, int num_lines) {
+  if (!data || 0 == band_rows) return;
+
+  if (0 == first_line) {
+    apply_window();
+    apply_smooth();
+    bus_stats.frame_start = micros();
+    gfx.startWrite();
+    set_area();
+    band_open = true;
+    band_busy_us = 0;
+  }
+
+  // Niente finestra aperta (frame iniziato a meta'), aspetta il prossimo
+  if (!band_open) return;
+
+  // Il DMA precedente usa un altro buffer
+  uint16_t *buf = band_buffer[band_next];
+  uint32_t start = micros();
+  int rows = scale_band(data, first_line, num_lines, buf);
+  bus_stats.convert_us += micros() - start;
+  if (rows > 0) {
+    next_band();
+    push_band(buf, rows);
+  }
+
+  // Tra una banda e l'altra si aspetta la PPU, quello non conta
+  band_busy_us += micros() - start;
+
+  if (first_line + num_lines >= NES_SCREEN_HEIGHT) {
+    end_frame(band_busy_us);
+    band_open = false;
+  }
+}
+
+extern "C" void display_write_band(const uint8_t *data[], int first_line, int num_lines) {
+  write_band(data, first_line, num_lines);
+}
+
+extern "C" void display_write_band16(const uint16_t *data[], int first_line, int num_lines) {
+  write_band(data, first_line, num_lines);
 }
+#endif
 
 extern "C" void display_clear() {
   gfx.fillScreen(bg_color);
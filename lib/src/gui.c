@@ -64,7 +64,7 @@ rgb_t gui_pal[GUI_TOTALCOLORS] =
 /**************************************************************/
 #include "pcx.h"
 #include "nes/nesstate.h"
-static bool option_drawsprites = true;
+static THREAD_LOCAL bool option_drawsprites = true;
 
 /* save a PCX snapshot */
 void gui_savesnap(void)
@@ -116,7 +116,7 @@ void gui_toggle_chan(int chan)
 {
 #define FILL_CHAR 0x7C  /* ASCII 124 '|' */
 #define BLANK_CHAR 0x7F /* ASCII 127   [delta] */
-   static bool chan_enabled[6] = {true, true, true, true, true, true};
+   static THREAD_LOCAL bool chan_enabled[6] = {true, true, true, true, true, true};
 
    chan_enabled[chan] ^= true;
    apu_setchan(chan, chan_enabled[chan]);
@@ -133,7 +133,7 @@ void gui_toggle_chan(int chan)
 void gui_setfilter(int filter_type)
 {
    char *types[3] = {"no", "lowpass", "weighted"};
-   static int last_filter = 2;
+   static THREAD_LOCAL int last_filter = 2;
 
    if (last_filter == filter_type || filter_type < 0 || filter_type > 2)
       return;
@@ -159,23 +159,23 @@ enum
 };
 
 /* TODO: roll options into a structure */
-static message_t msg;
-static bool option_showfps = false;
-static bool option_showgui = false;
-static int option_wavetype = GUI_WAVENONE;
-static bool option_showpattern = false;
-static bool option_showoam = false;
-static int pattern_col = 0;
+static THREAD_LOCAL message_t msg;
+static THREAD_LOCAL bool option_showfps = false;
+static THREAD_LOCAL bool option_showgui = false;
+static THREAD_LOCAL int option_wavetype = GUI_WAVENONE;
+static THREAD_LOCAL bool option_showpattern = false;
+static THREAD_LOCAL bool option_showoam = false;
+static THREAD_LOCAL int pattern_col = 0;
 
 /* timimg variables */
-static bool gui_fpsupdate = false;
-static int gui_ticks = 0;
-static int gui_fps = 0;
-static int gui_refresh = 60; /* default to 60Hz */
+static THREAD_LOCAL bool gui_fpsupdate = false;
+static THREAD_LOCAL int gui_ticks = 0;
+static THREAD_LOCAL int gui_fps = 0;
+static THREAD_LOCAL int gui_refresh = 60; /* default to 60Hz */
 
-static int mouse_x, mouse_y, mouse_button;
+static THREAD_LOCAL int mouse_x, mouse_y, mouse_button;
 
-static bitmap_t *gui_surface;
+static THREAD_LOCAL bitmap_t *gui_surface;
 
 /* Put a pixel on our bitmap- just for GUI use */
 INLINE void gui_putpixel(int x_pos, int y_pos, uint8 color)
@@ -332,7 +332,7 @@ static void gui_drawmouse(void)
 void gui_tick(int ticks)
 {
 
-   static int fps_counter = 0;
+   static THREAD_LOCAL int fps_counter = 0;
 
    gui_ticks += ticks;
    fps_counter += ticks;
@@ -348,7 +348,7 @@ void gui_tick(int ticks)
 static void gui_tickdec(void)
 {
 #ifdef NOFRENDO_DEBUG
-   static int hertz_ticks = 0;
+   static THREAD_LOCAL int hertz_ticks = 0;
 #endif /* NOFRENDO_DEBUG */
    int ticks = gui_ticks;
 
@@ -379,7 +379,7 @@ static void gui_tickdec(void)
 /* Update the FPS display */
 static void gui_updatefps(void)
 {
-   static char fpsbuf[20];
+   static THREAD_LOCAL char fpsbuf[20];
 
    /* Check to see if we need to do an sprintf or not */
    if (true == gui_fpsupdate)
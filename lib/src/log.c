@@ -31,7 +31,7 @@
 #include "log.h"
 
 #ifdef NOFRENDO_LOG_TO_FILE
-static FILE *errorlog = NULL;
+static THREAD_LOCAL FILE *errorlog = NULL;
 #endif /* NOFRENDO_LOG_TO_FILE */
 
 static int (*log_func)(const char *string) = NULL;
@@ -79,7 +79,7 @@ int nofrendo_log_print(const char *string)
 int nofrendo_log_printf(const char *format, ...)
 {
    /* don't allocate on stack every call */
-   static char buffer[1024 + 1];
+   static THREAD_LOCAL char buffer[1024 + 1];
    va_list arg;
 
    va_start(arg, format);
@@ -28,15 +28,15 @@
 #include "../nes/nes.h"
 #include "../libsnss/libsnss.h"
 
-static struct
+static THREAD_LOCAL struct
 {
    int counter, latch;
    bool enabled, reset;
 } irq;
 
-static uint8 reg;
-static uint8 command;
-static uint16 vrombase;
+static THREAD_LOCAL uint8 reg;
+static THREAD_LOCAL uint8 command;
+static THREAD_LOCAL uint16 vrombase;
 
 /* mapper 4: MMC3 */
 static void map4_write(uint32 address, uint8 value)
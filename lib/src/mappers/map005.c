@@ -33,7 +33,7 @@
 ** let's implement it correctly/completely
 */
 
-static struct
+static THREAD_LOCAL struct
 {
    int counter, enabled;
    int reset, latch;
@@ -59,7 +59,7 @@ static void map5_hblank(int vblank)
 
 static void map5_write(uint32 address, uint8 value)
 {
-   static int page_size = 8;
+   static THREAD_LOCAL int page_size = 8;
 
    /* ex-ram memory-- bleh! */
    if (address >= 0x5C00 && address <= 0x5FFF)
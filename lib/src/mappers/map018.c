@@ -47,7 +47,7 @@
       mmc_bankvrom(1, (bank) << 10, (highnybbles[(bank)] << 4) + lownybbles[(bank)]); \
    }
 
-static struct
+static THREAD_LOCAL struct
 {
    int counter, enabled;
    uint8 nybbles[4];
@@ -59,10 +59,10 @@ static void map18_init(void)
    irq.counter = irq.enabled = 0;
 }
 
-static uint8 lownybbles[8];
-static uint8 highnybbles[8];
-static uint8 lowprgnybbles[3];
-static uint8 highprgnybbles[3];
+static THREAD_LOCAL uint8 lownybbles[8];
+static THREAD_LOCAL uint8 highnybbles[8];
+static THREAD_LOCAL uint8 lowprgnybbles[3];
+static THREAD_LOCAL uint8 highprgnybbles[3];
 
 static void map18_write(uint32 address, uint8 value)
 {
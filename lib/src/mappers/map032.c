@@ -27,7 +27,7 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes_ppu.h"
 
-static int select_c000 = 0;
+static THREAD_LOCAL int select_c000 = 0;
 
 /* mapper 32: Irem G-101 */
 static void map32_write(uint32 address, uint8 value)
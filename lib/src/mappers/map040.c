@@ -31,7 +31,7 @@
 
 #define MAP40_IRQ_PERIOD (4096 / 113.666666)
 
-static struct
+static THREAD_LOCAL struct
 {
    int enabled, counter;
 } irq;
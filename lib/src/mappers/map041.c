@@ -32,8 +32,8 @@
 #include "../libsnss/libsnss.h"
 #include "../log.h"
 
-static uint8 register_low;
-static uint8 register_high;
+static THREAD_LOCAL uint8 register_low;
+static THREAD_LOCAL uint8 register_high;
 
 /*****************************************************/
 /* Set 8K CHR bank from the combined register values */
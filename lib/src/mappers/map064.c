@@ -28,14 +28,14 @@
 #include "../nes/nes.h"
 #include "../log.h"
 
-static struct
+static THREAD_LOCAL struct
 {
    int counter, latch;
    bool enabled, reset;
 } irq;
 
-static uint8 command = 0;
-static uint16 vrombase = 0x0000;
+static THREAD_LOCAL uint8 command = 0;
+static THREAD_LOCAL uint16 vrombase = 0x0000;
 
 static void map64_hblank(int vblank)
 {
@@ -27,7 +27,7 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes_ppu.h"
 
-static struct
+static THREAD_LOCAL struct
 {
    int counter;
    bool enabled;
@@ -27,8 +27,8 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes_ppu.h"
 
-static uint8 latch[2];
-static uint8 hibits;
+static THREAD_LOCAL uint8 latch[2];
+static THREAD_LOCAL uint8 hibits;
 
 /* mapper 75: Konami VRC1 */
 static void map75_write(uint32 address, uint8 value)
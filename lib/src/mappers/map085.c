@@ -28,7 +28,7 @@
 #include "../nes/nes.h"
 #include "../log.h"
 
-static struct
+static THREAD_LOCAL struct
 {
    int counter, latch;
    int wait_state;
@@ -28,7 +28,7 @@
 #include "../nes/nes_ppu.h"
 #include "../nes/nes.h"
 
-static struct
+static THREAD_LOCAL struct
 {
    bool enabled, expired;
    int counter;
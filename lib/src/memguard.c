@@ -54,8 +54,8 @@ bool mem_debug = false;
 
 #ifdef NOFRENDO_DEBUG
 
-static int mem_blockcount = 0; /* allocated block count */
-static memblock_t *mem_record = NULL;
+static THREAD_LOCAL int mem_blockcount = 0; /* allocated block count */
+static THREAD_LOCAL memblock_t *mem_record = NULL;
 
 #define GUARD_STRING "GgUuAaRrDdSsTtRrIiNnGgBbLlOoCcKk"
 #define GUARD_LENGTH 32 /* before and after allocated block */
@@ -43,14 +43,23 @@
 #define NES_CLOCK_DIVIDER 12
 //#define  NES_MASTER_CLOCK     21477272.727272727272
 #define NES_MASTER_CLOCK (236250000 / 11)
-#define NES_SCANLINE_CYCLES (1364.0 / NES_CLOCK_DIVIDER)
 #define NES_FIQ_PERIOD (NES_MASTER_CLOCK / NES_CLOCK_DIVIDER / 60)
 
+/* timeline, in master clocks */
+#define NES_SCANLINE_CLOCKS 1364
+#define NES_FRAME_CLOCKS (262 * NES_SCANLINE_CLOCKS)
+#define NES_FIQ_CLOCKS ((int)NES_FIQ_PERIOD * NES_CLOCK_DIVIDER)
+#define NES_NMI_DELAY (7 * NES_CLOCK_DIVIDER)
+#define NES_LINE_CLOCK(line) ((line) * NES_SCANLINE_CLOCKS)
+
+/* last scanline the PPU catches up to lazily */
+#define NES_LAST_CATCHUP_LINE 240
+
 #define NES_RAMSIZE 0x800
 
 #define NES_SKIP_LIMIT (NES_REFRESH_RATE / 5) /* 12 or 10, depending on PAL/NTSC */
 
-static nes_t nes;
+static THREAD_LOCAL nes_t nes;
 
 /* find out if a file is ours */
 int nes_isourfile(const char *filename)
@@ -245,6 +254,9 @@ static void build_address_handlers(nes_t *machine)
    machine->writehandler[num_handlers].write_func = NULL;
    num_handlers++;
    ASSERT(num_handlers <= MAX_MEM_HANDLERS);
+
+   /* flatten the lists into page tables for the CPU */
+   nes6502_buildpages(machine->cpu);
 }
 
 /* raise an IRQ */
@@ -271,24 +283,81 @@ static uint8 nes_clearfiq(void)
    return 0;
 }
 
-void nes_setfiq(uint8 value)
+/* where the CPU is on the timeline */
+static int32 nes_now(void)
 {
-   nes.fiq_state = value;
-   nes.fiq_cycles = (int)NES_FIQ_PERIOD;
+   return nes.clock_base + (int32)(nes6502_getcycles(false) - nes.cycle_base) * NES_CLOCK_DIVIDER;
+}
+
+/* CPU cycle count at which a scanline starts */
+static uint32 nes_linecycle(int scanline)
+{
+   int32 clocks = NES_LINE_CLOCK(scanline) - nes.clock_base;
+
+   if (clocks <= 0)
+      return nes.cycle_base + clocks / NES_CLOCK_DIVIDER;
+
+   return nes.cycle_base + (clocks + NES_CLOCK_DIVIDER - 1) / NES_CLOCK_DIVIDER;
 }
 
-static void nes_checkfiq(int cycles)
+/* (re)schedule an event; there is at most one of each type pending */
+static void nes_schedule(int type, int32 due)
 {
-   nes.fiq_cycles -= cycles;
-   if (nes.fiq_cycles <= 0)
+   int i, j;
+
+   for (i = 0; i < nes.num_events; i++)
    {
-      nes.fiq_cycles += (int)NES_FIQ_PERIOD;
-      if (0 == (nes.fiq_state & 0xC0))
+      if (nes.events[i].type == type)
       {
-         nes.fiq_occurred = true;
-         nes6502_irq();
+         memmove(&nes.events[i], &nes.events[i + 1],
+                 (nes.num_events - i - 1) * sizeof(nes_event_t));
+         nes.num_events--;
+         break;
       }
    }
+
+   ASSERT(nes.num_events < NES_MAX_EVENTS);
+
+   for (i = 0; i < nes.num_events; i++)
+   {
+      if (due < nes.events[i].due || (due == nes.events[i].due && type < nes.events[i].type))
+         break;
+   }
+
+   for (j = nes.num_events; j > i; j--)
+      nes.events[j] = nes.events[j - 1];
+
+   nes.events[i].due = due;
+   nes.events[i].type = type;
+   nes.num_events++;
+
+   /* scheduled from inside the CPU, ahead of the current timeslice */
+   if (nes.in_slice && due < nes.slice_due)
+      nes6502_release();
+}
+
+void nes_setfiq(uint8 value)
+{
+   nes.fiq_state = value;
+   nes_schedule(NES_EVENT_FIQ, nes_now() + NES_FIQ_CLOCKS);
+}
+
+static void nes_fiq(int32 due)
+{
+   nes_schedule(NES_EVENT_FIQ, due + NES_FIQ_CLOCKS);
+
+   if (0 == (nes.fiq_state & 0xC0))
+   {
+      nes.fiq_occurred = true;
+      nes6502_irq();
+   }
+}
+
+/* stop the CPU on every scanline even if the mapper doesn't need it */
+void nes_setlinesync(bool force)
+{
+   nes.force_line_sync = force;
+   nes.line_sync = force || (nes.mmc && NULL != nes.mmc->intf->hblank);
 }
 
 void nes_nmi(void)
@@ -296,47 +365,190 @@ void nes_nmi(void)
    nes6502_nmi();
 }
 
-static void nes_renderframe(bool draw_flag)
+/* how long a poll of <address> is sure to keep reading the same, for
+** the CPU's idle loop skipping
+*/
+static int32 nes_idlecycles(uint32 address)
 {
-   int elapsed_cycles;
-   mapintf_t *mapintf = nes.mmc->intf;
-   int in_vblank = 0;
+   uint32 cycle;
+   int32 next_line = NES6502_IDLE_FOREVER;
 
-   while (262 != nes.scanline)
+   /* RAM mirrors */
+   if (address < 0x2000)
+      return NES6502_IDLE_FOREVER;
+
+   if (address < 0x4000 && PPU_STAT == (address & 0x2007))
    {
+      cycle = nes6502_getcycles(false);
+
+      /* lines still to be drawn will be as soon as the CPU passes them */
+      if (false == nes.line_sync && nes.scanline <= NES_LAST_CATCHUP_LINE)
+      {
+         next_line = (int32)(nes_linecycle(nes.scanline) - cycle);
+         if (next_line <= 0)
+            return 0;
+      }
+
+      return ppu_statidle(cycle, next_line);
+   }
+
+   return 0;
+}
+
+/* start-of-scanline work: finish the previous line, draw this one */
+static void nes_startline(int scanline)
+{
+   mapintf_t *mapintf = nes.mmc->intf;
+
+   if (scanline > 0)
+      ppu_endscanline(scanline - 1);
+
 #ifdef NOFRENDO_DOUBLE_FRAMEBUFFER
-      ppu_scanline(nes.vidbuf, nes.scanline, draw_flag);
+   ppu_scanline(nes.vidbuf, scanline, nes_linecycle(scanline), nes.draw_flag);
 #else  /* !NOFRENDO_DOUBLE_FRAMEBUFFER */
-      ppu_scanline(vid_getbuffer(), nes.scanline, draw_flag);
+   ppu_scanline(vid_getbuffer(), scanline, nes_linecycle(scanline), nes.draw_flag);
 #endif /* !NOFRENDO_DOUBLE_FRAMEBUFFER */
 
-      if (241 == nes.scanline)
+#ifdef NOFRENDO_LINE_STREAM
+   if (nes.draw_flag && scanline < NES_SCREEN_HEIGHT)
+      vid_streamline(scanline);
+#endif /* NOFRENDO_LINE_STREAM */
+
+   /* line 241 gets its hblank after the NMI */
+   if (mapintf->hblank && 241 != scanline)
+      mapintf->hblank(scanline > 241);
+}
+
+/* Bring the PPU up to the CPU.  Unless the mapper counts scanlines,
+** the CPU runs straight through the visible frame, and the PPU
+** draws every line the CPU has already passed the moment anything
+** that could change the picture happens (a PPU register access,
+** OAM DMA, a CHR bank or mirroring switch), and at vblank.
+*/
+static void nes_catchupto(int32 now)
+{
+   nes.catching_up = true;
+   while (nes.scanline <= NES_LAST_CATCHUP_LINE && NES_LINE_CLOCK(nes.scanline) <= now)
+      nes_startline(nes.scanline++);
+   nes.catching_up = false;
+}
+
+void nes_catchup(void)
+{
+   if (nes.in_slice && false == nes.line_sync && false == nes.catching_up)
+      nes_catchupto(nes_now());
+}
+
+/* schedule the next per-scanline stop, 241 and 261 have their own */
+static void nes_nextline(void)
+{
+   if (nes.line_sync && nes.scanline < 262 && 241 != nes.scanline && 261 != nes.scanline)
+      nes_schedule(NES_EVENT_SCANLINE, NES_LINE_CLOCK(nes.scanline));
+}
+
+/* run the CPU until the timeline reaches <due> */
+static void nes_runcpu(int32 due)
+{
+   int32 clocks = due - nes_now();
+
+   if (clocks > 0)
+   {
+      nes.slice_due = due;
+      nes.in_slice = true;
+      nes6502_execute((clocks + NES_CLOCK_DIVIDER - 1) / NES_CLOCK_DIVIDER);
+      nes.in_slice = false;
+   }
+}
+
+void nes_renderframe(bool draw_flag)
+{
+   mapintf_t *mapintf = nes.mmc->intf;
+   const rect_t *window;
+   nes_event_t event;
+   int i;
+
+   nes.draw_flag = draw_flag;
+
+   /* no drawing what overscan cuts off */
+   window = vid_getwindow();
+   ppu_setvisible(window->y, window->y + window->h);
+
+   /* a frame normally starts at line 0, but reset starts at 241 */
+   if (262 == nes.scanline)
+      nes.scanline = 0;
+   if (nes.scanline <= 241)
+      nes_schedule(NES_EVENT_VBLANK, NES_LINE_CLOCK(241));
+   nes_schedule(NES_EVENT_PRERENDER, NES_LINE_CLOCK(261));
+   nes_schedule(NES_EVENT_ENDFRAME, NES_FRAME_CLOCKS);
+   nes_nextline();
+
+   for (;;)
+   {
+      event = nes.events[0];
+
+      /* the CPU may hand back early if it schedules something sooner */
+      nes_runcpu(event.due);
+      if (nes.events[0].type != event.type || nes_now() < event.due)
+         continue;
+
+      nes.num_events--;
+      memmove(&nes.events[0], &nes.events[1], nes.num_events * sizeof(nes_event_t));
+
+      switch (event.type)
       {
+      case NES_EVENT_SCANLINE:
+         nes_startline(nes.scanline++);
+         nes_nextline();
+         break;
+
+      case NES_EVENT_VBLANK:
+         nes_catchupto(event.due);
+         nes.scanline = 241;
+         nes_startline(nes.scanline++);
          /* 7-9 cycle delay between when VINT flag goes up and NMI is taken */
-         elapsed_cycles = nes6502_execute(7);
-         nes.scanline_cycles -= elapsed_cycles;
-         nes_checkfiq(elapsed_cycles);
+         nes_schedule(NES_EVENT_NMI, event.due + NES_NMI_DELAY);
+         break;
 
+      case NES_EVENT_NMI:
          ppu_checknmi();
 
          if (mapintf->vblank)
             mapintf->vblank();
-         in_vblank = 1;
-      }
 
-      if (mapintf->hblank)
-         mapintf->hblank(in_vblank);
+         if (mapintf->hblank)
+            mapintf->hblank(1);
 
-      nes.scanline_cycles += (float)NES_SCANLINE_CYCLES;
-      elapsed_cycles = nes6502_execute((int)nes.scanline_cycles);
-      nes.scanline_cycles -= (float)elapsed_cycles;
-      nes_checkfiq(elapsed_cycles);
+         nes_nextline();
+         break;
 
-      ppu_endscanline(nes.scanline);
-      nes.scanline++;
+      case NES_EVENT_PRERENDER:
+         nes.scanline = 261;
+         nes_startline(nes.scanline++);
+         break;
+
+      case NES_EVENT_FIQ:
+         nes_fiq(event.due);
+         break;
+
+      default:
+         break;
+      }
+
+      if (NES_EVENT_ENDFRAME == event.type)
+         break;
    }
 
-   nes.scanline = 0;
+   /* rebase the timeline onto the next frame, the CPU's position with
+   ** it: the cycle count keeps running, so cycles since cycle_base in
+   ** master clocks would overflow an int32 after ~6000 frames
+   */
+   nes.clock_base = nes_now() - NES_FRAME_CLOCKS;
+   nes.cycle_base = nes6502_getcycles(false);
+   for (i = 0; i < nes.num_events; i++)
+      nes.events[i].due -= NES_FRAME_CLOCKS;
+
+   nes.bank_switches = nes6502_getbankswitches(true);
+   nes.idle_cycles = nes6502_getidlecycles(true);
 }
 
 static void system_video(bool draw)
@@ -354,8 +566,15 @@ static void system_video(bool draw)
             0, 0, NES_SCREEN_WIDTH, NES_VISIBLE_HEIGHT);
 #endif /* NOFRENDO_DOUBLE_FRAMEBUFFER */
 
+#if defined(NOFRENDO_LINE_STREAM) || defined(NOFRENDO_RGB565)
+   /* the lines are on their way to the screen already, or resolved to
+   ** RGB565 as they were drawn: there's no frame left to put the GUI on
+   */
+   gui_frame(false);
+#else  /* !(NOFRENDO_LINE_STREAM || NOFRENDO_RGB565) */
    /* overlay our GUI on top of it */
    gui_frame(true);
+#endif /* !(NOFRENDO_LINE_STREAM || NOFRENDO_RGB565) */
 
    /* blit to screen */
    vid_flush();
@@ -373,8 +592,6 @@ void nes_emulate(void)
 
    last_ticks = nofrendo_ticks;
    frames_to_render = 0;
-   nes.scanline_cycles = 0;
-   nes.fiq_cycles = (int)NES_FIQ_PERIOD;
 
    while (false == nes.poweroff)
    {
@@ -423,7 +640,10 @@ void nes_reset(int reset_type)
    {
       memset(nes.cpu->mem_page[0], 0, NES_RAMSIZE);
       if (nes.rominfo->vram)
+      {
          mem_trash(nes.rominfo->vram, 0x2000 * nes.rominfo->vram_banks);
+         ppu_flushchr(nes.ppu);
+      }
    }
 
    apu_reset();
@@ -431,7 +651,12 @@ void nes_reset(int reset_type)
    mmc_reset();
    nes6502_reset();
 
+   /* restart the timeline at vblank */
    nes.scanline = 241;
+   nes.clock_base = NES_LINE_CLOCK(241);
+   nes.cycle_base = nes6502_getcycles(false);
+   nes.num_events = 0;
+   nes_setfiq(nes.fiq_state);
 
    gui_sendmsg(GUI_GREEN, "NES %s",
                (HARD_RESET == reset_type) ? "powered on" : "reset");
@@ -452,6 +677,7 @@ void nes_destroy(nes_t **machine)
 
       if ((*machine)->cpu)
       {
+         nes6502_freecode((*machine)->cpu);
          if ((*machine)->cpu->mem_page[0])
             NOFRENDO_FREE((*machine)->cpu->mem_page[0]);
          NOFRENDO_FREE((*machine)->cpu);
@@ -482,13 +708,6 @@ int nes_insertcart(const char *filename, nes_t *machine)
    if (NULL == machine->rominfo)
       goto _fail;
 
-   /* map cart's SRAM to CPU $6000-$7FFF */
-   if (machine->rominfo->sram)
-   {
-      machine->cpu->mem_page[6] = machine->rominfo->sram;
-      machine->cpu->mem_page[7] = machine->rominfo->sram + 0x1000;
-   }
-
    /* mapper */
    machine->mmc = mmc_create(machine->rominfo);
    if (NULL == machine->mmc)
@@ -502,7 +721,30 @@ int nes_insertcart(const char *filename, nes_t *machine)
 
    build_address_handlers(machine);
 
+   /* predecode code run from PRG-ROM (16kB banks) and SRAM (1kB
+   ** banks), if the CPU core has the cache built in
+   */
+   nes6502_addcode(machine->cpu, machine->rominfo->rom, machine->rominfo->rom_banks * 0x4000);
+   if (machine->rominfo->sram)
+      nes6502_addcode(machine->cpu, machine->rominfo->sram, machine->rominfo->sram_banks * 0x400);
+
+   /* cache decoded tiles from CHR-ROM (8kB banks) and CHR-RAM, if
+   ** the PPU has the cache built in
+   */
+   if (machine->rominfo->vrom)
+      ppu_addchr(machine->ppu, machine->rominfo->vrom, machine->rominfo->vrom_banks * 0x2000);
+   if (machine->rominfo->vram)
+      ppu_addchr(machine->ppu, machine->rominfo->vram, 0x2000);
+
+   /* start a fresh profile for this cart, if the CPU keeps one */
+   nes6502_profreset(machine->rominfo->rom, machine->rominfo->rom_banks * 0x4000);
+
    nes_setcontext(machine);
+   nes_setlinesync(nes.force_line_sync);
+
+   /* map cart's SRAM to CPU $6000-$7FFF */
+   if (machine->rominfo->sram)
+      nes6502_setpages(6, 2, machine->rominfo->sram);
 
    nes_reset(HARD_RESET);
    return 0;
@@ -553,6 +795,9 @@ nes_t *nes_create(void)
 
    machine->cpu->read_handler = machine->readhandler;
    machine->cpu->write_handler = machine->writehandler;
+   machine->cpu->read_page = machine->readpage;
+   machine->cpu->write_page = machine->writepage;
+   machine->cpu->idle_func = nes_idlecycles;
 
    /* apu */
    osd_getsoundinfo(&osd_sound);
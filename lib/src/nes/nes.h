@@ -45,6 +45,24 @@
 #endif /* !PAL */
 
 #define MAX_MEM_HANDLERS 32
+#define NES_MAX_EVENTS 8
+
+/* timeline events; ties fire in this order */
+enum
+{
+   NES_EVENT_SCANLINE,
+   NES_EVENT_VBLANK,
+   NES_EVENT_NMI,
+   NES_EVENT_PRERENDER,
+   NES_EVENT_FIQ,
+   NES_EVENT_ENDFRAME
+};
+
+typedef struct nes_event_s
+{
+   int32 due; /* master clocks since the start of the frame */
+   int type;
+} nes_event_t;
 
 enum
 {
@@ -58,6 +76,8 @@ typedef struct nes_s
    nes6502_context *cpu;
    nes6502_memread readhandler[MAX_MEM_HANDLERS];
    nes6502_memwrite writehandler[MAX_MEM_HANDLERS];
+   nes6502_readfunc readpage[NES6502_NUMPAGES];
+   nes6502_writefunc writepage[NES6502_NUMPAGES];
 
    ppu_t *ppu;
    apu_t *apu;
@@ -71,14 +91,32 @@ typedef struct nes_s
 
    bool fiq_occurred;
    uint8 fiq_state;
-   int fiq_cycles;
 
-   int scanline;
+   int scanline; /* next scanline the PPU has to start */
+
+   /* Timeline: pending events sorted by due time, and the CPU's
+   ** position in master clocks, which is clock_base at cycle_base
+   */
+   nes_event_t events[NES_MAX_EVENTS];
+   int num_events;
+   int32 clock_base;
+   uint32 cycle_base;
+   int32 slice_due;
+   bool in_slice;
+   bool line_sync; /* stop the CPU at every scanline */
+   bool force_line_sync;
+   bool catching_up;
+   bool draw_flag;
 
    /* Timing stuff */
-   float scanline_cycles;
    bool autoframeskip;
 
+   /* CPU bank switches during the last frame */
+   uint32 bank_switches;
+
+   /* CPU cycles skipped in idle loops during the last frame */
+   uint32 idle_cycles;
+
    /* control */
    bool poweroff;
    bool pause;
@@ -99,9 +137,12 @@ extern void nes_destroy(nes_t **machine);
 extern int nes_insertcart(const char *filename, nes_t *machine);
 
 extern void nes_setfiq(uint8 state);
+extern void nes_catchup(void);
+extern void nes_setlinesync(bool force);
 extern void nes_nmi(void);
 extern void nes_irq(void);
 extern void nes_emulate(void);
+extern void nes_renderframe(bool draw_flag);
 
 extern void nes_reset(int reset_type);
 
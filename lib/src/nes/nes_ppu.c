@@ -32,6 +32,7 @@
 #include "../gui.h"
 #include "../cpu/nes6502.h"
 #include "../log.h"
+#include "../osd.h"
 #include "nes_mmc.h"
 
 #include "../bitmap.h"
@@ -40,7 +41,8 @@
 #include "nesinput.h"
 
 /* PPU access */
-#define PPU_MEM(x) ppu.page[(x) >> 10][(x)]
+#define PPU_PAGEMEM(p, x) (p)->page[(x) >> 10][(x)]
+#define PPU_MEM(x) PPU_PAGEMEM(&ppu, x)
 
 /* Background (color 0) and solid sprite pixel flags */
 #define BG_TRANS 0x80
@@ -50,10 +52,72 @@
 #define SP_CLEAR(V) (0 == ((V)&SP_PIXEL))
 
 /* Full BG color */
-#define FULLBG (ppu.palette[0] | BG_TRANS)
+#define FULLBG(p) ((p)->palette[0] | BG_TRANS)
+
+#ifdef NOFRENDO_DEFERRED_RENDER
+#include <stdatomic.h>
+
+#define PPU_DEFER_LINES 256 /* a power of 2, and more than a frame */
+#define PPU_DEFER_COPIES 4 /* a power of 2 too */
+
+/* a visible line as the emulation thread left it */
+typedef struct ppu_line_s
+{
+   uint8 *vidbuf;
+   uint16 *rgbbuf; /* and its RGB565, if there's a plane for it */
+   const uint16 *rgb565;
+   uint32 vaddr, obj_base, bg_base;
+   uint8 tile_xofs, obj_height, scanline;
+   uint8 pal, oam, pages; /* serials of the copies it's drawn with */
+   bool bg_on, obj_on, obj_mask, bg_mask;
+   bool drawsprites;
+} ppu_line_t;
+
+/* copies of something the lines share, taken when its gen moves on */
+typedef struct ppu_copies_s
+{
+   uint32 gen;
+   uint8 serial; /* of the newest, in slot serial % PPU_DEFER_COPIES */
+   uint32 busy_until[PPU_DEFER_COPIES]; /* lines drawn when it's free */
+} ppu_copies_t;
+
+typedef struct ppu_defer_s
+{
+   bool enabled;
+   atomic_bool running, quit;
+
+   /* lines recorded and drawn so far, each written by one thread */
+   atomic_uint head, tail;
+   ppu_line_t line[PPU_DEFER_LINES];
+
+   ppu_copies_t pal_copies, oam_copies, page_copies;
+   uint8 pal[PPU_DEFER_COPIES][32];
+   uint8 oam[PPU_DEFER_COPIES][256];
+   struct
+   {
+      uint8 *page[12];
+      int32 chr_page[8];
+      int32 attrib_page[4];
+   } pages[PPU_DEFER_COPIES];
+
+   /* the render thread's own PPU, and serials of the copies in there */
+   ppu_t render;
+   int pal_used, oam_used, pages_used;
+} ppu_defer_t;
+#endif /* NOFRENDO_DEFERRED_RENDER */
 
 /* the NES PPU */
-static ppu_t ppu;
+static THREAD_LOCAL ppu_t ppu;
+
+static void ppu_pickrenderers(ppu_t *src_ppu);
+static void attrib_mappages(ppu_t *src_ppu);
+static void attrib_rebuild(ppu_t *src_ppu);
+#ifdef NOFRENDO_DEFERRED_RENDER
+static void defer_init(ppu_t *src_ppu);
+#endif /* NOFRENDO_DEFERRED_RENDER */
+static bool defer_running(ppu_t *src_ppu);
+static void defer_sync(ppu_t *src_ppu);
+static void defer_stop(ppu_t *src_ppu);
 
 void ppu_displaysprites(bool display)
 {
@@ -64,6 +128,9 @@ void ppu_setcontext(ppu_t *src_ppu)
 {
    int nametab[4];
    ASSERT(src_ppu);
+
+   /* the render thread may still be drawing from the old one */
+   defer_sync(&ppu);
    ppu = *src_ppu;
 
    /* we can't just copy contexts here, because more than likely,
@@ -87,6 +154,22 @@ void ppu_setcontext(ppu_t *src_ppu)
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
    ppu.page[15] = ppu.page[11] - 0x1000;
+
+   ppu_pickrenderers(&ppu);
+
+   /* new nametables, maybe */
+   attrib_mappages(&ppu);
+   attrib_rebuild(&ppu);
+
+#if PPU_BGCACHE_TABLES
+   if (ppu.bg_cache)
+      ppu.bg_cache->nametab = ppu.nametab;
+#endif /* PPU_BGCACHE_TABLES */
+
+   /* anything recorded since is from another PPU */
+   ppu.pal_gen++;
+   ppu.oam_gen++;
+   ppu.page_gen++;
 }
 
 void ppu_getcontext(ppu_t *dest_ppu)
@@ -121,8 +204,9 @@ void ppu_getcontext(ppu_t *dest_ppu)
 
 ppu_t *ppu_create(void)
 {
-   static bool pal_generated = false;
+   static THREAD_LOCAL bool pal_generated = false;
    ppu_t *temp;
+   int i;
 
    temp = NOFRENDO_MALLOC(sizeof(ppu_t));
    if (NULL == temp)
@@ -134,6 +218,49 @@ ppu_t *ppu_create(void)
    temp->vromswitch = NULL;
    temp->vram_present = false;
    temp->drawsprites = true;
+   temp->first_line = 0;
+   temp->end_line = NES_SCREEN_HEIGHT;
+   ppu_pickrenderers(temp);
+
+   for (i = 0; i < 8; i++)
+      temp->chr_page[i] = -1;
+
+   /* read on every tile, so fast memory */
+   temp->attrib_tiles = mem_alloc(4 * 960, true);
+   attrib_mappages(temp);
+   attrib_rebuild(temp);
+
+#if PPU_CHRCACHE_TILES
+   /* not NOFRENDO_MALLOC, which always wants fast memory */
+   temp->chr_cache = mem_alloc(PPU_CHRCACHE_TILES * 64, PPU_CHRCACHE_FAST);
+   temp->chr_tag = mem_alloc(PPU_CHRCACHE_TILES * sizeof(uint32), PPU_CHRCACHE_FAST);
+   if (NULL == temp->chr_cache || NULL == temp->chr_tag)
+   {
+      ppu_destroy(&temp);
+      return NULL;
+   }
+
+   ppu_flushchr(temp);
+#endif /* PPU_CHRCACHE_TILES */
+
+#if PPU_BGCACHE_TABLES
+   /* big, so PSRAM if there's some, and we can do without it */
+   temp->bg_cache = mem_alloc(sizeof(ppu_bgcache_t), false);
+   if (temp->bg_cache)
+   {
+      memset(temp->bg_cache->line, 0, sizeof(temp->bg_cache->line));
+      temp->bg_cache->gen = 1;
+      temp->bg_cache->hits = temp->bg_cache->lookups = 0;
+      temp->bg_cache->nametab = temp->nametab;
+   }
+#endif /* PPU_BGCACHE_TABLES */
+
+#ifdef NOFRENDO_DEFERRED_RENDER
+   /* on by default, the render thread starts with the first line */
+   temp->defer = mem_alloc(sizeof(ppu_defer_t), true);
+   if (temp->defer)
+      defer_init(temp);
+#endif /* NOFRENDO_DEFERRED_RENDER */
 
    /* TODO: probably a better way to do this... */
    if (false == pal_generated)
@@ -151,13 +278,203 @@ void ppu_destroy(ppu_t **src_ppu)
 {
    if (*src_ppu)
    {
+      if ((*src_ppu)->defer)
+      {
+         defer_stop(*src_ppu);
+         free((*src_ppu)->defer);
+      }
+      if ((*src_ppu)->chr_cache)
+         free((*src_ppu)->chr_cache);
+      if ((*src_ppu)->chr_tag)
+         free((*src_ppu)->chr_tag);
+      if ((*src_ppu)->bg_cache)
+         free((*src_ppu)->bg_cache);
+      if ((*src_ppu)->attrib_tiles)
+         free((*src_ppu)->attrib_tiles);
+
       NOFRENDO_FREE(*src_ppu);
       *src_ppu = NULL;
    }
 }
 
+#if PPU_CHRCACHE_TILES
+/* find the cache tile number pattern page <page> starts at, if it
+** maps CHR memory the cache knows about
+*/
+static void chr_mappage(ppu_t *src_ppu, int page)
+{
+   uint8 *location = src_ppu->page[page];
+   int i;
+
+   src_ppu->chr_page[page] = -1;
+   if (NULL == location)
+      return;
+
+   location += page << 10;
+
+   for (i = 0; i < PPU_MAX_CHR; i++)
+   {
+      ppu_chr_t *chr = &src_ppu->chr[i];
+
+      if (chr->base && location >= chr->base &&
+          location + 0x400 <= chr->base + chr->size &&
+          0 == ((location - chr->base) & 0x0F))
+      {
+         src_ppu->chr_page[page] = chr->first_tile + ((location - chr->base) >> 4);
+         return;
+      }
+   }
+}
+#endif /* PPU_CHRCACHE_TILES */
+
+/* which of the tables in nametab each nametable page maps, if any */
+static void attrib_mappages(ppu_t *src_ppu)
+{
+   uint8 *location;
+   int i;
+
+   for (i = 0; i < 4; i++)
+   {
+      location = src_ppu->page[8 + i];
+      src_ppu->attrib_page[i] = -1;
+      if (NULL == src_ppu->attrib_tiles || NULL == location)
+         continue;
+
+      location += 0x2000 + (i << 10);
+      if (location >= src_ppu->nametab && location < src_ppu->nametab + 0x1000 &&
+          0 == ((location - src_ppu->nametab) & 0x3FF))
+         src_ppu->attrib_page[i] = (location - src_ppu->nametab) >> 10;
+   }
+}
+
+/* spread attribute byte <offset> (0-63) of table <table> over the 4x4
+** tiles it colors, or the 4x2 of the bottom row
+*/
+static void attrib_expand(ppu_t *src_ppu, int table, int offset)
+{
+   uint8 attrib = src_ppu->nametab[(table << 10) + 0x3C0 + offset];
+   uint8 *tiles = src_ppu->attrib_tiles + table * 960;
+   int first_x = (offset & 7) << 2;
+   int first_y = (offset >> 3) << 2;
+   int x_tile, y_tile;
+
+   for (y_tile = first_y; y_tile < first_y + 4 && y_tile < 30; y_tile++)
+   {
+      for (x_tile = first_x; x_tile < first_x + 4; x_tile++)
+         tiles[(y_tile << 5) + x_tile] = ((attrib >> (((y_tile & 2) << 1) + (x_tile & 2))) & 3) << 2;
+   }
+}
+
+/* all of it again, after nametab was changed behind the PPU's back */
+static void attrib_rebuild(ppu_t *src_ppu)
+{
+   int table, offset;
+
+   if (NULL == src_ppu->attrib_tiles)
+      return;
+
+   for (table = 0; table < 4; table++)
+   {
+      for (offset = 0; offset < 64; offset++)
+         attrib_expand(src_ppu, table, offset);
+   }
+}
+
+/* cache decoded tiles from <size> bytes of CHR-ROM or CHR-RAM at
+** <base>, returns -1 if the cache isn't built in or no slot is free
+*/
+int ppu_addchr(ppu_t *src_ppu, uint8 *base, uint32 size)
+{
+#if PPU_CHRCACHE_TILES
+   int32 first_tile = 0;
+   int i, page;
+
+   ASSERT(src_ppu && base);
+
+   for (i = 0; i < PPU_MAX_CHR; i++)
+   {
+      if (NULL == src_ppu->chr[i].base)
+      {
+         src_ppu->chr[i].base = base;
+         src_ppu->chr[i].size = size;
+         src_ppu->chr[i].first_tile = first_tile;
+
+         for (page = 0; page < 8; page++)
+            chr_mappage(src_ppu, page);
+         src_ppu->page_gen++;
+
+         return 0;
+      }
+
+      first_tile += src_ppu->chr[i].size >> 4;
+   }
+#else  /* !PPU_CHRCACHE_TILES */
+   UNUSED(src_ppu);
+   UNUSED(base);
+   UNUSED(size);
+#endif /* !PPU_CHRCACHE_TILES */
+
+   return -1;
+}
+
+/* something every cached background line depends on has changed */
+static void bg_flush(ppu_t *src_ppu)
+{
+#if PPU_BGCACHE_TABLES
+   /* 0 marks stale lines */
+   if (src_ppu->bg_cache && 0 == ++src_ppu->bg_cache->gen)
+      src_ppu->bg_cache->gen = 1;
+#else  /* !PPU_BGCACHE_TABLES */
+   UNUSED(src_ppu);
+#endif /* !PPU_BGCACHE_TABLES */
+}
+
+/* forget everything decoded or drawn, after CHR-RAM or nametables
+** were changed behind the PPU's back (e.g. a state load)
+*/
+void ppu_flushchr(ppu_t *src_ppu)
+{
+   defer_sync(src_ppu);
+
+   if (src_ppu->chr_tag)
+      memset(src_ppu->chr_tag, 0xFF, PPU_CHRCACHE_TILES * sizeof(uint32));
+
+   /* a state load sets the nametable pages itself */
+   attrib_mappages(src_ppu);
+   attrib_rebuild(src_ppu);
+
+   bg_flush(src_ppu);
+}
+
+/* percentage of background lines copied out of the cache since the
+** last reset, -1 if it isn't built in or nothing was drawn
+*/
+int ppu_getbgcachehits(bool reset_flag)
+{
+   int percent = -1;
+
+#if PPU_BGCACHE_TABLES
+   if (ppu.bg_cache)
+   {
+      if (ppu.bg_cache->lookups)
+         percent = (int)(ppu.bg_cache->hits * 100.0 / ppu.bg_cache->lookups);
+
+      if (reset_flag)
+         ppu.bg_cache->hits = ppu.bg_cache->lookups = 0;
+   }
+#else  /* !PPU_BGCACHE_TABLES */
+   UNUSED(reset_flag);
+#endif /* !PPU_BGCACHE_TABLES */
+
+   return percent;
+}
+
 void ppu_setpage(int size, int page_num, uint8 *location)
 {
+   int first_page = page_num;
+
+   nes_catchup();
+
    /* deliberately fall through */
    switch (size)
    {
@@ -175,11 +492,24 @@ void ppu_setpage(int size, int page_num, uint8 *location)
       ppu.page[page_num++] = location;
       break;
    }
+
+   ppu.page_gen++;
+
+   if (page_num > 8 && first_page < 12)
+      attrib_mappages(&ppu);
+
+#if PPU_CHRCACHE_TILES
+   for (; first_page < page_num && first_page < 8; first_page++)
+      chr_mappage(&ppu, first_page);
+#endif /* PPU_CHRCACHE_TILES */
 }
 
 /* make sure $3000-$3F00 mirrors $2000-$2F00 */
 void ppu_mirrorhipages(void)
 {
+   nes_catchup();
+
+   ppu.page_gen++;
    ppu.page[12] = ppu.page[8] - 0x1000;
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
@@ -188,6 +518,9 @@ void ppu_mirrorhipages(void)
 
 void ppu_mirror(int nt1, int nt2, int nt3, int nt4)
 {
+   nes_catchup();
+
+   ppu.page_gen++;
    ppu.page[8] = ppu.nametab + (nt1 << 10) - 0x2000;
    ppu.page[9] = ppu.nametab + (nt2 << 10) - 0x2400;
    ppu.page[10] = ppu.nametab + (nt3 << 10) - 0x2800;
@@ -196,6 +529,8 @@ void ppu_mirror(int nt1, int nt2, int nt3, int nt4)
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
    ppu.page[15] = ppu.page[11] - 0x1000;
+
+   attrib_mappages(&ppu);
 }
 
 /* bleh, for snss */
@@ -204,6 +539,159 @@ uint8 *ppu_getpage(int page)
    return ppu.page[page];
 }
 
+/* decode <rows> rows of a tile's bitplanes to one pixel a byte */
+static void chr_decode(uint8 *pixels, const uint8 *data, int rows)
+{
+   while (rows--)
+   {
+      uint8 pat1 = data[0];
+      uint8 pat2 = data[8];
+
+      pixels[0] = ((pat1 >> 7) & 1) | ((pat2 >> 6) & 2);
+      pixels[1] = ((pat1 >> 6) & 1) | ((pat2 >> 5) & 2);
+      pixels[2] = ((pat1 >> 5) & 1) | ((pat2 >> 4) & 2);
+      pixels[3] = ((pat1 >> 4) & 1) | ((pat2 >> 3) & 2);
+      pixels[4] = ((pat1 >> 3) & 1) | ((pat2 >> 2) & 2);
+      pixels[5] = ((pat1 >> 2) & 1) | ((pat2 >> 1) & 2);
+      pixels[6] = ((pat1 >> 1) & 1) | (pat2 & 2);
+      pixels[7] = (pat1 & 1) | ((pat2 << 1) & 2);
+
+      pixels += 8;
+      data++;
+   }
+}
+
+/* the pixels (0-3, left to right) of the tile row at pattern address
+** <addr>: out of the cache if the page is CHR memory it knows, else
+** decoded into <scratch>.  Word aligned either way.
+*/
+INLINE const uint8 *chr_getrow(ppu_t *src_ppu, uint32 addr, uint32 *scratch)
+{
+#if PPU_CHRCACHE_TILES
+   int32 tile = src_ppu->chr_page[addr >> 10];
+
+   if (tile >= 0)
+   {
+      uint8 *pixels;
+      uint32 slot;
+
+      tile += (addr & 0x3F0) >> 4;
+      slot = tile & (PPU_CHRCACHE_TILES - 1);
+      pixels = src_ppu->chr_cache + (slot << 6);
+
+      /* miss: decode the whole tile, the other rows are coming */
+      if (src_ppu->chr_tag[slot] != (uint32)tile)
+      {
+         chr_decode(pixels, &PPU_PAGEMEM(src_ppu, addr & ~0x0F), 8);
+         src_ppu->chr_tag[slot] = tile;
+      }
+
+      return pixels + ((addr & 7) << 3);
+   }
+#endif /* PPU_CHRCACHE_TILES */
+
+   chr_decode((uint8 *)scratch, &PPU_PAGEMEM(src_ppu, addr), 1);
+   return (uint8 *)scratch;
+}
+
+/* the PPU wrote to <addr>, drop the tile if it's CHR we've decoded */
+INLINE void chr_invalidate(uint32 addr)
+{
+#if PPU_CHRCACHE_TILES
+   if (addr < 0x2000 && ppu.chr_page[addr >> 10] >= 0)
+   {
+      uint32 tile = ppu.chr_page[addr >> 10] + ((addr & 0x3F0) >> 4);
+      uint32 slot = tile & (PPU_CHRCACHE_TILES - 1);
+
+      if (ppu.chr_tag[slot] == tile)
+         ppu.chr_tag[slot] = (uint32)-1;
+   }
+#else  /* !PPU_CHRCACHE_TILES */
+   UNUSED(addr);
+#endif /* !PPU_CHRCACHE_TILES */
+}
+
+/* the PPU wrote to <addr>, drop the background lines drawn from it */
+INLINE void bg_invalidate(uint32 addr)
+{
+#if PPU_BGCACHE_TABLES
+   uint8 *data;
+   int offset, slot, line, last_line;
+
+   if (NULL == ppu.bg_cache)
+      return;
+
+   /* pattern data, could be on any line */
+   if (addr < 0x2000)
+   {
+      bg_flush(&ppu);
+      return;
+   }
+
+   data = &PPU_MEM(addr);
+   if (data < ppu.nametab || data >= ppu.nametab + PPU_BGCACHE_TABLES * 0x400)
+      return;
+
+   offset = data - ppu.nametab;
+   slot = (offset >> 10) * 240;
+   offset &= 0x3FF;
+
+   /* a tile row, or the attribute row over four of them */
+   if (offset < 0x3C0)
+   {
+      line = (offset >> 5) << 3;
+      last_line = line + 8;
+   }
+   else
+   {
+      line = ((offset - 0x3C0) >> 3) << 5;
+      last_line = line + 32;
+      if (last_line > 240)
+         last_line = 240;
+   }
+
+   for (; line < last_line; line++)
+      ppu.bg_cache->line[slot + line].gen = 0;
+#else  /* !PPU_BGCACHE_TABLES */
+   UNUSED(addr);
+#endif /* !PPU_BGCACHE_TABLES */
+}
+
+/* the PPU wrote to <addr>, re-expand it if it's an attribute byte */
+INLINE void attrib_update(uint32 addr)
+{
+   uint8 *data;
+   int offset;
+
+   if (addr < 0x2000 || NULL == ppu.attrib_tiles)
+      return;
+
+   data = &PPU_MEM(addr);
+   if (data < ppu.nametab || data >= ppu.nametab + 0x1000)
+      return;
+
+   offset = data - ppu.nametab;
+   if ((offset & 0x3FF) >= 0x3C0)
+      attrib_expand(&ppu, offset >> 10, (offset & 0x3FF) - 0x3C0);
+}
+
+/* store a byte below $3F00, and drop whatever the caches made of the
+** old one
+*/
+static void ppu_storebyte(uint32 addr, uint8 value)
+{
+   if (PPU_MEM(addr) == value)
+      return;
+
+   /* not under the render thread's feet */
+   defer_sync(&ppu);
+
+   PPU_MEM(addr) = value;
+   chr_invalidate(addr);
+   bg_invalidate(addr);
+   attrib_update(addr);
+}
+
 static void mem_trash(uint8 *buffer, int length)
 {
    int i;
@@ -217,6 +705,8 @@ void ppu_reset(int reset_type)
 {
    if (HARD_RESET == reset_type)
       mem_trash(ppu.oam, 256);
+   ppu.oam_dirty = true;
+   ppu.oam_gen++;
 
    ppu.ctrl0 = 0;
    ppu.ctrl1 = PPU_CTRL1F_OBJON | PPU_CTRL1F_BGON;
@@ -230,9 +720,9 @@ void ppu_reset(int reset_type)
    ppu.vram_accessible = true;
 }
 
-/* we render a scanline of graphics first so we know exactly
-** where the sprite 0 strike is going to occur (in terms of
-** cpu cycles), using the relation that 3 pixels == 1 cpu cycle
+/* we work out each scanline's sprite 0 strike as it starts (see
+** ppu_strikeline) so we know exactly where it is going to occur (in
+** terms of cpu cycles), using the relation that 3 pixels == 1 cpu cycle
 */
 static void ppu_setstrike(int x_loc)
 {
@@ -241,7 +731,7 @@ static void ppu_setstrike(int x_loc)
       ppu.strikeflag = true;
 
       /* 3 pixels per cpu cycle */
-      ppu.strike_cycle = nes6502_getcycles(false) + (x_loc / 3);
+      ppu.strike_cycle = ppu.line_cycle + (x_loc / 3);
    }
 }
 
@@ -249,32 +739,61 @@ static void ppu_oamdma(uint8 value)
 {
    uint32 cpu_address;
    uint8 oam_loc;
+   uint8 *src;
+   int split;
 
    cpu_address = (uint32)(value << 8);
+   ppu.oam_dirty = true;
+   ppu.oam_gen++;
 
-   /* Sprite DMA starts at the current SPRRAM address */
-   oam_loc = ppu.oam_addr;
-   do
+   /* plain RAM/ROM gets block copied, I/O pages a byte at a time */
+   src = nes6502_getpage(cpu_address);
+   if (src)
    {
-      ppu.oam[oam_loc++] = nes6502_getbyte(cpu_address++);
-   } while (oam_loc != ppu.oam_addr);
-
-   /* TODO: enough with houdini */
-   cpu_address -= 256;
-   /* Odd address in $2003 */
-   if ((ppu.oam_addr >> 2) & 1)
-   {
-      for (oam_loc = 4; oam_loc < 8; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
-      cpu_address += 248;
-      for (oam_loc = 0; oam_loc < 4; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      /* Sprite DMA starts at the current SPRRAM address */
+      split = 256 - ppu.oam_addr;
+      memcpy(ppu.oam + ppu.oam_addr, src, split);
+      memcpy(ppu.oam, src + split, ppu.oam_addr);
+
+      /* TODO: enough with houdini */
+      /* Odd address in $2003 */
+      if ((ppu.oam_addr >> 2) & 1)
+      {
+         memcpy(ppu.oam + 4, src, 4);
+         memcpy(ppu.oam, src + 252, 4);
+      }
+      /* Even address in $2003 */
+      else
+      {
+         memcpy(ppu.oam, src, 8);
+      }
    }
-   /* Even address in $2003 */
    else
    {
-      for (oam_loc = 0; oam_loc < 8; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      /* Sprite DMA starts at the current SPRRAM address */
+      oam_loc = ppu.oam_addr;
+      do
+      {
+         ppu.oam[oam_loc++] = nes6502_getbyte(cpu_address++);
+      } while (oam_loc != ppu.oam_addr);
+
+      /* TODO: enough with houdini */
+      cpu_address -= 256;
+      /* Odd address in $2003 */
+      if ((ppu.oam_addr >> 2) & 1)
+      {
+         for (oam_loc = 4; oam_loc < 8; oam_loc++)
+            ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+         cpu_address += 248;
+         for (oam_loc = 0; oam_loc < 4; oam_loc++)
+            ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      }
+      /* Even address in $2003 */
+      else
+      {
+         for (oam_loc = 0; oam_loc < 8; oam_loc++)
+            ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      }
    }
 
    /* make the CPU spin for DMA cycles */
@@ -288,13 +807,17 @@ void ppu_writehigh(uint32 address, uint8 value)
    switch (address)
    {
    case PPU_OAMDMA:
+      nes_catchup();
       ppu_oamdma(value);
       break;
 
    case PPU_JOY0:
       /* VS system VROM switching - bleh!*/
       if (ppu.vromswitch)
+      {
+         nes_catchup();
          ppu.vromswitch(value);
+      }
 
       /* see if we need to strobe them joypads */
       value &= 1;
@@ -326,6 +849,9 @@ uint8 ppu_readhigh(uint32 address)
       break;
 
    case PPU_JOY1:
+      /* zapper looks at what's been drawn */
+      nes_catchup();
+
       /* TODO: better input handling */
       value = input_get(INP_ZAPPER | INP_JOYPAD1
                         /*| INP_ARKANOID*/
@@ -345,6 +871,8 @@ uint8 ppu_read(uint32 address)
 {
    uint8 value;
 
+   nes_catchup();
+
    /* handle mirrored reads up to $3FFF */
    switch (address & 0x2007)
    {
@@ -357,6 +885,8 @@ uint8 ppu_read(uint32 address)
             value |= PPU_STATF_STRIKE;
       }
 
+      ppu.stat_read = value;
+
       /* clear both vblank flag and vram address flipflop */
       ppu.stat &= ~PPU_STATF_VBLANK;
       ppu.flipflop = 0;
@@ -404,6 +934,8 @@ uint8 ppu_read(uint32 address)
 /* Write to $2000-$2007 */
 void ppu_write(uint32 address, uint8 value)
 {
+   nes_catchup();
+
    /* write goes into ppu latch... */
    ppu.latch = value;
 
@@ -412,7 +944,16 @@ void ppu_write(uint32 address, uint8 value)
    case PPU_CTRL0:
       ppu.ctrl0 = value;
 
-      ppu.obj_height = (value & PPU_CTRL0F_OBJ16) ? 16 : 8;
+      /* taller or shorter sprites are on other lines, and drawn by
+      ** other renderers
+      */
+      if (ppu.obj_height != ((value & PPU_CTRL0F_OBJ16) ? 16 : 8))
+      {
+         ppu.obj_height = (value & PPU_CTRL0F_OBJ16) ? 16 : 8;
+         ppu.oam_dirty = true;
+         ppu_pickrenderers(&ppu);
+      }
+
       ppu.bg_base = (value & PPU_CTRL0F_BGADDR) ? 0x1000 : 0;
       ppu.obj_base = (value & PPU_CTRL0F_OBJADDR) ? 0x1000 : 0;
       ppu.vaddr_inc = (value & PPU_CTRL0F_ADDRINC) ? 32 : 1;
@@ -438,6 +979,8 @@ void ppu_write(uint32 address, uint8 value)
 
    case PPU_OAMDATA:
       ppu.oam[ppu.oam_addr++] = value;
+      ppu.oam_dirty = true;
+      ppu.oam_gen++;
       break;
 
    case PPU_SCROLL:
@@ -487,7 +1030,7 @@ void ppu_write(uint32 address, uint8 value)
          {
             nofrendo_log_printf("VRAM write to $%04X, scanline %d\n",
                                 ppu.vaddr, nes_getcontextptr()->scanline);
-            PPU_MEM(ppu.vaddr) = 0xFF; /* corrupt */
+            ppu_storebyte(ppu.vaddr, 0xFF); /* corrupt */
          }
          else
          {
@@ -496,20 +1039,31 @@ void ppu_write(uint32 address, uint8 value)
             if (false == ppu.vram_present && addr >= 0x3000)
                ppu.vaddr -= 0x1000;
 
-            PPU_MEM(addr) = value;
+            ppu_storebyte(addr, value);
          }
       }
       else
       {
+         /* the render thread flushes for the lines it draws itself */
+         bool flush = (false == defer_running(&ppu));
+
+         ppu.pal_gen++;
+
          if (0 == (ppu.vaddr & 0x0F))
          {
             int i;
 
+            if (flush && ppu.palette[0] != ((value & 0x3F) | BG_TRANS))
+               bg_flush(&ppu);
+
             for (i = 0; i < 8; i++)
                ppu.palette[i << 2] = (value & 0x3F) | BG_TRANS;
          }
          else if (ppu.vaddr & 3)
          {
+            if (flush && 0 == (ppu.vaddr & 0x10) && ppu.palette[ppu.vaddr & 0x1F] != (value & 0x3F))
+               bg_flush(&ppu);
+
             ppu.palette[ppu.vaddr & 0x1F] = value & 0x3F;
          }
       }
@@ -565,6 +1119,7 @@ void ppu_setdefaultpal(ppu_t *src_ppu)
 void ppu_setlatchfunc(ppulatchfunc_t func)
 {
    ppu.latchfunc = func;
+   ppu_pickrenderers(&ppu);
 }
 
 void ppu_setvromswitch(ppuvromswitch_t func)
@@ -573,75 +1128,40 @@ void ppu_setvromswitch(ppuvromswitch_t func)
 }
 
 /* rendering routines */
-INLINE void draw_bgtile(uint8 *surface, uint8 pat1, uint8 pat2,
+INLINE void draw_bgtile(uint8 *surface, const uint8 *pixels,
                         const uint8 *colors)
 {
-   uint32 pattern = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1) | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
-
-   *surface++ = colors[(pattern >> 14) & 3];
-   *surface++ = colors[(pattern >> 6) & 3];
-   *surface++ = colors[(pattern >> 12) & 3];
-   *surface++ = colors[(pattern >> 4) & 3];
-   *surface++ = colors[(pattern >> 10) & 3];
-   *surface++ = colors[(pattern >> 2) & 3];
-   *surface++ = colors[(pattern >> 8) & 3];
-   *surface = colors[pattern & 3];
+   surface[0] = colors[pixels[0]];
+   surface[1] = colors[pixels[1]];
+   surface[2] = colors[pixels[2]];
+   surface[3] = colors[pixels[3]];
+   surface[4] = colors[pixels[4]];
+   surface[5] = colors[pixels[5]];
+   surface[6] = colors[pixels[6]];
+   surface[7] = colors[pixels[7]];
 }
 
-INLINE int draw_oamtile(uint8 *surface, uint8 attrib, uint8 pat1,
-                        uint8 pat2, const uint8 *col_tbl, bool check_strike)
+INLINE void draw_oamtile(uint8 *surface, uint8 attrib, const uint8 *pixels,
+                         const uint8 *col_tbl)
 {
-   int strike_pixel = -1;
-   uint32 color = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1) | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
-
    /* sprite is not 100% transparent */
-   if (color)
+   if (((const uint32 *)pixels)[0] | ((const uint32 *)pixels)[1])
    {
-      uint8 colors[8];
+      const uint8 *colors = pixels;
+      uint8 flipped[8];
 
       /* swap pixels around if our tile is flipped */
-      if (0 == (attrib & OAMF_HFLIP))
+      if (attrib & OAMF_HFLIP)
       {
-         colors[0] = (color >> 14) & 3;
-         colors[1] = (color >> 6) & 3;
-         colors[2] = (color >> 12) & 3;
-         colors[3] = (color >> 4) & 3;
-         colors[4] = (color >> 10) & 3;
-         colors[5] = (color >> 2) & 3;
-         colors[6] = (color >> 8) & 3;
-         colors[7] = color & 3;
-      }
-      else
-      {
-         colors[7] = (color >> 14) & 3;
-         colors[6] = (color >> 6) & 3;
-         colors[5] = (color >> 12) & 3;
-         colors[4] = (color >> 4) & 3;
-         colors[3] = (color >> 10) & 3;
-         colors[2] = (color >> 2) & 3;
-         colors[1] = (color >> 8) & 3;
-         colors[0] = color & 3;
-      }
-
-      /* check for solid sprite pixel overlapping solid bg pixel */
-      if (check_strike)
-      {
-         if (colors[0] && BG_SOLID(surface[0]))
-            strike_pixel = 0;
-         else if (colors[1] && BG_SOLID(surface[1]))
-            strike_pixel = 1;
-         else if (colors[2] && BG_SOLID(surface[2]))
-            strike_pixel = 2;
-         else if (colors[3] && BG_SOLID(surface[3]))
-            strike_pixel = 3;
-         else if (colors[4] && BG_SOLID(surface[4]))
-            strike_pixel = 4;
-         else if (colors[5] && BG_SOLID(surface[5]))
-            strike_pixel = 5;
-         else if (colors[6] && BG_SOLID(surface[6]))
-            strike_pixel = 6;
-         else if (colors[7] && BG_SOLID(surface[7]))
-            strike_pixel = 7;
+         flipped[0] = pixels[7];
+         flipped[1] = pixels[6];
+         flipped[2] = pixels[5];
+         flipped[3] = pixels[4];
+         flipped[4] = pixels[3];
+         flipped[5] = pixels[2];
+         flipped[6] = pixels[1];
+         flipped[7] = pixels[0];
+         colors = flipped;
       }
 
       /* draw the character */
@@ -684,91 +1204,221 @@ INLINE int draw_oamtile(uint8 *surface, uint8 attrib, uint8 pat1,
             surface[7] = SP_PIXEL | col_tbl[colors[7]];
       }
    }
-
-   return strike_pixel;
 }
 
-static void ppu_renderbg(uint8 *vidbuf)
+/* blank left hand column if need be */
+INLINE void bg_maskleft(ppu_t *src_ppu, uint8 *vidbuf)
 {
-   uint8 *bmp_ptr, *data_ptr, *tile_ptr, *attrib_ptr;
-   uint32 refresh_vaddr, bg_offset, attrib_base;
-   int tile_count;
-   uint8 tile_index, x_tile, y_tile;
-   uint8 col_high, attrib, attrib_shift;
-
-   /* draw a line of transparent background color if bg is disabled */
-   if (false == ppu.bg_on)
+   if (src_ppu->bg_mask)
    {
-      memset(vidbuf, FULLBG, NES_SCREEN_WIDTH);
-      return;
+      uint32 *buf_ptr = (uint32 *)vidbuf;
+      uint32 bg_clear = FULLBG(src_ppu) | FULLBG(src_ppu) << 8 | FULLBG(src_ppu) << 16 | FULLBG(src_ppu) << 24;
+
+      ((uint32 *)buf_ptr)[0] = bg_clear;
+      ((uint32 *)buf_ptr)[1] = bg_clear;
    }
+}
 
-   bmp_ptr = vidbuf - ppu.tile_xofs;              /* scroll x */
-   refresh_vaddr = 0x2000 + (ppu.vaddr & 0x0FE0); /* mask out x tile */
-   x_tile = ppu.vaddr & 0x1F;
-   y_tile = (ppu.vaddr >> 5) & 0x1F;                  /* to simplify calculations */
-   bg_offset = ((ppu.vaddr >> 12) & 7) + ppu.bg_base; /* offset in y tile */
-
-   /* calculate initial values */
-   tile_ptr = &PPU_MEM(refresh_vaddr + x_tile); /* pointer to tile index */
-   attrib_base = (refresh_vaddr & 0x2C00) + 0x3C0 + ((y_tile & 0x1C) << 1);
-   attrib_ptr = &PPU_MEM(attrib_base + (x_tile >> 2));
-   attrib = *attrib_ptr++;
-   attrib_shift = (x_tile & 2) + ((y_tile & 2) << 1);
-   col_high = ((attrib >> attrib_shift) & 3) << 2;
-
-   /* ppu fetches 33 tiles */
-   tile_count = 33;
-   while (tile_count--)
-   {
-      /* Tile number from nametable */
-      tile_index = *tile_ptr++;
-      data_ptr = &PPU_MEM(bg_offset + (tile_index << 4));
+/* the palette (col_high) of each tile on tile row <y_tile> of the
+** nametable at <nt_addr>: out of the expanded attribute tables, or
+** worked out into <scratch> for a page that isn't nametable RAM and
+** for rows 30 and 31, which take theirs from the last attribute row
+*/
+INLINE const uint8 *attrib_getrow(ppu_t *src_ppu, uint32 nt_addr, int y_tile, uint8 *scratch)
+{
+   int32 table = src_ppu->attrib_page[(nt_addr >> 10) & 3];
+   const uint8 *attrib_ptr;
+   int x_tile, attrib_shift;
 
-      /* Handle $FD/$FE tile VROM switching (PunchOut) */
-      if (ppu.latchfunc)
-         ppu.latchfunc(ppu.bg_base, tile_index);
+   if (table >= 0 && y_tile < 30)
+      return src_ppu->attrib_tiles + table * 960 + (y_tile << 5);
 
-      draw_bgtile(bmp_ptr, data_ptr[0], data_ptr[8], ppu.palette + col_high);
-      bmp_ptr += 8;
+   attrib_ptr = &PPU_PAGEMEM(src_ppu, (nt_addr & 0x2C00) + 0x3C0 + ((y_tile & 0x1C) << 1));
+   attrib_shift = (y_tile & 2) << 1;
+   for (x_tile = 0; x_tile < 32; x_tile++)
+      scratch[x_tile] = ((attrib_ptr[x_tile >> 2] >> (attrib_shift + (x_tile & 2))) & 3) << 2;
 
-      x_tile++;
+   return scratch;
+}
 
-      if (0 == (x_tile & 1)) /* check every 2 tiles */
-      {
-         if (0 == (x_tile & 3)) /* check every 4 tiles */
-         {
-            if (32 == x_tile) /* check every 32 tiles */
-            {
-               x_tile = 0;
-               refresh_vaddr ^= (1 << 10); /* switch nametable */
-               attrib_base ^= (1 << 10);
-
-               /* recalculate pointers */
-               tile_ptr = &PPU_MEM(refresh_vaddr);
-               attrib_ptr = &PPU_MEM(attrib_base);
-            }
-
-            /* Get the attribute byte */
-            attrib = *attrib_ptr++;
-         }
+#if PPU_BGCACHE_TABLES
+/* draw all 32 tiles of one line of the nametable at <nt_addr> */
+static void bg_drawline(ppu_t *src_ppu, uint8 *pixels, uint32 nt_addr, int line)
+{
+   const uint8 *tile_ptr, *attrib_row;
+   uint32 bg_offset, scratch[2];
+   uint8 attrib_scratch[32];
+   int x_tile;
 
-         attrib_shift ^= 2;
-         col_high = ((attrib >> attrib_shift) & 3) << 2;
-      }
+   tile_ptr = &PPU_PAGEMEM(src_ppu, nt_addr) + ((line >> 3) << 5);
+   attrib_row = attrib_getrow(src_ppu, nt_addr, line >> 3, attrib_scratch);
+   bg_offset = src_ppu->bg_base + (line & 7);
+
+   for (x_tile = 0; x_tile < 32; x_tile++)
+   {
+      draw_bgtile(pixels + (x_tile << 3),
+                  chr_getrow(src_ppu, bg_offset + (tile_ptr[x_tile] << 4), scratch),
+                  src_ppu->palette + attrib_row[x_tile]);
    }
+}
+
+/* line <line> (0-239) of the nametable at <nt_addr>, drawn now unless
+** it's cached already -- NULL if the page there isn't nametable RAM
+** the cache covers
+*/
+static const uint8 *bg_getline(ppu_t *src_ppu, uint32 nt_addr, int line)
+{
+   ppu_bgcache_t *bg_cache = src_ppu->bg_cache;
+   ppu_bgline_t *tag;
+   uint8 *nametab, *page[4];
+   int offset, slot, i;
+
+   nametab = &PPU_PAGEMEM(src_ppu, nt_addr);
+   offset = nametab - bg_cache->nametab;
+   if (nametab < bg_cache->nametab || offset >= PPU_BGCACHE_TABLES * 0x400 || (offset & 0x3FF))
+      return NULL;
+
+   slot = (offset >> 10) * 240 + line;
+   tag = &bg_cache->line[slot];
 
-   /* Blank left hand column if need be */
-   if (ppu.bg_mask)
+   /* where the background patterns are right now */
+   for (i = 0; i < 4; i++)
+      page[i] = src_ppu->page[(src_ppu->bg_base >> 10) + i] + src_ppu->bg_base + (i << 10);
+
+   bg_cache->lookups++;
+
+   if (tag->gen == bg_cache->gen && 0 == memcmp(tag->page, page, sizeof(page)))
    {
-      uint32 *buf_ptr = (uint32 *)vidbuf;
-      uint32 bg_clear = FULLBG | FULLBG << 8 | FULLBG << 16 | FULLBG << 24;
+      bg_cache->hits++;
+   }
+   else
+   {
+      bg_drawline(src_ppu, bg_cache->pixels[slot], nt_addr, line);
+      memcpy(tag->page, page, sizeof(page));
+      tag->gen = bg_cache->gen;
+   }
 
-      ((uint32 *)buf_ptr)[0] = bg_clear;
-      ((uint32 *)buf_ptr)[1] = bg_clear;
+   return bg_cache->pixels[slot];
+}
+#endif /* PPU_BGCACHE_TABLES */
+
+/* copy a line of background together out of the line cache, false
+** if there isn't one or it can't have this line
+*/
+INLINE bool bg_copyline(ppu_t *src_ppu, uint8 *vidbuf)
+{
+#if PPU_BGCACHE_TABLES
+   const uint8 *left, *right;
+   uint32 nt_addr = (src_ppu->vaddr & 0x0C00) | 0x2000;
+   int x_tile = src_ppu->vaddr & 0x1F;
+   int y_tile = (src_ppu->vaddr >> 5) & 0x1F;
+   int line = (y_tile << 3) + ((src_ppu->vaddr >> 12) & 7);
+   int split = (32 - x_tile) << 3;
+
+   if (NULL == src_ppu->bg_cache || y_tile >= 30)
+      return false;
+
+   left = bg_getline(src_ppu, nt_addr, line);
+   right = bg_getline(src_ppu, nt_addr ^ (1 << 10), line);
+   if (NULL == left || NULL == right)
+      return false;
+
+   memcpy(vidbuf - src_ppu->tile_xofs, left + (x_tile << 3), split);
+   memcpy(vidbuf - src_ppu->tile_xofs + split, right, (33 << 3) - split);
+   bg_maskleft(src_ppu, vidbuf);
+   return true;
+#else /* !PPU_BGCACHE_TABLES */
+   UNUSED(vidbuf);
+   return false;
+#endif /* !PPU_BGCACHE_TABLES */
+}
+
+/* a finished line in RGB565, for a bitmap with a plane for it: the
+** flag bits the sprites were sorted out with are just more colors in
+** <rgb565>, so this is the only lookup the display needs
+*/
+INLINE void ppu_resolveline(const uint16 *rgb565, const uint8 *vidbuf, uint16 *rgbbuf)
+{
+   int x;
+
+   for (x = 0; x < NES_SCREEN_WIDTH; x += 4)
+   {
+      rgbbuf[x] = rgb565[vidbuf[x]];
+      rgbbuf[x + 1] = rgb565[vidbuf[x + 1]];
+      rgbbuf[x + 2] = rgb565[vidbuf[x + 2]];
+      rgbbuf[x + 3] = rgb565[vidbuf[x + 3]];
    }
 }
 
+/* The scanline renderers are generated in variants, see
+** ppu_pickrenderers(), so the per tile and per sprite tests for things
+** most games never use fold away: <latch> for mappers that watch
+** pattern fetches (MMC2/MMC4), <tall> for 8x16 sprites.
+*/
+#define PPU_MAKE_RENDERBG(name, latch)                                                       \
+   static void ppu_renderbg_##name(ppu_t *src_ppu, uint8 *vidbuf)                            \
+   {                                                                                         \
+      uint8 *bmp_ptr, *tile_ptr;                                                             \
+      const uint8 *pixels, *attrib_row;                                                      \
+      uint32 scratch[2];                                                                     \
+      uint8 attrib_scratch[32];                                                              \
+      uint32 refresh_vaddr, bg_offset;                                                       \
+      int tile_count;                                                                        \
+      uint8 tile_index, x_tile, y_tile;                                                      \
+                                                                                             \
+      /* draw a line of transparent background color if bg is disabled */                    \
+      if (false == src_ppu->bg_on)                                                           \
+      {                                                                                      \
+         memset(vidbuf, FULLBG(src_ppu), NES_SCREEN_WIDTH);                                  \
+         return;                                                                             \
+      }                                                                                      \
+                                                                                             \
+      bmp_ptr = vidbuf - src_ppu->tile_xofs;              /* scroll x */                     \
+      refresh_vaddr = 0x2000 + (src_ppu->vaddr & 0x0FE0); /* mask out x tile */              \
+      x_tile = src_ppu->vaddr & 0x1F;                                                        \
+      y_tile = (src_ppu->vaddr >> 5) & 0x1F;                  /* to simplify calculations */ \
+      bg_offset = ((src_ppu->vaddr >> 12) & 7) + src_ppu->bg_base; /* offset in y tile */    \
+                                                                                             \
+      /* copy the line together out of the cache, unless the mapper                          \
+      ** watches tile fetches                                                                \
+      */                                                                                     \
+      if (false == (latch) && bg_copyline(src_ppu, vidbuf))                                  \
+         return;                                                                             \
+                                                                                             \
+      /* calculate initial values */                                                         \
+      tile_ptr = &PPU_PAGEMEM(src_ppu, refresh_vaddr + x_tile); /* pointer to tile index */  \
+      attrib_row = attrib_getrow(src_ppu, refresh_vaddr, y_tile, attrib_scratch);            \
+                                                                                             \
+      /* ppu fetches 33 tiles */                                                             \
+      tile_count = 33;                                                                       \
+      while (tile_count--)                                                                   \
+      {                                                                                      \
+         /* Tile number from nametable */                                                    \
+         tile_index = *tile_ptr++;                                                           \
+         pixels = chr_getrow(src_ppu, bg_offset + (tile_index << 4), scratch);               \
+                                                                                             \
+         /* Handle $FD/$FE tile VROM switching (PunchOut) */                                 \
+         if (latch)                                                                          \
+            src_ppu->latchfunc(src_ppu->bg_base, tile_index);                                \
+                                                                                             \
+         /* palette from the expanded attribute row */                                      \
+         draw_bgtile(bmp_ptr, pixels, src_ppu->palette + attrib_row[x_tile]);                \
+         bmp_ptr += 8;                                                                       \
+                                                                                             \
+         if (32 == ++x_tile) /* check every 32 tiles */                                      \
+         {                                                                                   \
+            x_tile = 0;                                                                      \
+            refresh_vaddr ^= (1 << 10); /* switch nametable */                               \
+                                                                                             \
+            /* recalculate pointers */                                                       \
+            tile_ptr = &PPU_PAGEMEM(src_ppu, refresh_vaddr);                                 \
+            attrib_row = attrib_getrow(src_ppu, refresh_vaddr, y_tile, attrib_scratch);      \
+         }                                                                                   \
+      }                                                                                      \
+                                                                                             \
+      bg_maskleft(src_ppu, vidbuf);                                                          \
+   }                                                                                         \
+
 /* OAM entry */
 typedef struct obj_s
 {
@@ -778,141 +1428,236 @@ typedef struct obj_s
    uint8 x_loc;
 } obj_t;
 
-/* TODO: fetch valid OAM a scanline before, like the Real Thing */
-static void ppu_renderoam(uint8 *vidbuf, int scanline)
+/* sort the sprites into the lines they're on, up to PPU_MAXSPRITE a
+** line in OAM order, which is all the renderer ever looks at.  Done
+** again whenever OAM or the sprite height has changed since.
+*/
+static void ppu_evaloam(ppu_t *src_ppu)
 {
-   uint8 *buf_ptr;
-   uint32 vram_offset, savecol[2] = {0};
-   int sprite_num, spritecount;
-   obj_t *sprite_ptr;
-   uint8 sprite_height;
-
-   if (false == ppu.obj_on)
-      return;
+   obj_t *sprite_ptr = (obj_t *)src_ppu->oam;
+   int sprite_num, line, last_line;
+   uint8 sprite_y;
 
-   /* Get our buffer pointer */
-   buf_ptr = vidbuf;
-
-   /* Save left hand column? */
-   if (ppu.obj_mask)
-   {
-      savecol[0] = ((uint32 *)buf_ptr)[0];
-      savecol[1] = ((uint32 *)buf_ptr)[1];
-   }
-
-   sprite_height = ppu.obj_height;
-   vram_offset = ppu.obj_base;
-   spritecount = 0;
-
-   sprite_ptr = (obj_t *)ppu.oam;
+   memset(src_ppu->obj_count, 0, sizeof(src_ppu->obj_count));
 
    for (sprite_num = 0; sprite_num < 64; sprite_num++, sprite_ptr++)
    {
-      uint8 *data_ptr, *bmp_ptr;
-      uint32 vram_adr;
-      int y_offset;
-      uint8 tile_index, attrib, col_high;
-      uint8 sprite_y, sprite_x;
-      bool check_strike;
-      int strike_pixel;
-
       sprite_y = sprite_ptr->y_loc + 1;
 
-      /* Check to see if sprite is out of range */
-      if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height)) || (0 == sprite_y) || (sprite_y >= 240))
+      /* never drawn */
+      if ((0 == sprite_y) || (sprite_y >= 240))
          continue;
 
-      sprite_x = sprite_ptr->x_loc;
-      tile_index = sprite_ptr->tile;
-      attrib = sprite_ptr->atr;
+      last_line = sprite_y + src_ppu->obj_height;
+      if (last_line > 240)
+         last_line = 240;
 
-      bmp_ptr = buf_ptr + sprite_x;
-
-      /* Handle $FD/$FE tile VROM switching (PunchOut) */
-      if (ppu.latchfunc)
-         ppu.latchfunc(vram_offset, tile_index);
-
-      /* Get upper two bits of color */
-      col_high = ((attrib & 3) << 2);
+      for (line = sprite_y; line < last_line; line++)
+      {
+         if (src_ppu->obj_count[line] < PPU_MAXSPRITE)
+            src_ppu->obj_line[line][src_ppu->obj_count[line]++] = sprite_num;
+      }
+   }
 
-      /* 8x16 even sprites use $0000, odd use $1000 */
-      if (16 == ppu.obj_height)
-         vram_adr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
-      else
-         vram_adr = vram_offset + (tile_index << 4);
+   src_ppu->oam_dirty = false;
+}
 
-      /* Get the address of the tile */
-      data_ptr = &PPU_MEM(vram_adr);
+/* TODO: fetch valid OAM a scanline before, like the Real Thing */
+#define PPU_MAKE_RENDEROAM(name, latch, tall)                                                                  \
+   static void ppu_renderoam_##name(ppu_t *src_ppu, uint8 *vidbuf, int scanline)                               \
+   {                                                                                                           \
+      uint8 *buf_ptr;                                                                                          \
+      uint32 vram_offset, savecol[2] = {0};                                                                    \
+      uint32 scratch[2];                                                                                       \
+      int sprite, spritecount;                                                                                 \
+                                                                                                               \
+      if (false == src_ppu->obj_on)                                                                            \
+         return;                                                                                               \
+                                                                                                               \
+      /* Get our buffer pointer */                                                                             \
+      buf_ptr = vidbuf;                                                                                        \
+                                                                                                               \
+      /* Save left hand column? */                                                                             \
+      if (src_ppu->obj_mask)                                                                                   \
+      {                                                                                                        \
+         savecol[0] = ((uint32 *)buf_ptr)[0];                                                                  \
+         savecol[1] = ((uint32 *)buf_ptr)[1];                                                                  \
+      }                                                                                                        \
+                                                                                                               \
+      if (src_ppu->oam_dirty)                                                                                  \
+         ppu_evaloam(src_ppu);                                                                                 \
+                                                                                                               \
+      vram_offset = src_ppu->obj_base;                                                                         \
+      spritecount = src_ppu->obj_count[scanline];                                                              \
+                                                                                                               \
+      for (sprite = 0; sprite < spritecount; sprite++)                                                         \
+      {                                                                                                        \
+         const uint8 *pixels;                                                                                  \
+         uint8 *bmp_ptr;                                                                                       \
+         obj_t *sprite_ptr;                                                                                    \
+         uint32 vram_adr;                                                                                      \
+         int y_offset, sprite_num;                                                                             \
+         uint8 tile_index, attrib, col_high;                                                                   \
+         uint8 sprite_y, sprite_x;                                                                             \
+                                                                                                               \
+         sprite_num = src_ppu->obj_line[scanline][sprite];                                                     \
+         sprite_ptr = (obj_t *)src_ppu->oam + sprite_num;                                                      \
+         sprite_y = sprite_ptr->y_loc + 1;                                                                     \
+         sprite_x = sprite_ptr->x_loc;                                                                         \
+         tile_index = sprite_ptr->tile;                                                                        \
+         attrib = sprite_ptr->atr;                                                                             \
+                                                                                                               \
+         bmp_ptr = buf_ptr + sprite_x;                                                                         \
+                                                                                                               \
+         /* Handle $FD/$FE tile VROM switching (PunchOut) */                                                   \
+         if (latch)                                                                                            \
+            src_ppu->latchfunc(vram_offset, tile_index);                                                       \
+                                                                                                               \
+         /* Get upper two bits of color */                                                                     \
+         col_high = ((attrib & 3) << 2);                                                                       \
+                                                                                                               \
+         /* 8x16 even sprites use $0000, odd use $1000 */                                                      \
+         if (tall)                                                                                             \
+            vram_adr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);                                  \
+         else                                                                                                  \
+            vram_adr = vram_offset + (tile_index << 4);                                                        \
+                                                                                                               \
+         /* Calculate offset (line within the sprite) */                                                       \
+         y_offset = scanline - sprite_y;                                                                       \
+         if (y_offset > 7)                                                                                     \
+            y_offset += 8;                                                                                     \
+                                                                                                               \
+         /* Account for vertical flippage */                                                                   \
+         if (attrib & OAMF_VFLIP)                                                                              \
+         {                                                                                                     \
+            if (tall)                                                                                          \
+               y_offset -= 23;                                                                                 \
+            else                                                                                               \
+               y_offset -= 7;                                                                                  \
+                                                                                                               \
+            vram_adr -= y_offset;                                                                              \
+         }                                                                                                     \
+         else                                                                                                  \
+         {                                                                                                     \
+            vram_adr += y_offset;                                                                              \
+         }                                                                                                     \
+                                                                                                               \
+         /* Get the row of the tile */                                                                         \
+         pixels = chr_getrow(src_ppu, vram_adr, scratch);                                                      \
+                                                                                                               \
+         draw_oamtile(bmp_ptr, attrib, pixels, src_ppu->palette + 16 + col_high);                              \
+      }                                                                                                        \
+                                                                                                               \
+      /* maximum of 8 sprites per scanline */                                                                  \
+      if (PPU_MAXSPRITE == spritecount)                                                                        \
+         src_ppu->stat |= PPU_STATF_MAXSPRITE;                                                                 \
+                                                                                                               \
+      /* Restore lefthand column */                                                                            \
+      if (src_ppu->obj_mask)                                                                                   \
+      {                                                                                                        \
+         ((uint32 *)buf_ptr)[0] = savecol[0];                                                                  \
+         ((uint32 *)buf_ptr)[1] = savecol[1];                                                                  \
+      }                                                                                                        \
+   }                                                                                                           \
+
+/* generate the functions */
+#if PPU_RENDERVARIANTS
+PPU_MAKE_RENDERBG(plain, false)
+PPU_MAKE_RENDERBG(latch, true)
+PPU_MAKE_RENDEROAM(8, false, false)
+PPU_MAKE_RENDEROAM(16, false, true)
+PPU_MAKE_RENDEROAM(8_latch, true, false)
+PPU_MAKE_RENDEROAM(16_latch, true, true)
+#else /* !PPU_RENDERVARIANTS */
+PPU_MAKE_RENDERBG(any, NULL != src_ppu->latchfunc)
+PPU_MAKE_RENDEROAM(any, NULL != src_ppu->latchfunc, 16 == src_ppu->obj_height)
+#endif /* !PPU_RENDERVARIANTS */
+
+/* point the renderers at the variants for the mapper and sprite size,
+** whenever either changes
+*/
+static void ppu_pickrenderers(ppu_t *src_ppu)
+{
+#if PPU_RENDERVARIANTS
+   bool tall = (16 == src_ppu->obj_height);
 
-      /* Calculate offset (line within the sprite) */
-      y_offset = scanline - sprite_y;
-      if (y_offset > 7)
-         y_offset += 8;
+   if (src_ppu->latchfunc)
+   {
+      src_ppu->renderbg = ppu_renderbg_latch;
+      src_ppu->renderoam = tall ? ppu_renderoam_16_latch : ppu_renderoam_8_latch;
+   }
+   else
+   {
+      src_ppu->renderbg = ppu_renderbg_plain;
+      src_ppu->renderoam = tall ? ppu_renderoam_16 : ppu_renderoam_8;
+   }
+#else /* !PPU_RENDERVARIANTS */
+   src_ppu->renderbg = ppu_renderbg_any;
+   src_ppu->renderoam = ppu_renderoam_any;
+#endif /* !PPU_RENDERVARIANTS */
+}
 
-      /* Account for vertical flippage */
-      if (attrib & OAMF_VFLIP)
-      {
-         if (16 == ppu.obj_height)
-            y_offset -= 23;
-         else
-            y_offset -= 7;
+/* the opaque pixels of the pattern row at <addr>, bit 7 leftmost:
+** straight off both bitplanes, so no decoding and no CHR cache, which
+** may be the render thread's
+*/
+INLINE uint8 chr_opaque(uint32 addr)
+{
+   return PPU_MEM(addr) | PPU_MEM(addr + 8);
+}
 
-         data_ptr -= y_offset;
-      }
-      else
-      {
-         data_ptr += y_offset;
-      }
+INLINE uint8 flip_bits(uint8 bits)
+{
+   bits = (bits >> 4) | (bits << 4);
+   bits = ((bits & 0xCC) >> 2) | ((bits & 0x33) << 2);
+   return ((bits & 0xAA) >> 1) | ((bits & 0x55) << 1);
+}
 
-      /* if we're on sprite 0 and sprite 0 strike flag isn't set,
-      ** check for a strike 
-      */
-      check_strike = (0 == sprite_num) && (false == ppu.strikeflag);
-      strike_pixel = draw_oamtile(bmp_ptr, attrib, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high, check_strike);
-      if (strike_pixel >= 0)
-         ppu_setstrike(strike_pixel);
+/* the opaque pixels of tile <x_tile> (0-33, from where the line starts
+** fetching) of the background on this line
+*/
+INLINE uint8 bg_opaque(int x_tile)
+{
+   uint32 nt_addr = 0x2000 + (ppu.vaddr & 0x0FE0);
 
-      /* maximum of 8 sprites per scanline */
-      if (++spritecount == PPU_MAXSPRITE)
-      {
-         ppu.stat |= PPU_STATF_MAXSPRITE;
-         break;
-      }
-   }
+   x_tile += ppu.vaddr & 0x1F;
+   if (x_tile & 0x20)
+      nt_addr ^= 0x0400;
+   nt_addr += x_tile & 0x1F;
 
-   /* Restore lefthand column */
-   if (ppu.obj_mask)
-   {
-      ((uint32 *)buf_ptr)[0] = savecol[0];
-      ((uint32 *)buf_ptr)[1] = savecol[1];
-   }
+   return chr_opaque(ppu.bg_base + (PPU_MEM(nt_addr) << 4) + ((ppu.vaddr >> 12) & 7));
 }
 
-/* Fake rendering a line */
-/* This is needed for sprite 0 hits when we're skipping drawing a frame */
-static void ppu_fakeoam(int scanline)
+/* Sprite 0 hits, on every line whether it's drawn, skipped or drawn on
+** the render thread: sprite 0's opaque pixels against the opaque
+** background under them, out of pattern data and nametables alone,
+** never the pixels drawn.  So a frame strikes on the same cycle however
+** it's drawn, and a status bar split doesn't move when frames are
+** skipped.
+*/
+static void ppu_strikeline(int scanline)
 {
-   uint8 *data_ptr;
    obj_t *sprite_ptr;
-   uint32 vram_adr, color;
-   int y_offset;
-   uint8 pat1, pat2;
+   uint32 vram_adr, bg_pair;
+   int y_offset, column, i;
    uint8 tile_index, attrib;
-   uint8 sprite_height, sprite_y, sprite_x;
+   uint8 sprite_y, sprite_x;
+   uint8 sprite_row, bg_row;
 
    /* we don't need to be here if strike flag is set */
+   if (ppu.strikeflag || false == ppu.obj_on || false == ppu.bg_on)
+      return;
 
-   if (false == ppu.obj_on || ppu.strikeflag)
+   if (ppu.oam_dirty)
+      ppu_evaloam(&ppu);
+
+   /* sprite 0 is first on any line it's on */
+   if (0 == ppu.obj_count[scanline] || 0 != ppu.obj_line[scanline][0])
       return;
 
-   sprite_height = ppu.obj_height;
    sprite_ptr = (obj_t *)ppu.oam;
    sprite_y = sprite_ptr->y_loc + 1;
 
-   /* Check to see if sprite is out of range */
-   if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height)) || (0 == sprite_y) || (sprite_y > 240))
-      return;
-
    sprite_x = sprite_ptr->x_loc;
    tile_index = sprite_ptr->tile;
    attrib = sprite_ptr->atr;
@@ -923,8 +1668,6 @@ static void ppu_fakeoam(int scanline)
    else
       vram_adr = ppu.obj_base + (tile_index << 4);
 
-   data_ptr = &PPU_MEM(vram_adr);
-
    /* Calculate offset (line within the sprite) */
    y_offset = scanline - sprite_y;
    if (y_offset > 7)
@@ -937,68 +1680,353 @@ static void ppu_fakeoam(int scanline)
          y_offset -= 23;
       else
          y_offset -= 7;
-      data_ptr -= y_offset;
+      vram_adr -= y_offset;
    }
    else
    {
-      data_ptr += y_offset;
+      vram_adr += y_offset;
    }
 
-   /* check for a solid sprite 0 pixel */
-   pat1 = data_ptr[0];
-   pat2 = data_ptr[8];
-   color = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1) | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
+   sprite_row = chr_opaque(vram_adr);
+   if (attrib & OAMF_HFLIP)
+      sprite_row = flip_bits(sprite_row);
 
-   if (color)
-   {
-      uint8 colors[8];
+   if (0 == sprite_row)
+      return;
+
+   /* the 8 background pixels under it, out of the two tiles they're
+   ** across
+   */
+   column = sprite_x + ppu.tile_xofs;
+   bg_pair = (bg_opaque(column >> 3) << 8) | bg_opaque((column >> 3) + 1);
+   bg_row = (uint8)((bg_pair << (column & 7)) >> 8);
+
+   /* none in a masked left hand column, and none at x=255 */
+   if (ppu.bg_mask && sprite_x < 8)
+      bg_row &= (1 << sprite_x) - 1;
+   if (sprite_x > 247)
+      bg_row &= 0xFF << (sprite_x - 247);
+
+   sprite_row &= bg_row;
 
-      /* buckle up, it's going to get ugly... */
-      if (0 == (attrib & OAMF_HFLIP))
+   for (i = 0; i < 8; i++)
+   {
+      if (sprite_row & (0x80 >> i))
       {
-         colors[0] = (color >> 14) & 3;
-         colors[1] = (color >> 6) & 3;
-         colors[2] = (color >> 12) & 3;
-         colors[3] = (color >> 4) & 3;
-         colors[4] = (color >> 10) & 3;
-         colors[5] = (color >> 2) & 3;
-         colors[6] = (color >> 8) & 3;
-         colors[7] = color & 3;
+         ppu_setstrike(sprite_x + i);
+         break;
       }
-      else
+   }
+}
+
+bool ppu_enabled(void)
+{
+   return (ppu.bg_on || ppu.obj_on);
+}
+
+/* Deferred rendering (NOFRENDO_DEFERRED_RENDER).  The emulation thread
+** doesn't draw visible lines, it records what each one needs: scroll,
+** what the control registers set, and copies of the palette, OAM and page
+** mapping, taken only when their gen says they've changed.  The render
+** thread, on the other core, draws the lines from those with a PPU of
+** its own, a line or so behind.  Sprite 0 hits and the sprite overflow
+** flag are still worked out on the emulation thread, as for any line.
+** Anything that writes pattern or nametable memory, or the caches,
+** waits for the render thread to catch up first, as does the end of
+** the frame.  Mappers with a latch callback are drawn
+** inline, as it has to see the fetches in order.
+*/
+#ifdef NOFRENDO_DEFERRED_RENDER
+static void defer_init(ppu_t *src_ppu)
+{
+   ppu_defer_t *defer = src_ppu->defer;
+
+   memset(defer, 0, sizeof(ppu_defer_t));
+   atomic_init(&defer->running, false);
+   atomic_init(&defer->quit, false);
+   atomic_init(&defer->head, 0);
+   atomic_init(&defer->tail, 0);
+   defer->enabled = true;
+
+   /* new copies of all of it first thing */
+   defer->pal_copies.gen = src_ppu->pal_gen - 1;
+   defer->oam_copies.gen = src_ppu->oam_gen - 1;
+   defer->page_copies.gen = src_ppu->page_gen - 1;
+}
+#endif /* NOFRENDO_DEFERRED_RENDER */
+
+/* is there a render thread to keep out of the way of */
+static bool defer_running(ppu_t *src_ppu)
+{
+#ifdef NOFRENDO_DEFERRED_RENDER
+   return src_ppu->defer && atomic_load(&src_ppu->defer->running);
+#else  /* !NOFRENDO_DEFERRED_RENDER */
+   UNUSED(src_ppu);
+   return false;
+#endif /* !NOFRENDO_DEFERRED_RENDER */
+}
+
+/* wait until the render thread has drawn every line recorded */
+static void defer_sync(ppu_t *src_ppu)
+{
+#ifdef NOFRENDO_DEFERRED_RENDER
+   ppu_defer_t *defer = src_ppu->defer;
+
+   if (NULL == defer)
+      return;
+
+   while (atomic_load_explicit(&defer->tail, memory_order_acquire) !=
+          atomic_load_explicit(&defer->head, memory_order_relaxed))
+      osd_yield();
+#else  /* !NOFRENDO_DEFERRED_RENDER */
+   UNUSED(src_ppu);
+#endif /* !NOFRENDO_DEFERRED_RENDER */
+}
+
+/* finish drawing and end the render thread, if there is one */
+static void defer_stop(ppu_t *src_ppu)
+{
+#ifdef NOFRENDO_DEFERRED_RENDER
+   ppu_defer_t *defer = src_ppu->defer;
+
+   if (NULL == defer || false == atomic_load(&defer->running))
+      return;
+
+   defer_sync(src_ppu);
+   atomic_store(&defer->quit, true);
+   while (atomic_load(&defer->running))
+      osd_yield();
+#else  /* !NOFRENDO_DEFERRED_RENDER */
+   UNUSED(src_ppu);
+#endif /* !NOFRENDO_DEFERRED_RENDER */
+}
+
+#ifdef NOFRENDO_DEFERRED_RENDER
+/* the render thread: bring its PPU up to a line's state, and draw it */
+static void defer_drawline(ppu_defer_t *defer, const ppu_line_t *line)
+{
+   ppu_t *render = &defer->render;
+   int pal = line->pal & (PPU_DEFER_COPIES - 1);
+   int oam = line->oam & (PPU_DEFER_COPIES - 1);
+   int pages = line->pages & (PPU_DEFER_COPIES - 1);
+
+   if (line->pages != defer->pages_used)
+   {
+      memcpy(render->page, defer->pages[pages].page, sizeof(defer->pages[0].page));
+      memcpy(render->chr_page, defer->pages[pages].chr_page, sizeof(render->chr_page));
+      memcpy(render->attrib_page, defer->pages[pages].attrib_page, sizeof(render->attrib_page));
+      defer->pages_used = line->pages;
+   }
+
+   /* cached background lines have the old colors in them */
+   if (line->pal != defer->pal_used)
+   {
+      if (defer->pal_used < 0 || memcmp(render->palette, defer->pal[pal], 16))
+         bg_flush(render);
+
+      memcpy(render->palette, defer->pal[pal], 32);
+      defer->pal_used = line->pal;
+   }
+
+   if (line->oam != defer->oam_used)
+   {
+      memcpy(render->oam, defer->oam[oam], 256);
+      render->oam_dirty = true;
+      defer->oam_used = line->oam;
+   }
+
+   /* as ppu_write() does it */
+   if (render->obj_height != line->obj_height)
+   {
+      render->obj_height = line->obj_height;
+      render->oam_dirty = true;
+      ppu_pickrenderers(render);
+   }
+
+   render->obj_base = line->obj_base;
+   render->bg_base = line->bg_base;
+   render->bg_on = line->bg_on;
+   render->obj_on = line->obj_on;
+   render->obj_mask = line->obj_mask;
+   render->bg_mask = line->bg_mask;
+   render->vaddr = line->vaddr;
+   render->tile_xofs = line->tile_xofs;
+
+   render->renderbg(render, line->vidbuf);
+   if (line->drawsprites)
+      render->renderoam(render, line->vidbuf, line->scanline);
+
+   if (line->rgbbuf)
+      ppu_resolveline(line->rgb565, line->vidbuf, line->rgbbuf);
+}
+
+static void defer_thread(void *arg)
+{
+   ppu_defer_t *defer = arg;
+   uint32 tail = atomic_load(&defer->tail);
+
+   while (false == atomic_load(&defer->quit))
+   {
+      if (tail == atomic_load_explicit(&defer->head, memory_order_acquire))
       {
-         colors[7] = (color >> 14) & 3;
-         colors[6] = (color >> 6) & 3;
-         colors[5] = (color >> 12) & 3;
-         colors[4] = (color >> 4) & 3;
-         colors[3] = (color >> 10) & 3;
-         colors[2] = (color >> 2) & 3;
-         colors[1] = (color >> 8) & 3;
-         colors[0] = color & 3;
+         osd_yield();
+         continue;
       }
 
-      if (colors[0])
-         ppu_setstrike(sprite_x + 0);
-      else if (colors[1])
-         ppu_setstrike(sprite_x + 1);
-      else if (colors[2])
-         ppu_setstrike(sprite_x + 2);
-      else if (colors[3])
-         ppu_setstrike(sprite_x + 3);
-      else if (colors[4])
-         ppu_setstrike(sprite_x + 4);
-      else if (colors[5])
-         ppu_setstrike(sprite_x + 5);
-      else if (colors[6])
-         ppu_setstrike(sprite_x + 6);
-      else if (colors[7])
-         ppu_setstrike(sprite_x + 7);
+      defer_drawline(defer, &defer->line[tail & (PPU_DEFER_LINES - 1)]);
+      atomic_store_explicit(&defer->tail, ++tail, memory_order_release);
    }
+
+   atomic_store(&defer->running, false);
 }
 
-bool ppu_enabled(void)
+static bool defer_start(ppu_defer_t *defer)
 {
-   return (ppu.bg_on || ppu.obj_on);
+   ppu_t *render = &defer->render;
+
+   /* the caches are shared, but only ever used by one thread at once */
+   memset(render, 0, sizeof(ppu_t));
+   render->chr_cache = ppu.chr_cache;
+   render->chr_tag = ppu.chr_tag;
+   render->bg_cache = ppu.bg_cache;
+   render->attrib_tiles = ppu.attrib_tiles;
+   ppu_pickrenderers(render);
+   defer->pal_used = defer->oam_used = defer->pages_used = -1;
+
+   atomic_store(&defer->quit, false);
+   atomic_store(&defer->running, true);
+   if (osd_startthread(defer_thread, defer))
+   {
+      atomic_store(&defer->running, false);
+      defer->enabled = false;
+      return false;
+   }
+
+   return true;
+}
+
+/* a slot for a copy of something that changed, once the oldest is
+** free; serials tell the copies apart, as the slots are reused
+*/
+static int defer_newcopy(ppu_defer_t *defer, ppu_copies_t *copies, uint32 gen)
+{
+   int slot = (uint8)(copies->serial + 1) & (PPU_DEFER_COPIES - 1);
+
+   while ((int32)(atomic_load_explicit(&defer->tail, memory_order_acquire) - copies->busy_until[slot]) < 0)
+      osd_yield();
+
+   copies->serial++;
+   copies->gen = gen;
+   return slot;
+}
+
+/* the newest copy, needed until line <head> is drawn */
+INLINE uint8 defer_usecopy(ppu_copies_t *copies, uint32 head)
+{
+   copies->busy_until[copies->serial & (PPU_DEFER_COPIES - 1)] = head + 1;
+   return copies->serial;
+}
+#endif /* NOFRENDO_DEFERRED_RENDER */
+
+/* record a line for the render thread, false if it's to be drawn here */
+static bool defer_line(bitmap_t *bmp, int scanline)
+{
+#ifdef NOFRENDO_DEFERRED_RENDER
+   ppu_defer_t *defer = ppu.defer;
+   ppu_line_t *line;
+   uint32 head;
+   int slot;
+
+   if (NULL == defer || false == defer->enabled || ppu.latchfunc)
+      return false;
+
+   if (false == atomic_load(&defer->running) && false == defer_start(defer))
+      return false;
+
+   /* a frame behind already */
+   head = atomic_load_explicit(&defer->head, memory_order_relaxed);
+   while (head - atomic_load_explicit(&defer->tail, memory_order_acquire) >= PPU_DEFER_LINES)
+      osd_yield();
+
+   if (ppu.pal_gen != defer->pal_copies.gen)
+   {
+      slot = defer_newcopy(defer, &defer->pal_copies, ppu.pal_gen);
+      memcpy(defer->pal[slot], ppu.palette, 32);
+   }
+
+   if (ppu.oam_gen != defer->oam_copies.gen)
+   {
+      slot = defer_newcopy(defer, &defer->oam_copies, ppu.oam_gen);
+      memcpy(defer->oam[slot], ppu.oam, 256);
+   }
+
+   if (ppu.page_gen != defer->page_copies.gen)
+   {
+      slot = defer_newcopy(defer, &defer->page_copies, ppu.page_gen);
+      memcpy(defer->pages[slot].page, ppu.page, sizeof(defer->pages[0].page));
+      memcpy(defer->pages[slot].chr_page, ppu.chr_page, sizeof(ppu.chr_page));
+      memcpy(defer->pages[slot].attrib_page, ppu.attrib_page, sizeof(ppu.attrib_page));
+   }
+
+   line = &defer->line[head & (PPU_DEFER_LINES - 1)];
+   line->vidbuf = bmp->line[scanline];
+   line->rgbbuf = bmp->line16 ? bmp->line16[scanline] : NULL;
+   line->rgb565 = bmp->rgb565;
+   line->vaddr = ppu.vaddr;
+   line->obj_base = ppu.obj_base;
+   line->bg_base = ppu.bg_base;
+   line->tile_xofs = ppu.tile_xofs;
+   line->obj_height = ppu.obj_height;
+   line->scanline = scanline;
+   line->pal = defer_usecopy(&defer->pal_copies, head);
+   line->oam = defer_usecopy(&defer->oam_copies, head);
+   line->pages = defer_usecopy(&defer->page_copies, head);
+   line->bg_on = ppu.bg_on;
+   line->obj_on = ppu.obj_on;
+   line->obj_mask = ppu.obj_mask;
+   line->bg_mask = ppu.bg_mask;
+   line->drawsprites = ppu.drawsprites;
+
+   atomic_store_explicit(&defer->head, head + 1, memory_order_release);
+
+   /* what drawing the sprites would have found out */
+   if (ppu.drawsprites && ppu.obj_on)
+   {
+      if (ppu.oam_dirty)
+         ppu_evaloam(&ppu);
+      if (PPU_MAXSPRITE == ppu.obj_count[scanline])
+         ppu.stat |= PPU_STATF_MAXSPRITE;
+   }
+
+   return true;
+#else  /* !NOFRENDO_DEFERRED_RENDER */
+   UNUSED(bmp);
+   UNUSED(scanline);
+   return false;
+#endif /* !NOFRENDO_DEFERRED_RENDER */
+}
+
+/* turn drawing on the render thread on or off, -1 if not built in */
+int ppu_setdeferred(bool enable)
+{
+#ifdef NOFRENDO_DEFERRED_RENDER
+   if (NULL == ppu.defer)
+      return -1;
+
+   if (false == enable && atomic_load(&ppu.defer->running))
+   {
+      defer_stop(&ppu);
+
+      /* palette writes since left the flushing to the render thread */
+      bg_flush(&ppu);
+   }
+
+   ppu.defer->enabled = enable;
+   return 0;
+#else  /* !NOFRENDO_DEFERRED_RENDER */
+   UNUSED(enable);
+   return -1;
+#endif /* !NOFRENDO_DEFERRED_RENDER */
 }
 
 static void ppu_renderscanline(bitmap_t *bmp, int scanline, bool draw_flag)
@@ -1019,14 +2047,28 @@ static void ppu_renderscanline(bitmap_t *bmp, int scanline, bool draw_flag)
       }
    }
 
-   if (draw_flag)
-      ppu_renderbg(buf);
+   ppu_strikeline(scanline);
+
+   /* a line overscan cuts off is only ever needed for its sprite 0 hit,
+   ** unless the mapper watches the pattern fetches drawing it makes
+   */
+   if ((scanline < ppu.first_line || scanline >= ppu.end_line) && NULL == ppu.latchfunc)
+      draw_flag = false;
+
+   if (false == draw_flag || defer_line(bmp, scanline))
+      return;
+
+   /* drawing it here, after whatever the render thread has yet to */
+   defer_sync(&ppu);
+
+   ppu.renderbg(&ppu, buf);
 
    /* TODO: fetch obj data 1 scanline before */
-   if (true == ppu.drawsprites && true == draw_flag)
-      ppu_renderoam(buf, scanline);
-   else
-      ppu_fakeoam(scanline);
+   if (true == ppu.drawsprites)
+      ppu.renderoam(&ppu, buf, scanline);
+
+   if (bmp->line16)
+      ppu_resolveline(bmp->rgb565, buf, bmp->line16[scanline]);
 }
 
 void ppu_endscanline(int scanline)
@@ -1063,14 +2105,49 @@ void ppu_endscanline(int scanline)
    }
 }
 
+/* For idle loop skipping: how many CPU cycles from <cycle> on $2002
+** is sure to keep reading the same.  Vblank only comes and goes on
+** timeline events, which end the timeslice anyway; the sprite flags
+** change when a known sprite 0 strike comes due, or possibly when the
+** next line is drawn, <next_line> cycles from now.  A strike can come
+** due between the loop's read and its jump back, none to skip then.
+*/
+int32 ppu_statidle(uint32 cycle, int32 next_line)
+{
+   int32 limit = NES6502_IDLE_FOREVER;
+
+   if (ppu.strikeflag)
+   {
+      if (ppu.strike_cycle > cycle)
+         limit = ppu.strike_cycle - cycle;
+      else if (0 == (ppu.stat_read & PPU_STATF_STRIKE))
+         return 0;
+   }
+
+   if ((ppu.obj_on || (ppu.stat & PPU_STATF_MAXSPRITE)) && next_line < limit)
+      limit = next_line;
+
+   return limit;
+}
+
+void ppu_setvisible(int first_line, int end_line)
+{
+   ASSERT(first_line >= 0 && first_line <= end_line && end_line <= NES_SCREEN_HEIGHT);
+
+   ppu.first_line = first_line;
+   ppu.end_line = end_line;
+}
+
 void ppu_checknmi(void)
 {
    if (ppu.ctrl0 & PPU_CTRL0F_NMI)
       nes_nmi();
 }
 
-void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag)
+void ppu_scanline(bitmap_t *bmp, int scanline, uint32 cycle, bool draw_flag)
 {
+   ppu.line_cycle = cycle;
+
    if (scanline < NES_SCREEN_HEIGHT)
    {
       /* Lower the Max Sprite per scanline flag */
@@ -1084,6 +2161,9 @@ void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag)
    }
    else if (261 == scanline)
    {
+      /* the frame is finished when the render thread is */
+      defer_sync(&ppu);
+
       ppu.stat &= ~PPU_STATF_VBLANK;
       ppu.strikeflag = false;
       ppu.strike_cycle = (uint32)-1;
@@ -1157,7 +2237,8 @@ static void draw_sprite(bitmap_t *bmp, int x, int y, uint8 tile_num, uint8 attri
 {
    int line, height;
    int col_high, vram_adr;
-   uint8 *vid, *data_ptr;
+   uint32 scratch[2];
+   uint8 *vid;
 
    vid = bmp->line[y] + x;
 
@@ -1172,17 +2253,15 @@ static void draw_sprite(bitmap_t *bmp, int x, int y, uint8 tile_num, uint8 attri
    else
       vram_adr = ppu.obj_base + (tile_num << 4);
 
-   data_ptr = &PPU_MEM(vram_adr);
-
    for (line = 0; line < height; line++)
    {
       if (line == 8)
-         data_ptr += 8;
+         vram_adr += 8;
 
-      draw_bgtile(vid, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high);
-      //draw_oamtile(vid, attrib, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high);
+      draw_bgtile(vid, chr_getrow(&ppu, vram_adr, scratch), ppu.palette + 16 + col_high);
+      //draw_oamtile(vid, attrib, chr_getrow(&ppu, vram_adr, scratch), ppu.palette + 16 + col_high);
 
-      data_ptr++;
+      vram_adr++;
       vid += bmp->pitch;
    }
 }
@@ -1218,7 +2297,8 @@ void ppu_dumpoam(bitmap_t *bmp, int x_loc, int y_loc)
 void ppu_dumppattern(bitmap_t *bmp, int table_num, int x_loc, int y_loc, int col)
 {
    int x_tile, y_tile;
-   uint8 *bmp_ptr, *data_ptr, *ptr;
+   uint8 *bmp_ptr, *ptr;
+   uint32 scratch[2], vram_adr;
    int tile_num, line;
    uint8 col_high;
 
@@ -1232,13 +2312,13 @@ void ppu_dumppattern(bitmap_t *bmp, int table_num, int x_loc, int y_loc, int col
 
       for (x_tile = 0; x_tile < 16; x_tile++)
       {
-         data_ptr = &PPU_MEM((table_num << 12) + (tile_num << 4));
+         vram_adr = (table_num << 12) + (tile_num << 4);
          ptr = bmp_ptr;
 
          for (line = 0; line < 8; line++)
          {
-            draw_bgtile(ptr, data_ptr[0], data_ptr[8], ppu.palette + col_high);
-            data_ptr++;
+            draw_bgtile(ptr, chr_getrow(&ppu, vram_adr, scratch), ppu.palette + col_high);
+            vram_adr++;
             ptr += bmp->pitch;
          }
 
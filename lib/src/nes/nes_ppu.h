@@ -69,10 +69,81 @@
 /* Maximum number of sprites per horizontal scanline */
 #define PPU_MAXSPRITE 8
 
+/* Decoded CHR cache: tile rows are kept as one 2-bit pixel per byte,
+** looked up by where the tile sits in CHR-ROM/RAM (see ppu_addchr)
+** rather than by PPU address, so bank switches don't invalidate it.
+** PPU_CHRCACHE_TILES is a power of 2, or 0 to decode every row as it
+** is drawn; each tile costs 64 bytes plus a 4 byte tag.  512 holds
+** 8kB of CHR, i.e. all of CHR-RAM, without evictions.
+*/
+#ifndef PPU_CHRCACHE_TILES
+#define PPU_CHRCACHE_TILES 512
+#endif /* !PPU_CHRCACHE_TILES */
+
+/* true puts the cache in internal SRAM, false lets it go to PSRAM,
+** which is slower but has room to hold a whole CHR-ROM
+*/
+#ifndef PPU_CHRCACHE_FAST
+#define PPU_CHRCACHE_FAST true
+#endif /* !PPU_CHRCACHE_FAST */
+
+/* CHR-ROM and CHR-RAM */
+#define PPU_MAX_CHR 2
+
+/* Background line cache: every line of the first PPU_BGCACHE_TABLES
+** nametables, drawn, so a line whose nametable row, background pattern
+** pages and palette haven't changed is copied out at whatever scroll
+** instead of drawn tile by tile.  Each table costs about 66kB, which
+** goes to PSRAM if there is some; 2 covers all but four-screen carts,
+** 0 turns the cache off.
+*/
+#ifndef PPU_BGCACHE_TABLES
+#define PPU_BGCACHE_TABLES 2
+#endif /* !PPU_BGCACHE_TABLES */
+
+/* 1 draws with scanline renderers built for the mapper and sprite
+** size, see ppu_pickrenderers; 0 with a single one that tests for
+** both as it goes, which is only worth having to measure against
+*/
+#ifndef PPU_RENDERVARIANTS
+#define PPU_RENDERVARIANTS 1
+#endif /* !PPU_RENDERVARIANTS */
+
 /* some mappers do *dumb* things */
 typedef void (*ppulatchfunc_t)(uint32 address, uint8 value);
 typedef void (*ppuvromswitch_t)(uint8 value);
 
+typedef struct ppu_chr_s
+{
+   uint8 *base;
+   uint32 size;
+   int32 first_tile; /* cache tile number of the first tile */
+} ppu_chr_t;
+
+#if PPU_BGCACHE_TABLES
+/* how a cached background line was drawn */
+typedef struct ppu_bgline_s
+{
+   uint8 *page[4]; /* background pattern pages, as mapped */
+   uint32 gen;     /* ppu_bgcache_t.gen then, or 0 once stale */
+} ppu_bgline_t;
+
+typedef struct ppu_bgcache_s
+{
+   /* bumped by anything that changes every line: pattern data, the
+   ** background palette, state loads
+   */
+   uint32 gen;
+   uint32 hits, lookups;
+
+   /* the running PPU's nametable RAM, the only pages cached */
+   uint8 *nametab;
+
+   ppu_bgline_t line[PPU_BGCACHE_TABLES * 240];
+   uint8 pixels[PPU_BGCACHE_TABLES * 240][256];
+} ppu_bgcache_t;
+#endif /* PPU_BGCACHE_TABLES */
+
 typedef struct ppu_s
 {
    /* big nasty memory chunks */
@@ -83,6 +154,20 @@ typedef struct ppu_s
 
    /* hardware registers */
    uint8 ctrl0, ctrl1, stat, oam_addr;
+
+   /* set whenever OAM changes, cleared by whatever caches sprites */
+   bool oam_dirty;
+
+   /* bumped whenever the palette, OAM or page mapping changes, for
+   ** the copies deferred rendering takes
+   */
+   uint32 pal_gen, oam_gen, page_gen;
+
+   /* OAM indices of the sprites on each visible line, in OAM order,
+   ** see ppu_evaloam
+   */
+   uint8 obj_line[240][PPU_MAXSPRITE];
+   uint8 obj_count[240];
    uint32 vaddr, vaddr_latch;
    int tile_xofs, flipflop;
    int vaddr_inc;
@@ -99,11 +184,17 @@ typedef struct ppu_s
 
    bool strikeflag;
    uint32 strike_cycle;
+   uint8 stat_read; /* what $2002 last read, see ppu_statidle */
+   uint32 line_cycle; /* CPU cycle the current scanline started on */
 
    /* callbacks for naughty mappers */
    ppulatchfunc_t latchfunc;
    ppuvromswitch_t vromswitch;
 
+   /* scanline renderers for the above and the sprite height */
+   void (*renderbg)(struct ppu_s *src_ppu, uint8 *vidbuf);
+   void (*renderoam)(struct ppu_s *src_ppu, uint8 *vidbuf, int scanline);
+
    /* copy of our current palette */
    rgb_t curpal[256];
 
@@ -111,6 +202,27 @@ typedef struct ppu_s
 
    bool vram_present;
    bool drawsprites;
+   int first_line, end_line; /* the lines drawn, see ppu_setvisible */
+
+   /* decoded CHR cache, see ppu_addchr */
+   ppu_chr_t chr[PPU_MAX_CHR];
+   int32 chr_page[8]; /* cache tile number of each pattern page, or -1 */
+   uint8 *chr_cache;
+   uint32 *chr_tag;
+
+   /* palette (col_high) of every tile of the four tables in nametab,
+   ** 960 a table, kept up to date as attribute bytes are written; and
+   ** which table each of pages 8-11 maps, or -1 if it isn't one of
+   ** them (or there's no memory for it)
+   */
+   uint8 *attrib_tiles;
+   int32 attrib_page[4];
+
+   /* background line cache, NULL if not built in or no memory */
+   struct ppu_bgcache_s *bg_cache;
+
+   /* lines recorded for the render thread, NULL if not built in */
+   struct ppu_defer_s *defer;
 } ppu_t;
 
 /* TODO: should use this pointers */
@@ -129,13 +241,27 @@ extern void ppu_mirror(int nt1, int nt2, int nt3, int nt4);
 extern void ppu_setpage(int size, int page_num, uint8 *location);
 extern uint8 *ppu_getpage(int page);
 
+/* CHR and background caches (no-ops when not built in) */
+extern int ppu_addchr(ppu_t *src_ppu, uint8 *base, uint32 size);
+extern void ppu_flushchr(ppu_t *src_ppu);
+extern int ppu_getbgcachehits(bool reset_flag);
+
+/* draw on the render thread (NOFRENDO_DEFERRED_RENDER), -1 if not built in */
+extern int ppu_setdeferred(bool enable);
+
 /* control */
 extern void ppu_reset(int reset_type);
 extern bool ppu_enabled(void);
-extern void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag);
+extern void ppu_scanline(bitmap_t *bmp, int scanline, uint32 cycle, bool draw_flag);
 extern void ppu_endscanline(int scanline);
 extern void ppu_checknmi();
 
+/* draw only lines <first_line> to <end_line> - 1, the rest are cut off
+** by overscan
+*/
+extern void ppu_setvisible(int first_line, int end_line);
+extern int32 ppu_statidle(uint32 cycle, int32 next_line);
+
 extern ppu_t *ppu_create(void);
 extern void ppu_destroy(ppu_t **ppu);
 
@@ -38,7 +38,7 @@
 #define FIRST_STATE_SLOT 0
 #define LAST_STATE_SLOT 9
 
-static int state_slot = FIRST_STATE_SLOT;
+static THREAD_LOCAL int state_slot = FIRST_STATE_SLOT;
 
 /* Set the state-save slot to use (0 - 9) */
 void state_setslot(int slot)
@@ -240,6 +240,7 @@ static void load_baseblock(nes_t *state, SNSS_FILE *snssFile)
 
    memcpy(state->cpu->mem_page[0], snssFile->baseBlock.cpuRam, 0x800);
    memcpy(state->ppu->oam, snssFile->baseBlock.spriteRam, 0x100);
+   state->ppu->oam_dirty = true;
    memcpy(state->ppu->nametab, snssFile->baseBlock.ppuRam, 0x1000);
    memcpy(state->ppu->palette, snssFile->baseBlock.palette, 0x20);
 
@@ -263,6 +264,7 @@ static void load_baseblock(nes_t *state, SNSS_FILE *snssFile)
 
    nes6502_setcontext(state->cpu);
    ppu_setcontext(state->ppu);
+   ppu_flushchr(state->ppu); /* new nametables */
 
    ppu_write(PPU_CTRL0, state->ppu->ctrl0);
    ppu_write(PPU_CTRL1, state->ppu->ctrl1);
@@ -276,6 +278,7 @@ static void load_vramblock(nes_t *state, SNSS_FILE *snssFile)
 
    ASSERT(snssFile->vramBlock.vramSize <= VRAM_8K); /* can't handle more than this! */
    memcpy(state->rominfo->vram, snssFile->vramBlock.vram, snssFile->vramBlock.vramSize);
+   ppu_flushchr(state->ppu);
 }
 
 static void load_sramblock(nes_t *state, SNSS_FILE *snssFile)
@@ -284,6 +287,7 @@ static void load_sramblock(nes_t *state, SNSS_FILE *snssFile)
 
    ASSERT(snssFile->sramBlock.sramSize <= SRAM_8K); /* can't handle more than this! */
    memcpy(state->rominfo->sram, snssFile->sramBlock.sram, snssFile->sramBlock.sramSize);
+   nes6502_flushcode(state->cpu);
 }
 
 static void load_controllerblock(nes_t *state, SNSS_FILE *snssFile)
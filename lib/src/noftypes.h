@@ -40,6 +40,34 @@
 /* Define this if running on little-endian (x86) systems */
 #define HOST_LITTLE_ENDIAN
 
+/* Define this to give each thread its own machine: the CPU, PPU, APU,
+** MMC and everything else in the core become per-thread singletons,
+** so independent instances can run concurrently on separate threads
+*/
+// #define NOFRENDO_MULTI_INSTANCE
+
+/* Define this to draw scanlines on a thread of their own, on the other
+** core: the emulation thread only records each line's PPU state, see
+** ppu_setdeferred.  Needs osd_startthread() and osd_yield().
+*/
+// #define NOFRENDO_DEFERRED_RENDER
+
+/* Define this to hand the screen to the video driver a band of lines
+** at a time, as the PPU finishes them, out of a ring of a few bands
+** instead of a whole frame buffer: see vid_streamline.  No GUI on top.
+*/
+// #define NOFRENDO_LINE_STREAM
+
+/* Define this to have the PPU resolve each line it draws to RGB565
+** once, into a second plane of the primary buffer (see bmp_addrgb565),
+** so the display only scales and copies.  No GUI on top.
+*/
+// #define NOFRENDO_RGB565
+
+#if defined(NOFRENDO_LINE_STREAM) && (defined(NOFRENDO_DOUBLE_FRAMEBUFFER) || defined(NOFRENDO_DEFERRED_RENDER))
+#error "NOFRENDO_LINE_STREAM needs the lines drawn into the primary buffer, in order, on this thread"
+#endif
+
 #ifdef __GNUC__
 #define INLINE static inline
 #define ZERO_LENGTH 0
@@ -51,6 +79,16 @@
 #define ZERO_LENGTH 1
 #endif
 
+#ifndef NOFRENDO_MULTI_INSTANCE
+#define THREAD_LOCAL
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#elif defined(WIN32)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#error "no thread-local storage for NOFRENDO_MULTI_INSTANCE"
+#endif
+
 /* quell stupid compiler warnings */
 #define UNUSED(x) ((x) = (x))
 
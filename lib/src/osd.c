@@ -1,4 +1,6 @@
 /* start rewrite from: https://github.com/espressif/esp32-nesemu.git */
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <freertos/FreeRTOS.h>
@@ -14,10 +16,12 @@
 #include <gui.h>
 #include <log.h>
 #include <nes/nes.h>
+#include <cpu/nes6502.h>
 #include <nes/nes_pal.h>
 #include <nes/nesinput.h>
 #include <nofconfig.h>
 #include <osd.h>
+#include <vid_scale.h>
 
 #include "hw_config.h"
 
@@ -44,22 +48,79 @@ extern void osd_getsoundinfo(sndinfo_t *info);
 
 /* display */
 extern void display_init();
-extern void display_write_frame(const uint8_t *data[]);
+extern void display_write_frame(const uint8_t *data[], int num_dirties, const rect_t *dirty_rects);
+extern void display_write_band(const uint8_t *data[], int first_line, int num_lines);
+extern void display_write_frame16(const uint16_t *data[], int num_dirties, const rect_t *dirty_rects);
+extern void display_write_band16(const uint16_t *data[], int first_line, int num_lines);
+extern void display_set_palette(const uint16_t *palette);
+extern void display_set_window(const rect_t *window);
+extern int display_get_scalemode();
+extern void display_set_scalemode(int mode);
+extern bool display_get_smooth();
+extern void display_set_smooth(bool smooth);
 extern void display_clear();
 
-//This runs on core 0.
-QueueHandle_t vidQueue;
+#ifdef NOFRENDO_LINE_STREAM
+#if VID_STREAM_BANDS < 3
+#error "the line ring needs a band being drawn, one being pushed and one queued"
+#endif
+
+typedef struct
+{
+	bitmap_t *bmp;
+	int first_line, num_lines;
+} band_t;
+
+//The line ring has a band being drawn, one being pushed, and the rest
+//waiting here: with the queue full the emulator waits for the LCD.
+QueueHandle_t bandQueue;
 static void displayTask(void *arg)
 {
-	bitmap_t *bmp = NULL;
+	band_t band;
 	while (1)
 	{
-		// xQueueReceive(vidQueue, &bmp, portMAX_DELAY); //skip one frame to drop to 30
-		xQueueReceive(vidQueue, &bmp, portMAX_DELAY);
-		display_write_frame((const uint8_t **)bmp->line);
+		xQueueReceive(bandQueue, &band, portMAX_DELAY);
+#ifdef NOFRENDO_RGB565
+		display_write_band16((const uint16_t **)band.bmp->line16, band.first_line, band.num_lines);
+#else  /* !NOFRENDO_RGB565 */
+		display_write_band((const uint8_t **)band.bmp->line, band.first_line, band.num_lines);
+#endif /* !NOFRENDO_RGB565 */
 	}
 }
 
+static void stream_band(bitmap_t *bmp, int first_line, int num_lines)
+{
+	band_t band = {bmp, first_line, num_lines};
+	xQueueSend(bandQueue, &band, portMAX_DELAY);
+}
+#else  /* !NOFRENDO_LINE_STREAM */
+//This runs on core 0. Finished frames come out of the video driver's
+//pool (vid_takeframe), newest first: the emulator never waits for the
+//LCD, and this never reads a frame being drawn. custom_blit only wakes
+//it up; frames flushed over while it was busy are dropped. Only the
+//bands that changed since the last frame shown go out.
+static TaskHandle_t displayHandle = NULL;
+static void displayTask(void *arg)
+{
+	bitmap_t *bmp;
+	rect_t dirty_rects[VID_MAX_DIRTIES];
+	int num_dirties;
+	while (1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		bmp = vid_takeframe();
+		if (NULL == bmp)
+			continue;
+		num_dirties = vid_getdirties(dirty_rects);
+#ifdef NOFRENDO_RGB565
+		display_write_frame16((const uint16_t **)bmp->line16, num_dirties, dirty_rects);
+#else  /* !NOFRENDO_RGB565 */
+		display_write_frame((const uint8_t **)bmp->line, num_dirties, dirty_rects);
+#endif /* !NOFRENDO_RGB565 */
+	}
+}
+#endif /* !NOFRENDO_LINE_STREAM */
+
 /* get info */
 static char fb[1]; //dummy
 bitmap_t *myBitmap;
@@ -94,6 +155,8 @@ static void set_palette(rgb_t *pal)
 		//myPalette[i]=(c>>8)|((c&0xff)<<8);
 		myPalette[i] = c;
 	}
+
+	display_set_palette(myPalette);
 }
 
 /* clear all frames to a particular color */
@@ -119,10 +182,20 @@ static void free_write(int num_dirties, rect_t *dirty_rects)
 
 static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects)
 {
-	xQueueSend(vidQueue, &bmp, 0);
+#ifndef NOFRENDO_LINE_STREAM
+	//streamed out a band at a time already
+	if (displayHandle)
+		xTaskNotifyGive(displayHandle);
+#endif /* !NOFRENDO_LINE_STREAM */
 	do_audio_frame();
 }
 
+/* overscan changed, the display scales what's left up */
+static void set_window(const rect_t *window)
+{
+	display_set_window(window);
+}
+
 viddriver_t sdlDriver =
 	{
 		"Simple DirectMedia Layer", /* name */
@@ -134,7 +207,13 @@ viddriver_t sdlDriver =
 		lock_write,					/* lock_write */
 		free_write,					/* free_write */
 		custom_blit,				/* custom_blit */
-		false						/* invalidate flag */
+		false,						/* invalidate flag */
+#ifdef NOFRENDO_LINE_STREAM
+		stream_band,				/* stream_band */
+#else  /* !NOFRENDO_LINE_STREAM */
+		NULL,						/* stream_band */
+#endif /* !NOFRENDO_LINE_STREAM */
+		set_window					/* set_window */
 };
 
 void osd_getvideoinfo(vidinfo_t *info)
@@ -148,10 +227,53 @@ void osd_getvideoinfo(vidinfo_t *info)
 extern void controller_init();
 extern uint32_t controller_read_input();
 
+/* CPU profile goes out over the serial console, framed by its own
+** "N6PF" header so host/profsym can pick it out of the log
+*/
+static void osd_profwrite(const uint8 *data, int len)
+{
+	fwrite(data, 1, len, stdout);
+}
+
+static void osd_dumpprofile(int code)
+{
+	uint32 produced, displayed, dropped;
+
+	if (INP_STATE_MAKE != code)
+		return;
+
+	vid_getframestats(&produced, &displayed, &dropped);
+	printf("\nFrames: %u produced, %u displayed, %u dropped\n", produced, displayed, dropped);
+
+	printf("\nCPU profile:\n");
+	if (nes6502_profdump(osd_profwrite, true) < 0)
+		printf("not built in, define NES6502_PROFILE in nes6502.h\n");
+	printf("\n");
+	fflush(stdout);
+}
+
+//Next of the LCD's scaling modes, see vid_scale.h: each nearest, then smooth
+static void osd_nextscalemode(int code)
+{
+	if (INP_STATE_MAKE != code)
+		return;
+
+	if (false == display_get_smooth())
+	{
+		display_set_smooth(true);
+		return;
+	}
+
+	display_set_smooth(false);
+	display_set_scalemode((display_get_scalemode() + 1) % VIDSCALE_MODES);
+}
+
 static void osd_initinput()
 {
 	gui_togglefps();
 	controller_init();
+	event_set(event_osd_1, osd_dumpprofile);
+	event_set(event_osd_2, osd_nextscalemode);
 }
 
 static void osd_freeinput(void)
@@ -163,7 +285,7 @@ void osd_getinput(void)
 	const int ev[32] = {
 		event_joypad1_up, event_joypad1_down, event_joypad1_left, event_joypad1_right,
 		event_joypad1_select, event_joypad1_start, event_joypad1_a, event_joypad1_b,
-		event_state_save, event_state_load, 0, 0,
+		event_state_save, event_state_load, event_osd_1, event_osd_2,
 		0, 0, 0, 0,
 		0, 0, 0, 0,
 		0, 0, 0, 0,
@@ -194,6 +316,48 @@ void osd_getmouse(int *x, int *y, int *button)
 }
 
 /* init / shutdown */
+#ifdef NOFRENDO_DEFERRED_RENDER
+typedef struct
+{
+	void (*func)(void *arg);
+	void *arg;
+} thread_start_t;
+
+//A task can't return, so this ends it once func has.
+static void threadTask(void *start_arg)
+{
+	thread_start_t start = *(thread_start_t *)start_arg;
+
+	free(start_arg);
+	start.func(start.arg);
+	vTaskDelete(NULL);
+}
+
+//Core 0, next to displayTask: the emulator itself runs on core 1.
+int osd_startthread(void (*func)(void *arg), void *arg)
+{
+	thread_start_t *start = malloc(sizeof(thread_start_t));
+
+	if (NULL == start)
+		return -1;
+
+	start->func = func;
+	start->arg = arg;
+	if (pdPASS != xTaskCreatePinnedToCore(&threadTask, "renderTask", 4096, start, 0, NULL, 0))
+	{
+		free(start);
+		return -1;
+	}
+
+	return 0;
+}
+
+void osd_yield(void)
+{
+	taskYIELD();
+}
+#endif /* NOFRENDO_DEFERRED_RENDER */
+
 static int logprint(const char *string)
 {
 	return printf("%s", string);
@@ -207,10 +371,14 @@ int osd_init()
 		return -1;
 
 	display_init();
-	vidQueue = xQueueCreate(1, sizeof(bitmap_t *));
+#ifdef NOFRENDO_LINE_STREAM
+	bandQueue = xQueueCreate(VID_STREAM_BANDS - 2, sizeof(band_t));
 	
 	// xTaskCreatePinnedToCore(&displayTask, "displayTask", 2048, NULL, 5, NULL, 1);
 	xTaskCreatePinnedToCore(&displayTask, "displayTask", 2048, NULL, 0, NULL, 0);
+#else  /* !NOFRENDO_LINE_STREAM */
+	xTaskCreatePinnedToCore(&displayTask, "displayTask", 2048, NULL, 0, &displayHandle, 0);
+#endif /* !NOFRENDO_LINE_STREAM */
 	osd_initinput();
 	return 0;
 }
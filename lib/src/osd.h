@@ -58,6 +58,16 @@ extern void *mem_alloc(int size, bool prefer_fast_memory);
 /* audio */
 extern void osd_setsound(void (*playfunc)(void *buffer, int size));
 
+#ifdef NOFRENDO_DEFERRED_RENDER
+/* run <func> on a thread of its own, on another core if there is one,
+** until it returns; 0 if it started
+*/
+extern int osd_startthread(void (*func)(void *arg), void *arg);
+
+/* let whatever else wants this core run, while spinning on a thread */
+extern void osd_yield(void);
+#endif /* NOFRENDO_DEFERRED_RENDER */
+
 #ifndef NSF_PLAYER
 #include "noftypes.h"
 #include "vid_drv.h"
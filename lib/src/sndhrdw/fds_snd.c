@@ -27,7 +27,7 @@
 #include "nes_apu.h"
 #include "fds_snd.h"
 
-static int32 fds_incsize = 0;
+static THREAD_LOCAL int32 fds_incsize = 0;
 
 /* mix sound channels together */
 static int32 fds_process(void)
@@ -42,17 +42,17 @@
 #define APU_DMC_OUTPUT ((apu.dmc.output_vol + apu.dmc.output_vol + apu.dmc.output_vol) >> 2)
 
 /* active APU */
-static apu_t apu;
+static THREAD_LOCAL apu_t apu;
 
 /* look up table madness */
-static int32 decay_lut[16];
-static int vbl_lut[32];
-static int trilength_lut[128];
+static THREAD_LOCAL int32 decay_lut[16];
+static THREAD_LOCAL int vbl_lut[32];
+static THREAD_LOCAL int trilength_lut[128];
 
 /* noise lookups for both modes */
 #ifndef REALTIME_NOISE
-static int8 noise_long_lut[APU_NOISE_32K];
-static int8 noise_short_lut[APU_NOISE_93];
+static THREAD_LOCAL int8 noise_long_lut[APU_NOISE_32K];
+static THREAD_LOCAL int8 noise_short_lut[APU_NOISE_93];
 #endif /* !REALTIME_NOISE */
 
 /* vblank length table used for rectangles, triangle, noise */
@@ -120,7 +120,7 @@ void apu_setchan(int chan, bool enabled)
 #ifdef REALTIME_NOISE
 INLINE int8 shift_register15(uint8 xor_tap)
 {
-   static int sreg = 0x4000;
+   static THREAD_LOCAL int sreg = 0x4000;
    int bit0, tap, bit14;
 
    bit0 = sreg & 1;
@@ -133,7 +133,7 @@ INLINE int8 shift_register15(uint8 xor_tap)
 #else  /* !REALTIME_NOISE */
 static void shift_register15(int8 *buf, int count)
 {
-   static int sreg = 0x4000;
+   static THREAD_LOCAL int sreg = 0x4000;
    int bit0, bit1, bit6, bit14;
 
    if (count == APU_NOISE_93)
@@ -862,7 +862,7 @@ uint8 apu_read(uint32 address)
 
 void apu_process(void *buffer, int num_samples)
 {
-   static int32 prev_sample = 0;
+   static THREAD_LOCAL int32 prev_sample = 0;
 
    int16 *buf16;
    uint8 *buf8;
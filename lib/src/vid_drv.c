@@ -24,6 +24,7 @@
 */
 
 #include <string.h>
+#include <stdatomic.h>
 
 #include "noftypes.h"
 #include "log.h"
@@ -33,16 +34,54 @@
 #include "osd.h"
 
 /* hardware surface */
-static bitmap_t *screen = NULL;
+static THREAD_LOCAL bitmap_t *screen = NULL;
 
 /* primary / backbuffer surfaces */
 #ifdef NOFRENDO_DOUBLE_FRAMEBUFFER
-static bitmap_t *primary_buffer = NULL, *back_buffer = NULL;
+static THREAD_LOCAL bitmap_t *primary_buffer = NULL, *back_buffer = NULL;
 #else /* !NOFRENDO_DOUBLE_FRAMEBUFFER */
-static bitmap_t *primary_buffer = NULL;
+static THREAD_LOCAL bitmap_t *primary_buffer = NULL;
 #endif /* !NOFRENDO_DOUBLE_FRAMEBUFFER */
 
-static viddriver_t *driver = NULL;
+static THREAD_LOCAL viddriver_t *driver = NULL;
+
+/* what the primary buffer's lines go through for its RGB565 plane */
+static THREAD_LOCAL uint16 rgb565[256];
+
+/* bumped with each new palette, which makes every band dirty */
+static THREAD_LOCAL uint32 palette_serial = 0;
+
+/* The frames handed off: the primary buffer is frame[drawing], the
+** display thread's is frame[reading], and <between> is the index of the
+** third, VID_FRESH while nobody has taken it.  Each side only swaps
+** its own for the one between, so neither waits and neither ever has
+** the other's.  With only the one buffer, they're all it.
+*/
+#define VID_FRESH 0x100
+
+static THREAD_LOCAL struct
+{
+   bitmap_t *buffer[VID_FRAMES];
+   bitmap_t *frame[3];
+   int drawing, reading;
+   atomic_int between;
+   atomic_uint produced, displayed, dropped;
+
+   /* each frame's band hashes, and whether it's all to be drawn; and
+   ** the hashes of the frame flushed last, and of the one taken last
+   */
+   uint32 hash[3][VID_MAX_DIRTIES];
+   bool full[3];
+   uint32 flushed_hash[VID_MAX_DIRTIES], shown_hash[VID_MAX_DIRTIES];
+   bool flushed_valid, shown_valid;
+} pool;
+
+/* overscan, and the part of the primary buffer it leaves showing */
+static THREAD_LOCAL struct
+{
+   int top, bottom, left, right;
+} overscan = {VID_OVERSCAN_TOP, VID_OVERSCAN_BOTTOM, VID_OVERSCAN_LEFT, VID_OVERSCAN_RIGHT};
+static THREAD_LOCAL rect_t window;
 
 /* fast automagic loop unrolling */
 #define DUFFS_DEVICE(transfer, count)   \
@@ -155,9 +194,21 @@ bitmap_t *vid_getbuffer(void)
 
 void vid_setpalette(rgb_t *p)
 {
+   uint16 c;
+   int i;
+
    ASSERT(driver);
    ASSERT(p);
 
+   palette_serial++;
+
+   /* as osd.c makes it, then swapped for the LCD bus */
+   for (i = 0; i < 256; i++)
+   {
+      c = (p[i].b >> 3) + ((p[i].g >> 2) << 5) + ((p[i].r >> 3) << 11);
+      rgb565[i] = (uint16)((c >> 8) | (c << 8));
+   }
+
    driver->set_palette(p);
 }
 
@@ -311,82 +362,178 @@ static void vid_blitscreen(int num_dirties, rect_t *dirty_rects)
       driver->free_write(num_dirties, dirty_rects);
 }
 
-/* TODO: this code is sickly */
-
-#define CHUNK_WIDTH 256
-#define CHUNK_HEIGHT 16
-#define MAX_DIRTIES ((256 / CHUNK_WIDTH) * (240 / CHUNK_HEIGHT))
-#define DIRTY_CUTOFF ((3 * MAX_DIRTIES) / 4)
+/* Dirty bands: each band of VID_DIRTY_BAND lines of a frame is hashed
+** as it's flushed, seeded with the palette serial, and compared with
+** the same band of the frame flushed before it (for vid_blitscreen and
+** custom_blit) and of the frame taken before it (vid_getdirties).
+** Past DIRTY_CUTOFF of them, it's quicker to draw the lot.
+*/
+#define DIRTY_CUTOFF ((3 * VID_MAX_DIRTIES) / 4)
 
-#if 0
-INLINE int calc_dirties(rect_t *list)
+#ifndef NOFRENDO_LINE_STREAM
+/* the line ring doesn't keep a frame to hash */
+static void hash_bands(const bitmap_t *bmp, uint32 *hash)
 {
-   bool dirty;
-   int num_dirties = 0;
-   int i = 0, j, line_offset = 0;
-   int iterations = primary_buffer->height / CHUNK_HEIGHT;
+   int band, line, x;
 
-   for (i = 0; i < iterations; i++)
+   ASSERT(bmp->height <= VID_MAX_DIRTIES * VID_DIRTY_BAND);
+
+   for (band = 0, line = 0; line < bmp->height; band++)
    {
-      dirty = false;
-
-      j = line_offset;
-      DUFFS_DEVICE(
-      { 
-         if (vid_memcmp(back_buffer->line[j], primary_buffer->line[j], 
-                        CHUNK_WIDTH))
-         { 
-            dirty = true; 
-            break; 
-         } 
-
-         j++; 
-      }, CHUNK_HEIGHT);
-
-      if (true == dirty)
+      int end_line = (line + VID_DIRTY_BAND < bmp->height) ? line + VID_DIRTY_BAND : bmp->height;
+      uint32 h = 2166136261u ^ palette_serial;
+
+      /* FNV-1a a word at a time: every step is one to one, so a band
+      ** with one word changed never hashes the same
+      */
+      for (; line < end_line; line++)
       {
-         list->h = CHUNK_HEIGHT;
-         list->w = CHUNK_WIDTH;
-         list->x = 0;
-         list->y = line_offset;
-         list++;
-
-         /* totally arbitrary at this point */
-         if (++num_dirties > DIRTY_CUTOFF)
-            return -1;
+         const uint32 *p = (const uint32 *)bmp->line[line];
+
+         for (x = 0; x < bmp->width / 4; x++)
+         {
+            h ^= p[x];
+            h *= 16777619;
+         }
       }
 
-      line_offset += CHUNK_HEIGHT;
+      hash[band] = h;
+   }
+}
+#endif /* !NOFRENDO_LINE_STREAM */
+
+static int calc_dirties(const bitmap_t *bmp, const uint32 *hash, const uint32 *last_hash,
+                        rect_t *list)
+{
+   int num_dirties = 0, band, line;
+
+   for (band = 0, line = 0; line < bmp->height; band++, line += VID_DIRTY_BAND)
+   {
+      if (hash[band] == last_hash[band])
+         continue;
+
+      list->x = 0;
+      list->y = line;
+      list->w = bmp->width;
+      list->h = (line + VID_DIRTY_BAND < bmp->height) ? VID_DIRTY_BAND : bmp->height - line;
+      list++;
+
+      if (++num_dirties > DIRTY_CUTOFF)
+         return -1;
    }
 
    return num_dirties;
 }
-#endif
 
-void vid_flush(void)
+/* the finished frame goes between, and the next is drawn into what
+** was there
+*/
+static bitmap_t *vid_handoff(void)
 {
-   bitmap_t *temp;
-   int num_dirties;
-   rect_t dirty_rects[MAX_DIRTIES];
+   bitmap_t *finished = primary_buffer;
+   int old;
+
+   old = atomic_exchange(&pool.between, pool.drawing | VID_FRESH);
+   if (old & VID_FRESH)
+      atomic_fetch_add(&pool.dropped, 1);
+   atomic_fetch_add(&pool.produced, 1);
+
+   pool.drawing = old & ~VID_FRESH;
+#if VID_FRAMES > 1
+   primary_buffer = pool.frame[pool.drawing];
+#else  /* VID_FRAMES == 1 */
+   /* whichever the double frame buffer has up */
+   pool.frame[0] = pool.frame[1] = pool.frame[2] = finished;
+#endif /* VID_FRAMES == 1 */
+
+   return finished;
+}
 
-   ASSERT(driver);
+/* the primary buffer's bands against the frame flushed before it */
+static int vid_flushdirties(rect_t *dirty_rects)
+{
+#ifdef NOFRENDO_LINE_STREAM
+   /* the ring only holds the last few bands */
+   UNUSED(dirty_rects);
+   pool.full[pool.drawing] = true;
+   return -1;
+#else  /* !NOFRENDO_LINE_STREAM */
+   uint32 *hash = pool.hash[pool.drawing];
+   int num_dirties = -1;
+   bool full = true;
+
+   hash_bands(primary_buffer, hash);
 
    if (true == driver->invalidate)
    {
       driver->invalidate = false;
-      num_dirties = -1;
    }
-   else
+   else if (pool.flushed_valid)
    {
-      //num_dirties = calc_dirties(dirty_rects);
-      num_dirties = -1;
+      num_dirties = calc_dirties(primary_buffer, hash, pool.flushed_hash, dirty_rects);
+      full = false;
    }
 
-   if (driver->custom_blit)
-      driver->custom_blit(primary_buffer, num_dirties, dirty_rects);
-   else
+   /* an invalidated frame is all to be drawn on the display too */
+   pool.full[pool.drawing] = full;
+   memcpy(pool.flushed_hash, hash, sizeof(pool.flushed_hash));
+   pool.flushed_valid = true;
+
+   return num_dirties;
+#endif /* !NOFRENDO_LINE_STREAM */
+}
+
+bitmap_t *vid_takeframe(void)
+{
+   if (0 == (atomic_load(&pool.between) & VID_FRESH))
+      return NULL;
+
+   /* only vid_handoff touches it in between, and keeps it fresh */
+   pool.reading = atomic_exchange(&pool.between, pool.reading) & ~VID_FRESH;
+   atomic_fetch_add(&pool.displayed, 1);
+
+   return pool.frame[pool.reading];
+}
+
+int vid_getdirties(rect_t *dirty_rects)
+{
+   const uint32 *hash = pool.hash[pool.reading];
+   int num_dirties = -1;
+
+   if (false == pool.full[pool.reading] && pool.shown_valid)
+      num_dirties = calc_dirties(pool.frame[pool.reading], hash, pool.shown_hash, dirty_rects);
+
+   memcpy(pool.shown_hash, hash, sizeof(pool.shown_hash));
+   pool.shown_valid = true;
+
+   return num_dirties;
+}
+
+void vid_getframestats(uint32 *produced, uint32 *displayed, uint32 *dropped)
+{
+   *produced = atomic_load(&pool.produced);
+   *displayed = atomic_load(&pool.displayed);
+   *dropped = atomic_load(&pool.dropped);
+}
+
+void vid_flush(void)
+{
+   bitmap_t *temp, *finished;
+   int num_dirties;
+   rect_t dirty_rects[VID_MAX_DIRTIES];
+
+   ASSERT(driver);
+
+   num_dirties = vid_flushdirties(dirty_rects);
+
+   if (NULL == driver->custom_blit)
       vid_blitscreen(num_dirties, dirty_rects);
 
+   finished = vid_handoff();
+
+   if (driver->custom_blit)
+      driver->custom_blit(finished, num_dirties, dirty_rects);
+
 #ifdef NOFRENDO_DOUBLE_FRAMEBUFFER
    /* Swap pointers to the main/back buffers */
    temp = back_buffer;
@@ -395,36 +542,138 @@ void vid_flush(void)
 #endif /* NOFRENDO_DOUBLE_FRAMEBUFFER */
 }
 
+#ifdef NOFRENDO_LINE_STREAM
+/* <line> of the primary buffer is drawn: pass each band on as soon
+** as its last line is, the bottom one short if need be
+*/
+void vid_streamline(int line)
+{
+   int first_line;
+
+   ASSERT(driver);
+
+   if (line >= primary_buffer->height ||
+       (VID_STREAM_BAND - 1 != line % VID_STREAM_BAND && primary_buffer->height - 1 != line))
+      return;
+
+   first_line = line - line % VID_STREAM_BAND;
+   if (driver->stream_band)
+      driver->stream_band(primary_buffer, first_line, line + 1 - first_line);
+}
+#endif /* NOFRENDO_LINE_STREAM */
+
+/* work the window out again, and tell the driver */
+static void vid_setwindow(void)
+{
+   if (NULL == primary_buffer)
+      return;
+
+   window.x = overscan.left;
+   window.y = overscan.top;
+   window.w = primary_buffer->width - overscan.left - overscan.right;
+   window.h = primary_buffer->height - overscan.top - overscan.bottom;
+
+   if (driver && driver->set_window)
+      driver->set_window(&window);
+}
+
+int vid_setoverscan(int top, int bottom, int left, int right)
+{
+   if (top < 0 || top > VID_OVERSCAN_MAX || bottom < 0 || bottom > VID_OVERSCAN_MAX ||
+       left < 0 || left > VID_OVERSCAN_MAX || right < 0 || right > VID_OVERSCAN_MAX)
+      return -1;
+
+   overscan.top = top;
+   overscan.bottom = bottom;
+   overscan.left = left;
+   overscan.right = right;
+   vid_setwindow();
+
+   return 0;
+}
+
+const rect_t *vid_getwindow(void)
+{
+   return &window;
+}
+
+static void vid_freeframes(void)
+{
+   int i;
+
+   for (i = 0; i < VID_FRAMES; i++)
+   {
+      if (NULL != pool.buffer[i])
+         bmp_destroy(&pool.buffer[i]);
+   }
+
+   primary_buffer = NULL;
+}
+
 /* emulated machine tells us which resolution it wants */
 int vid_setmode(int width, int height)
 {
-   if (NULL != primary_buffer)
-      bmp_destroy(&primary_buffer);
+   int i;
+
+   vid_freeframes();
 #ifdef NOFRENDO_DOUBLE_FRAMEBUFFER
    if (NULL != back_buffer)
       bmp_destroy(&back_buffer);
 #endif /* NOFRENDO_DOUBLE_FRAMEBUFFER */
 
-   primary_buffer = bmp_create(width, height, 0); /* no overdraw */
-   if (NULL == primary_buffer)
-      return -1;
+   for (i = 0; i < VID_FRAMES; i++)
+   {
+#ifdef NOFRENDO_LINE_STREAM
+      /* only the lines still to be streamed out, and room for the PPU's
+      ** scrolled tiles either side
+      */
+      pool.buffer[i] = bmp_createring(width, height, VID_STREAM_BAND * VID_STREAM_BANDS, 8);
+#else  /* !NOFRENDO_LINE_STREAM */
+      pool.buffer[i] = bmp_create(width, height, 8); /* the PPU's scrolled tiles */
+#endif /* !NOFRENDO_LINE_STREAM */
+
+#ifdef NOFRENDO_RGB565
+      if (pool.buffer[i] && bmp_addrgb565(pool.buffer[i], rgb565))
+         bmp_destroy(&pool.buffer[i]);
+#endif /* NOFRENDO_RGB565 */
+
+      if (NULL == pool.buffer[i])
+      {
+         vid_freeframes();
+         return -1;
+      }
+
+      bmp_clear(pool.buffer[i], GUI_BLACK);
+   }
+
+   /* drawn, between, and read */
+   for (i = 0; i < 3; i++)
+      pool.frame[i] = pool.buffer[i % VID_FRAMES];
+   pool.drawing = 0;
+   pool.reading = 2;
+   atomic_store(&pool.between, 1);
+   pool.flushed_valid = false;
+   pool.shown_valid = false;
+   primary_buffer = pool.frame[0];
 
 #ifdef NOFRENDO_DOUBLE_FRAMEBUFFER
    /* Create our backbuffer */
-   back_buffer = bmp_create(width, height, 0); /* no overdraw */
+   back_buffer = bmp_create(width, height, 8);
+#ifdef NOFRENDO_RGB565
+   if (back_buffer && bmp_addrgb565(back_buffer, rgb565))
+      bmp_destroy(&back_buffer);
+#endif /* NOFRENDO_RGB565 */
    if (NULL == back_buffer)
    {
-      bmp_destroy(&primary_buffer);
+      vid_freeframes();
       return -1;
    }
-#endif /* NOFRENDO_DOUBLE_FRAMEBUFFER */
 
-   bmp_clear(primary_buffer, GUI_BLACK);
-
-#ifdef NOFRENDO_DOUBLE_FRAMEBUFFER
    bmp_clear(back_buffer, GUI_BLACK);
 #endif /* NOFRENDO_DOUBLE_FRAMEBUFFER */
 
+   vid_setwindow();
+
    return 0;
 }
 
@@ -476,8 +725,7 @@ void vid_shutdown(void)
    if (NULL == driver)
       return;
 
-   if (NULL != primary_buffer)
-      bmp_destroy(&primary_buffer);
+   vid_freeframes();
 
 #ifdef NOFRENDO_DOUBLE_FRAMEBUFFER
    if (NULL != back_buffer)
@@ -28,6 +28,71 @@
 
 #include "bitmap.h"
 
+/* NOFRENDO_LINE_STREAM: lines handed to the driver at a time, and how
+** many of those bands the line ring holds
+*/
+#ifndef VID_STREAM_BAND
+#define VID_STREAM_BAND 8
+#endif
+
+#ifndef VID_STREAM_BANDS
+#define VID_STREAM_BANDS 4
+#endif
+
+/* Overscan: lines and columns cut off each edge of the picture, as a
+** CRT's bezel did -- 8 lines top and bottom is what most games expect
+** and some leave garbage in.  The PPU doesn't draw lines cut off, the
+** driver scales up what's left.  vid_setoverscan changes it at run
+** time, each edge up to VID_OVERSCAN_MAX.
+*/
+#ifndef VID_OVERSCAN_TOP
+#define VID_OVERSCAN_TOP 0
+#endif
+
+#ifndef VID_OVERSCAN_BOTTOM
+#define VID_OVERSCAN_BOTTOM 0
+#endif
+
+#ifndef VID_OVERSCAN_LEFT
+#define VID_OVERSCAN_LEFT 0
+#endif
+
+#ifndef VID_OVERSCAN_RIGHT
+#define VID_OVERSCAN_RIGHT 0
+#endif
+
+#define VID_OVERSCAN_MAX 16
+
+/* Frame buffers: 3 hands finished frames to the driver's own thread
+** without either ever waiting, see vid_takeframe; 1 has it read the
+** one the emulator draws the next frame into.  A line ring, the
+** double frame buffer and more than one machine make do with 1.
+*/
+#ifndef VID_FRAMES
+#if defined(NOFRENDO_LINE_STREAM) || defined(NOFRENDO_DOUBLE_FRAMEBUFFER) || defined(NOFRENDO_MULTI_INSTANCE)
+#define VID_FRAMES 1
+#else
+#define VID_FRAMES 3
+#endif
+#endif
+
+#if VID_FRAMES != 1 && VID_FRAMES != 3
+#error "VID_FRAMES is 1, or 3 for one drawn, one shown and one in between"
+#endif
+
+#if VID_FRAMES > 1 && (defined(NOFRENDO_LINE_STREAM) || defined(NOFRENDO_DOUBLE_FRAMEBUFFER) || defined(NOFRENDO_MULTI_INSTANCE))
+#error "VID_FRAMES 3 needs whole frames drawn straight into the primary buffer, by one machine"
+#endif
+
+/* Lines in each band of a frame checked for changes since the frame
+** before, and so at most how many dirty rectangles there are
+*/
+#ifndef VID_DIRTY_BAND
+#define VID_DIRTY_BAND 16
+#endif
+
+#define VID_MAX_DIRTIES ((240 + VID_DIRTY_BAND - 1) / VID_DIRTY_BAND)
+
 typedef struct viddriver_s
 {
    /* name of driver */
@@ -46,11 +111,24 @@ typedef struct viddriver_s
    bitmap_t *(*lock_write)(void);
    /* free a locked surface (can be NULL) */
    void (*free_write)(int num_dirties, rect_t *dirty_rects);
-   /* custom blitter - num_dirties == -1 if full blit required */
+   /* custom blitter - num_dirties == -1 if full blit required; <primary>
+   ** may be drawn over from now on, a thread of the driver's own takes
+   ** frames with vid_takeframe instead
+   */
    void (*custom_blit)(bitmap_t *primary, int num_dirties,
                        rect_t *dirty_rects);
    /* immediately invalidate the buffer, i.e. full redraw */
    bool invalidate;
+   /* lines <first_line> on of the primary buffer are finished
+   ** (NOFRENDO_LINE_STREAM, can be NULL) - they're drawn over again
+   ** VID_STREAM_BAND * VID_STREAM_BANDS lines later, so must be
+   ** copied out or pushed by then
+   */
+   void (*stream_band)(bitmap_t *primary, int first_line, int num_lines);
+   /* the part of the primary buffer that's shown has changed, see
+   ** vid_setoverscan (can be NULL)
+   */
+   void (*set_window)(const rect_t *window);
 } viddriver_t;
 
 /* TODO: filth */
@@ -66,6 +144,29 @@ extern void vid_blit(bitmap_t *bitmap, int src_x, int src_y, int dest_x,
                      int dest_y, int blit_width, int blit_height);
 extern void vid_flush(void);
 
+#ifdef NOFRENDO_LINE_STREAM
+extern void vid_streamline(int line);
+#endif /* NOFRENDO_LINE_STREAM */
+
+/* on the driver's display thread: the newest frame flushed since the
+** last call, NULL if none, which is left alone until the next call;
+** and how many frames were flushed, taken, and flushed over before
+** anyone took them
+*/
+extern bitmap_t *vid_takeframe(void);
+
+/* then the bands of it that changed since the frame taken before it,
+** in order from the top, or -1 if it's all to be drawn
+*/
+extern int vid_getdirties(rect_t *dirty_rects);
+extern void vid_getframestats(uint32 *produced, uint32 *displayed, uint32 *dropped);
+
+/* lines and columns cut off each edge, -1 if too many; and the part
+** of the primary buffer that leaves
+*/
+extern int vid_setoverscan(int top, int bottom, int left, int right);
+extern const rect_t *vid_getwindow(void);
+
 #endif /* _VID_DRV_H_ */
 
 /*
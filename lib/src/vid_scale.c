@@ -0,0 +1,334 @@
+/*
+** vid_scale.c
+**
+** 8-bit NES lines to the LCD's RGB565, scaled nearest neighbour or
+** smooth
+*/
+
+#include <string.h>
+
+#include "noftypes.h"
+#include "vid_scale.h"
+
+/* Upscaling by up to 2, each source pixel makes 1 or 2 columns: 4 of
+** them at a time, each written twice and stepped over by how many it
+** makes, so there is no per column gather.  The last group's second
+** write can land one column past it, where the per column tail draws
+** over it.  <pixel(s)> is the RGB565 of source pixel *<s>.
+*/
+#define VIDSCALE_EXPAND(type, pixel) \
+{ \
+   const type *s = src + scale->src_x; \
+   uint16 *d = dest; \
+   int g; \
+   for (g = 0; g < scale->groups; g++, s += 4) \
+   { \
+      uint32 mask = scale->doubled[g]; \
+      uint16 c; \
+      c = pixel(s[0]); d[0] = c; d[1] = c; d += 1 + (mask & 1); \
+      c = pixel(s[1]); d[0] = c; d[1] = c; d += 1 + ((mask >> 1) & 1); \
+      c = pixel(s[2]); d[0] = c; d[1] = c; d += 1 + ((mask >> 2) & 1); \
+      c = pixel(s[3]); d[0] = c; d[1] = c; d += 1 + ((mask >> 3) & 1); \
+   } \
+}
+
+/* the channels of an RGB565 pixel spread out over a word, green to the
+** top half, with room above each for 5 bits of weight
+*/
+#define VIDSCALE_FIELDS 0x07E0F81F
+#define VIDSCALE_SPREAD(c) (((c) | ((uint32)(c) << 16)) & VIDSCALE_FIELDS)
+#define VIDSCALE_SWAP(c) ((uint16)(((c) >> 8) | ((c) << 8)))
+
+/* <w> of VIDSCALE_BLEND_ONE of spread pixel <b> and the rest of <a>,
+** all 3 channels with one multiply: the borrows of a negative channel
+** difference only reach the gap above it, which the mask drops.  Back
+** to RGB565 with the bytes swapped for the bus
+*/
+INLINE uint16 vidscale_blend(uint32 a, uint32 b, uint32 w)
+{
+   uint32 c = ((((b - a) * w) >> 5) + a) & VIDSCALE_FIELDS;
+
+   c = (c | (c >> 16)) & 0xFFFF;
+   return VIDSCALE_SWAP(c);
+}
+
+int vidscale_init(vidscale_t *scale, int src_x, int src_y,
+                  int src_width, int src_height, int width, int height)
+{
+   int x, y, line;
+   bool blended = false;
+
+   if (width <= 0 || width > VIDSCALE_MAX_WIDTH ||
+       height <= 0 || height > VIDSCALE_MAX_HEIGHT ||
+       src_x < 0 || src_width <= 0 || src_y < 0 || src_height <= 0 ||
+       src_y + src_height > VIDSCALE_MAX_LINES)
+      return -1;
+
+   scale->src_x = src_x;
+   scale->src_y = src_y;
+   scale->src_width = src_width;
+   scale->src_height = src_height;
+   scale->x = 0;
+   scale->y = 0;
+   scale->width = width;
+   scale->height = height;
+
+   for (x = 0; x < width; x++)
+      scale->col[x] = src_x + (x * src_width) / width;
+
+   /* which source pixels make 2 columns, in groups of 4 but for at
+   ** least one left to the tail; no groups if any make more or none
+   */
+   scale->groups = (src_width - 1) / 4;
+   if (width < src_width || width > 2 * src_width || scale->groups > VIDSCALE_MAX_WIDTH / 4)
+      scale->groups = 0;
+
+   memset(scale->doubled, 0, sizeof(scale->doubled));
+   for (x = 1; x < width; x++)
+   {
+      int pixel = scale->col[x] - src_x;
+
+      if (scale->col[x] == scale->col[x - 1] && pixel < 4 * scale->groups)
+         scale->doubled[pixel / 4] |= 1 << (pixel % 4);
+   }
+
+   scale->tail_x = 0;
+   while (scale->tail_x < width && scale->col[scale->tail_x] < src_x + 4 * scale->groups)
+      scale->tail_x++;
+
+   /* how far into the next source pixel each column's span reaches,
+   ** as a share of the span; a span is under a source pixel wide when
+   ** growing, so it covers 2 at most
+   */
+   memset(scale->blend, 0, sizeof(scale->blend));
+   scale->blend_end = 0;
+   for (x = 0; x < width; x++)
+   {
+      int end = (x + 1) * src_width;
+      int next = ((x * src_width) / width + 1) * width;
+
+      if (width >= src_width && end > next)
+         scale->blend[x] = (uint8)(((end - next) * VIDSCALE_BLEND_ONE + src_width / 2) / src_width);
+      if (scale->blend[x])
+         blended = true;
+      if (scale->col[x] < src_x + src_width - 1)
+         scale->blend_end = x + 1;
+   }
+
+   /* a pixel each, say: nothing to mix, the nearest rows are the same */
+   if (false == blended)
+      scale->blend_end = 0;
+   scale->smooth = false;
+
+   /* rows only ever go down the source, lines shrunk away get none */
+   for (y = 0, line = 0; y < height; y++)
+   {
+      scale->line[y] = src_y + (y * src_height) / height;
+      while (line <= scale->line[y])
+         scale->first_row[line++] = y;
+   }
+
+   while (line <= VIDSCALE_MAX_LINES)
+      scale->first_row[line++] = height;
+
+   return 0;
+}
+
+/* the biggest <width>x<height> fits on the LCD, for pixels <num>:<den> wide */
+static void vidscale_fit(int src_width, int src_height, int num, int den,
+                         int lcd_width, int lcd_height, int *width, int *height)
+{
+   *height = lcd_height;
+   *width = (src_width * num * lcd_height) / (src_height * den);
+   if (*width > lcd_width)
+   {
+      *width = lcd_width;
+      *height = (lcd_width * src_height * den) / (src_width * num);
+   }
+}
+
+int vidscale_setmode(vidscale_t *scale, int mode, int src_x, int src_y,
+                     int src_width, int src_height, int lcd_width, int lcd_height)
+{
+   int width, height;
+
+   switch (mode)
+   {
+   case VIDSCALE_1X:
+      width = (src_width < lcd_width) ? src_width : lcd_width;
+      height = (src_height < lcd_height) ? src_height : lcd_height;
+      break;
+
+   case VIDSCALE_8_7:
+      vidscale_fit(src_width, src_height, 8, 7, lcd_width, lcd_height, &width, &height);
+      break;
+
+   case VIDSCALE_4_3:
+      vidscale_fit(src_width, src_height, 5, 4, lcd_width, lcd_height, &width, &height);
+      break;
+
+   case VIDSCALE_CROPPED:
+      if (src_width > 4 * VIDSCALE_CROP && src_height > 4 * VIDSCALE_CROP)
+      {
+         src_x += VIDSCALE_CROP;
+         src_y += VIDSCALE_CROP;
+         src_width -= 2 * VIDSCALE_CROP;
+         src_height -= 2 * VIDSCALE_CROP;
+      }
+      /* fall through */
+
+   case VIDSCALE_STRETCH:
+      width = lcd_width;
+      height = lcd_height;
+      break;
+
+   default:
+      return -1;
+   }
+
+   if (vidscale_init(scale, src_x, src_y, src_width, src_height, width, height))
+      return -1;
+
+   scale->x = (lcd_width - width) / 2;
+   scale->y = (lcd_height - height) / 2;
+
+   return 0;
+}
+
+void vidscale_setpalette(vidscale_t *scale, const uint16 *rgb565)
+{
+   int i;
+
+   for (i = 0; i < 256; i++)
+   {
+      scale->palette[i] = VIDSCALE_SWAP(rgb565[i]);
+      scale->spread[i] = VIDSCALE_SPREAD(rgb565[i]);
+   }
+}
+
+void vidscale_row(const vidscale_t *scale, const uint8 *src, uint16 *dest)
+{
+   const uint16 *palette = scale->palette;
+   const uint16 *col = scale->col;
+   int x;
+
+#define VIDSCALE_PALETTE(p) palette[p]
+   VIDSCALE_EXPAND(uint8, VIDSCALE_PALETTE);
+#undef VIDSCALE_PALETTE
+
+   for (x = scale->tail_x; x < scale->width; x++)
+      dest[x] = palette[src[col[x]]];
+}
+
+void vidscale_smoothrow(const vidscale_t *scale, const uint8 *src, uint16 *dest)
+{
+   const uint32 *spread = scale->spread;
+   const uint16 *col = scale->col;
+   const uint8 *blend = scale->blend;
+   int x;
+
+   /* every column mixed, those with no weight to a pixel of their own */
+   for (x = 0; x < scale->blend_end; x++)
+   {
+      const uint8 *s = src + col[x];
+      dest[x] = vidscale_blend(spread[s[0]], spread[s[1]], blend[x]);
+   }
+
+   for (; x < scale->width; x++)
+      dest[x] = scale->palette[src[col[x]]];
+}
+
+void vidscale_fill(const vidscale_t *scale, uint8 *const *lines,
+                   int first_row, int num_rows, uint16 *dest)
+{
+   int y;
+
+   ASSERT(first_row >= 0 && first_row + num_rows <= scale->height);
+
+   for (y = first_row; y < first_row + num_rows; y++, dest += scale->width)
+   {
+      /* shown again, it's the row just made */
+      if (y > first_row && scale->line[y] == scale->line[y - 1])
+         memcpy(dest, dest - scale->width, scale->width * sizeof(uint16));
+      else if (scale->smooth && scale->blend_end)
+         vidscale_smoothrow(scale, lines[scale->line[y]], dest);
+      else
+         vidscale_row(scale, lines[scale->line[y]], dest);
+   }
+}
+
+int vidscale_band(const vidscale_t *scale, uint8 *const *lines,
+                  int first_line, int num_lines, uint16 *dest)
+{
+   int first_row, end_row;
+
+   ASSERT(first_line >= 0 && first_line + num_lines <= VIDSCALE_MAX_LINES);
+
+   first_row = scale->first_row[first_line];
+   end_row = scale->first_row[first_line + num_lines];
+   vidscale_fill(scale, lines, first_row, end_row - first_row, dest);
+
+   return end_row - first_row;
+}
+
+void vidscale_row16(const vidscale_t *scale, const uint16 *src, uint16 *dest)
+{
+   const uint16 *col = scale->col;
+   int x;
+
+#define VIDSCALE_RGB565(p) (p)
+   VIDSCALE_EXPAND(uint16, VIDSCALE_RGB565);
+#undef VIDSCALE_RGB565
+
+   for (x = scale->tail_x; x < scale->width; x++)
+      dest[x] = src[col[x]];
+}
+
+void vidscale_smoothrow16(const vidscale_t *scale, const uint16 *src, uint16 *dest)
+{
+   const uint16 *col = scale->col;
+   const uint8 *blend = scale->blend;
+   int x;
+
+   for (x = 0; x < scale->blend_end; x++)
+   {
+      const uint16 *s = src + col[x];
+      uint16 a = VIDSCALE_SWAP(s[0]), b = VIDSCALE_SWAP(s[1]);
+      dest[x] = vidscale_blend(VIDSCALE_SPREAD(a), VIDSCALE_SPREAD(b), blend[x]);
+   }
+
+   for (; x < scale->width; x++)
+      dest[x] = src[col[x]];
+}
+
+void vidscale_fill16(const vidscale_t *scale, uint16 *const *lines,
+                     int first_row, int num_rows, uint16 *dest)
+{
+   int y;
+
+   ASSERT(first_row >= 0 && first_row + num_rows <= scale->height);
+
+   for (y = first_row; y < first_row + num_rows; y++, dest += scale->width)
+   {
+      if (y > first_row && scale->line[y] == scale->line[y - 1])
+         memcpy(dest, dest - scale->width, scale->width * sizeof(uint16));
+      else if (scale->smooth && scale->blend_end)
+         vidscale_smoothrow16(scale, lines[scale->line[y]], dest);
+      else
+         vidscale_row16(scale, lines[scale->line[y]], dest);
+   }
+}
+
+int vidscale_band16(const vidscale_t *scale, uint16 *const *lines,
+                    int first_line, int num_lines, uint16 *dest)
+{
+   int first_row, end_row;
+
+   ASSERT(first_line >= 0 && first_line + num_lines <= VIDSCALE_MAX_LINES);
+
+   first_row = scale->first_row[first_line];
+   end_row = scale->first_row[first_line + num_lines];
+   vidscale_fill16(scale, lines, first_row, end_row - first_row, dest);
+
+   return end_row - first_row;
+}
@@ -0,0 +1,125 @@
+/*
+** vid_scale.h
+**
+** 8-bit NES lines to the LCD's RGB565, scaled nearest neighbour or
+** smooth, a row or a band of lines at a time.  Plain C with no hardware behind
+** it, so the host tools run the same code the display does.
+*/
+
+#ifndef _VID_SCALE_H_
+#define _VID_SCALE_H_
+
+#include "noftypes.h"
+
+#define VIDSCALE_MAX_WIDTH 480
+#define VIDSCALE_MAX_HEIGHT 320
+#define VIDSCALE_MAX_LINES 240
+
+/* how the NES window goes on the LCD */
+enum
+{
+   VIDSCALE_STRETCH = 0, /* over the whole LCD */
+   VIDSCALE_1X,          /* a pixel each, in the middle */
+   VIDSCALE_8_7,         /* pixels 8:7 wide, as NTSC shows them */
+   VIDSCALE_4_3,         /* pixels 5:4 wide, a whole frame 4:3 */
+   VIDSCALE_CROPPED,     /* VIDSCALE_CROP more cut off each edge, stretched */
+   VIDSCALE_MODES
+};
+
+#define VIDSCALE_CROP 8
+
+/* smooth columns mix 2 source pixels in 1/VIDSCALE_BLEND_ONE steps */
+#define VIDSCALE_BLEND_ONE 32
+
+typedef struct vidscale_s
+{
+   int src_x, src_y, src_width, src_height; /* NES pixels in */
+   int x, y, width, height;                 /* LCD pixels out */
+
+   /* RGB565 of each 8-bit pixel value, bytes swapped for the bus */
+   uint16 palette[256];
+
+   /* the same unswapped, each channel in its own field of a word for
+   ** the smooth rows: green in the top half, red and blue in the bottom
+   */
+   uint32 spread[256];
+
+   /* source pixel of each output column, source line of each output
+   ** row, and the first output row of each source line (and the end);
+   ** lines off the top of the window have none, and those off the
+   ** bottom start at the end
+   */
+   uint16 col[VIDSCALE_MAX_WIDTH];
+   uint8 line[VIDSCALE_MAX_HEIGHT];
+   uint16 first_row[VIDSCALE_MAX_LINES + 1];
+
+   /* the same columns in <groups> of 4 source pixels, bit i of each
+   ** <doubled> for pixel i making 2, when none make more; the rest,
+   ** from column <tail_x>, from col[]
+   */
+   int groups, tail_x;
+   uint8 doubled[VIDSCALE_MAX_WIDTH / 4];
+
+   /* for smooth rows, how much of each column's width the source pixel
+   ** after its col[] one covers, in 1/VIDSCALE_BLEND_ONE; none from
+   ** column <blend_end>, where col[] is the last, nor when shrinking.
+   ** The fills make smooth rows while <smooth> is set, unless no
+   ** column mixes and <blend_end> is 0
+   */
+   uint8 blend[VIDSCALE_MAX_WIDTH];
+   int blend_end;
+   bool smooth;
+} vidscale_t;
+
+/* the tables for the <src_width>x<src_height> of the lines at <src_x>,
+** <src_y> onto <width>x<height>, -1 if either is too big; rows are
+** nearest neighbour until <smooth> is set
+*/
+extern int vidscale_init(vidscale_t *scale, int src_x, int src_y,
+                         int src_width, int src_height, int width, int height);
+
+/* the same for the window at <src_x>, <src_y> shown in <mode> on a
+** <lcd_width>x<lcd_height> LCD; <x>, <y> is where on it the rows go,
+** and the rest of it is border
+*/
+extern int vidscale_setmode(vidscale_t *scale, int mode, int src_x, int src_y,
+                            int src_width, int src_height, int lcd_width, int lcd_height);
+extern void vidscale_setpalette(vidscale_t *scale, const uint16 *rgb565);
+
+/* one output row from one source line */
+extern void vidscale_row(const vidscale_t *scale, const uint8 *src, uint16 *dest);
+
+/* the same with each column that straddles 2 source pixels a mix of
+** them, so they all come out the same width on average
+*/
+extern void vidscale_smoothrow(const vidscale_t *scale, const uint8 *src, uint16 *dest);
+
+/* <num_rows> output rows from <first_row> on, one after the other in
+** <dest>; a row showing the same line as the one above is copied
+*/
+extern void vidscale_fill(const vidscale_t *scale, uint8 *const *lines,
+                          int first_row, int num_rows, uint16 *dest);
+
+/* all the output rows source lines <first_line> on make, one after the
+** other in <dest>; returns how many
+*/
+extern int vidscale_band(const vidscale_t *scale, uint8 *const *lines,
+                         int first_line, int num_lines, uint16 *dest);
+
+/* the same from lines the PPU resolved to RGB565 already (NOFRENDO_RGB565),
+** which only need scaling
+*/
+extern void vidscale_row16(const vidscale_t *scale, const uint16 *src, uint16 *dest);
+extern void vidscale_smoothrow16(const vidscale_t *scale, const uint16 *src, uint16 *dest);
+extern void vidscale_fill16(const vidscale_t *scale, uint16 *const *lines,
+                            int first_row, int num_rows, uint16 *dest);
+extern int vidscale_band16(const vidscale_t *scale, uint16 *const *lines,
+                           int first_line, int num_lines, uint16 *dest);
+
+/* how many that'll be */
+INLINE int vidscale_rows(const vidscale_t *scale, int first_line, int num_lines)
+{
+   return scale->first_row[first_line + num_lines] - scale->first_row[first_line];
+}
+
+#endif /* _VID_SCALE_H_ */